@@ -6,29 +6,67 @@ layout(location = 2) in vec3 in_normal;
 
 layout(location = 0) out vec3 out_color;
 layout(location = 1) out vec3 out_normal;
+invariant gl_Position;
 
 layout(set = 0, binding = 1) uniform ModelUniforms
 {
 	vec4 u_color;
 	mat4 u_model_mat;
 	vec4 u_material_factors;
+	vec4 u_position_scale;
+	vec4 u_position_offset;
+	uvec4 u_vertex_layout;
+	uvec4 u_instancing;
 };
 layout(set = 0, binding = 0) uniform CameraUniforms
 {
 	mat4 u_view_projection_mat;
 	vec4 u_camera_position;
 };
+// Layout of GpuInstance, drawn by GPU culling
+struct Instance
+{
+	mat4 model_mat;
+	vec4 color;
+	vec4 material_factors;
+	vec4 bounding_sphere;
+	vec4 aabb_min;
+	vec4 aabb_max;
+	uvec4 draw;
+};
+layout(std430, set = 0, binding = 8) readonly buffer Instances
+{
+	Instance u_instances[];
+};
 layout(set = 0, binding = 3) uniform DirectionalLight
 {
 	vec4 direction;
 	vec4 color;
 } u_directional_light;
-layout(set = 0, binding = 4) uniform PointLight
+layout(set = 0, binding = 4) uniform LightClusterUniforms
+{
+	mat4 view_mat;
+	mat4 inverse_projection_mat;
+	uvec4 grid_size;
+	vec4 screen;
+} u_clusters;
+
+struct PointLight
 {
 	vec4 position;
 	vec4 color;
 	vec4 attenuation;
-} u_point_light;
+};
+layout(std430, set = 0, binding = 6) readonly buffer PointLights
+{
+	PointLight u_point_lights[];
+};
+layout(std430, set = 0, binding = 7) readonly buffer ClusterLights
+{
+	uint u_cluster_lights[];
+};
+
+const uint CLUSTER_STRIDE = 64;
 
 float point_diffuse(vec3 N, vec3 L, vec4 a) {
 	float angle = max(0.0, dot(N, normalize(L)));
@@ -54,6 +92,28 @@ float ortho_diffuse(vec3 N, vec3 L) {
 	return max(0.0, dot(N, normalize(L)));
 }
 
+uint cluster_index(vec2 frag_coord, float view_depth)
+{
+	uvec3 grid = u_clusters.grid_size.xyz;
+	float near = u_clusters.screen.z;
+	float far = u_clusters.screen.w;
+	uvec2 tile = uvec2(clamp(frag_coord / u_clusters.screen.xy, 0.0, 0.9999) * vec2(grid.xy));
+	float slice = log(max(view_depth, near) / near) / log(far / near) * float(grid.z);
+	uint z = uint(clamp(slice, 0.0, float(grid.z - 1)));
+	return (z * grid.y + tile.y) * grid.x + tile.x;
+}
+
+// Smoothly fades a light to zero at its radius of influence
+float point_window(float d, float radius)
+{
+	if (radius <= 0.0)
+		return 1.0;
+	float x = d / radius;
+	x = x * x;
+	float w = clamp(1.0 - x * x, 0.0, 1.0);
+	return w * w;
+}
+
 float fresnel_schlick(vec3 N, vec3 V, float ior)
 {
 	float R0 = (1 - ior) / (1 + ior);
@@ -104,12 +164,42 @@ vec3 clampedReflect(vec3 I, vec3 N) {
 	return I - 2.0 * min(dot(N, I), 0.0) * N;
 }
 
+// Undoes the quantization of VertexLayout::Compact, identity for float vertices
+vec3 decode_position()
+{
+	return in_position * u_position_scale.xyz + u_position_offset.xyz;
+}
+
+vec3 decode_normal()
+{
+	if (u_vertex_layout.x == 0u)
+		return in_normal;
+	// octahedral encoding, the lower hemisphere is folded over the diagonals
+	vec3 n = vec3(in_normal.xy, 1.0 - abs(in_normal.x) - abs(in_normal.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
 void main() {
-	gl_Position = u_view_projection_mat * u_model_mat * vec4(in_position, 1.0);
-	vec3 color = in_color.rgb * mix(vec3(1.0), u_color.rgb, u_color.a);
-	out_normal = normalize(mat3(transpose(inverse(u_model_mat))) * in_normal);
+	mat4 model_mat = u_model_mat;
+	vec4 model_color = u_color;
+	vec4 material_factors = u_material_factors;
+	if (u_instancing.x != 0u)
+	{
+		Instance instance = u_instances[gl_InstanceIndex];
+		model_mat = instance.model_mat;
+		model_color = instance.color;
+		material_factors = instance.material_factors;
+	}
+	vec3 position = decode_position();
+	vec3 normal = decode_normal();
+	gl_Position = u_view_projection_mat * model_mat * vec4(position, 1.0);
+	vec3 color = in_color.rgb * mix(vec3(1.0), model_color.rgb, model_color.a);
+	out_normal = normalize(mat3(transpose(inverse(model_mat))) * normal);
 
-	vec3 P = (u_model_mat * vec4(in_position, 1.0)).xyz;
+	vec3 P = (model_mat * vec4(position, 1.0)).xyz;
 	vec3 V = u_camera_position.xyz - P;
 
 	if(dot(V, out_normal) <= 0.0) {
@@ -122,16 +212,26 @@ void main() {
 
 		vec3 L = -u_directional_light.direction.xyz;
 		diffuse += ortho_diffuse(N, L) * u_directional_light.color.rgb * u_directional_light.color.a;
-		specular += ortho_specular(N, L, V, u_material_factors.w) * u_directional_light.color.rgb * u_directional_light.color.a;
+		specular += ortho_specular(N, L, V, material_factors.w) * u_directional_light.color.rgb * u_directional_light.color.a;
 		
-		L = u_point_light.position.xyz - P;
-		diffuse += point_diffuse(N, L, u_point_light.attenuation) * u_point_light.color.rgb * u_point_light.color.a;
-		specular += point_specular(N, L, V, u_material_factors.w) * u_point_light.color.rgb * u_point_light.color.a;
+		// lit per vertex, so the cluster is picked per vertex too, see LightClusters
+		// vertices outside of the viewport fall back to the closest edge cluster
+		vec2 frag_coord = (gl_Position.xy / max(gl_Position.w, 0.0001) * 0.5 + 0.5) * u_clusters.screen.xy;
+		uint cluster = cluster_index(frag_coord, -(u_clusters.view_mat * vec4(P, 1.0)).z) * CLUSTER_STRIDE;
+		uint cluster_light_count = u_cluster_lights[cluster];
+		for (uint i = 0; i < cluster_light_count; i++)
+		{
+			PointLight light = u_point_lights[u_cluster_lights[cluster + 1 + i]];
+			L = light.position.xyz - P;
+			vec3 radiance = light.color.rgb * light.color.a * point_window(length(L), light.position.w);
+			diffuse += point_diffuse(N, L, light.attenuation) * radiance;
+			specular += point_specular(N, L, V, material_factors.w) * radiance;
+		}
 
 		vec3 I = vec3(0.0);
-		I += u_material_factors.x * ambient * color;
-		I += u_material_factors.y * diffuse * color;
-		I += u_material_factors.z * specular;
+		I += material_factors.x * ambient * color;
+		I += material_factors.y * diffuse * color;
+		I += material_factors.z * specular;
 		I = mix(I, vec3(0.8, 1.0, 1.0), fresnel_schlick(N, V, 1.925));
 		out_color.rgb = I;
 	} else {
@@ -0,0 +1,50 @@
+#version 450
+
+layout(location = 0) in vec3 in_position;
+
+// The color pass tests EQUAL against the depth written here, so all vertex shaders compute the position alike
+invariant gl_Position;
+
+layout(set = 0, binding = 1) uniform ModelUniforms
+{
+	vec4 u_color;
+	mat4 u_model_mat;
+	vec4 u_material_factors;
+	vec4 u_position_scale;
+	vec4 u_position_offset;
+	uvec4 u_vertex_layout;
+	uvec4 u_instancing;
+};
+layout(set = 0, binding = 0) uniform CameraUniforms
+{
+	mat4 u_view_projection_mat;
+};
+// Layout of GpuInstance, drawn by GPU culling
+struct Instance
+{
+	mat4 model_mat;
+	vec4 color;
+	vec4 material_factors;
+	vec4 bounding_sphere;
+	vec4 aabb_min;
+	vec4 aabb_max;
+	uvec4 draw;
+};
+layout(std430, set = 0, binding = 8) readonly buffer Instances
+{
+	Instance u_instances[];
+};
+
+// Undoes the quantization of VertexLayout::Compact, identity for float vertices
+vec3 decode_position()
+{
+	return in_position * u_position_scale.xyz + u_position_offset.xyz;
+}
+
+void main() {
+	mat4 model_mat = u_model_mat;
+	if (u_instancing.x != 0u)
+		model_mat = u_instances[gl_InstanceIndex].model_mat;
+	vec3 position = decode_position();
+	gl_Position = u_view_projection_mat * model_mat * vec4(position, 1.0);
+}
@@ -0,0 +1,31 @@
+#version 450
+
+layout(location = 0) in vec3 in_position;
+
+layout(push_constant) uniform DepthConstants
+{
+	mat4 u_view_projection_mat;
+	vec4 u_position_scale;
+	vec4 u_position_offset;
+};
+
+// Layout of GpuInstance
+struct Instance
+{
+	mat4 model_mat;
+	vec4 color;
+	vec4 material_factors;
+	vec4 bounding_sphere;
+	vec4 aabb_min;
+	vec4 aabb_max;
+	uvec4 draw;
+};
+layout(std430, set = 0, binding = 0) readonly buffer Instances
+{
+	Instance u_instances[];
+};
+
+void main() {
+	vec3 position = in_position * u_position_scale.xyz + u_position_offset.xyz;
+	gl_Position = u_view_projection_mat * u_instances[gl_InstanceIndex].model_mat * vec4(position, 1.0);
+}
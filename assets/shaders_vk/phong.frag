@@ -4,6 +4,7 @@ layout(location = 0) in vec3 in_color;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec3 in_position;
 layout(location = 3) in vec2 in_uv;
+layout(location = 4) flat in vec4 in_material_factors;
 
 layout(location = 0) out vec4 out_color;
 
@@ -22,20 +23,31 @@ layout(set = 0, binding = 3) uniform DirectionalLight
 	vec4 color;
 }
 u_directional_light;
-layout(set = 0, binding = 4) uniform PointLight
+layout(set = 0, binding = 4) uniform LightClusterUniforms
+{
+	mat4 view_mat;
+	mat4 inverse_projection_mat;
+	uvec4 grid_size;
+	vec4 screen;
+}
+u_clusters;
+
+struct PointLight
 {
 	vec4 position;
 	vec4 color;
 	vec4 attenuation;
-}
-u_point_light;
-layout(set = 0, binding = 1) uniform ModelUniforms
+};
+layout(std430, set = 0, binding = 6) readonly buffer PointLights
+{
+	PointLight u_point_lights[];
+};
+layout(std430, set = 0, binding = 7) readonly buffer ClusterLights
 {
-	vec4 u_color;
-	mat4 u_model_mat;
-	vec4 u_material_factors;
+	uint u_cluster_lights[];
 };
 
+const uint CLUSTER_STRIDE = 64;
 layout (binding = 5) uniform sampler2D diffuse_texture;
 
 float point_diffuse(vec3 N, vec3 L, vec4 a)
@@ -65,6 +77,28 @@ float ortho_diffuse(vec3 N, vec3 L)
 	return max(0.0, dot(N, normalize(L)));
 }
 
+uint cluster_index(vec2 frag_coord, float view_depth)
+{
+	uvec3 grid = u_clusters.grid_size.xyz;
+	float near = u_clusters.screen.z;
+	float far = u_clusters.screen.w;
+	uvec2 tile = uvec2(clamp(frag_coord / u_clusters.screen.xy, 0.0, 0.9999) * vec2(grid.xy));
+	float slice = log(max(view_depth, near) / near) / log(far / near) * float(grid.z);
+	uint z = uint(clamp(slice, 0.0, float(grid.z - 1)));
+	return (z * grid.y + tile.y) * grid.x + tile.x;
+}
+
+// Smoothly fades a light to zero at its radius of influence
+float point_window(float d, float radius)
+{
+	if (radius <= 0.0)
+		return 1.0;
+	float x = d / radius;
+	x = x * x;
+	float w = clamp(1.0 - x * x, 0.0, 1.0);
+	return w * w;
+}
+
 float fresnel_schlick(vec3 N, vec3 V, float ior)
 {
 	float R0 = (1 - ior) / (1 + ior);
@@ -144,18 +178,25 @@ void main()
 
 	vec3 L = -u_directional_light.direction.xyz;
 	diffuse += ortho_diffuse(N, L) * u_directional_light.color.rgb * u_directional_light.color.a;
-	specular += ortho_specular(N, L, V, u_material_factors.w) * u_directional_light.color.rgb * u_directional_light.color.a;
+	specular += ortho_specular(N, L, V, in_material_factors.w) * u_directional_light.color.rgb * u_directional_light.color.a;
 	
-	L = u_point_light.position.xyz - P;
-	diffuse += point_diffuse(N, L, u_point_light.attenuation) * u_point_light.color.rgb * u_point_light.color.a;
-	specular += point_specular(N, L, V, u_material_factors.w) * u_point_light.color.rgb * u_point_light.color.a;
+	uint cluster = cluster_index(gl_FragCoord.xy, -(u_clusters.view_mat * vec4(P, 1.0)).z) * CLUSTER_STRIDE;
+	uint cluster_light_count = u_cluster_lights[cluster];
+	for (uint i = 0; i < cluster_light_count; i++)
+	{
+		PointLight light = u_point_lights[u_cluster_lights[cluster + 1 + i]];
+		L = light.position.xyz - P;
+		vec3 radiance = light.color.rgb * light.color.a * point_window(length(L), light.position.w);
+		diffuse += point_diffuse(N, L, light.attenuation) * radiance;
+		specular += point_specular(N, L, V, in_material_factors.w) * radiance;
+	}
 	
 	vec3 diffuse_color = texture(diffuse_texture, in_uv).rgb * in_color.rgb;
 
 	vec3 I = vec3(0.0);
-	I += u_material_factors.x * ambient * diffuse_color;
-	I += u_material_factors.y * diffuse * diffuse_color;
-	I += u_material_factors.z * specular;
+	I += in_material_factors.x * ambient * diffuse_color;
+	I += in_material_factors.y * diffuse * diffuse_color;
+	I += in_material_factors.z * specular;
 	I = mix(I, getCornellBoxReflectionColor(P, clampedReflect(normalize(-V), N)), fresnel_schlick(N, V, 1.925));
 	out_color.rgb = I;
 }
\ No newline at end of file
@@ -9,23 +9,75 @@ layout(location = 0) out vec3 out_color;
 layout(location = 1) out vec3 out_normal;
 layout(location = 2) out vec3 out_position;
 layout(location = 3) out vec2 out_uv;
+layout(location = 4) flat out vec4 out_material_factors;
+invariant gl_Position;
 
 layout(set = 0, binding = 1) uniform ModelUniforms
 {
 	vec4 u_color;
 	mat4 u_model_mat;
 	vec4 u_material_factors;
+	vec4 u_position_scale;
+	vec4 u_position_offset;
+	uvec4 u_vertex_layout;
+	uvec4 u_instancing;
 };
 layout(set = 0, binding = 0) uniform CameraUniforms
 {
 	mat4 u_view_projection_mat;
 	vec4 u_camera_position;
 };
+// Layout of GpuInstance, drawn by GPU culling
+struct Instance
+{
+	mat4 model_mat;
+	vec4 color;
+	vec4 material_factors;
+	vec4 bounding_sphere;
+	vec4 aabb_min;
+	vec4 aabb_max;
+	uvec4 draw;
+};
+layout(std430, set = 0, binding = 8) readonly buffer Instances
+{
+	Instance u_instances[];
+};
+
+// Undoes the quantization of VertexLayout::Compact, identity for float vertices
+vec3 decode_position()
+{
+	return in_position * u_position_scale.xyz + u_position_offset.xyz;
+}
+
+vec3 decode_normal()
+{
+	if (u_vertex_layout.x == 0u)
+		return in_normal;
+	// octahedral encoding, the lower hemisphere is folded over the diagonals
+	vec3 n = vec3(in_normal.xy, 1.0 - abs(in_normal.x) - abs(in_normal.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
 
 void main() {
-	gl_Position = u_view_projection_mat * u_model_mat * vec4(in_position, 1.0);
-	out_color.rgb = in_color.rgb * mix(vec3(1.0), u_color.rgb, u_color.a);
-	out_normal = normalize(mat3(transpose(inverse(u_model_mat))) * in_normal);
-	out_position = (u_model_mat * vec4(in_position, 1.0)).xyz;
+	mat4 model_mat = u_model_mat;
+	vec4 model_color = u_color;
+	vec4 material_factors = u_material_factors;
+	if (u_instancing.x != 0u)
+	{
+		Instance instance = u_instances[gl_InstanceIndex];
+		model_mat = instance.model_mat;
+		model_color = instance.color;
+		material_factors = instance.material_factors;
+	}
+	vec3 position = decode_position();
+	vec3 normal = decode_normal();
+	gl_Position = u_view_projection_mat * model_mat * vec4(position, 1.0);
+	out_color.rgb = in_color.rgb * mix(vec3(1.0), model_color.rgb, model_color.a);
+	out_normal = normalize(mat3(transpose(inverse(model_mat))) * normal);
+	out_position = (model_mat * vec4(position, 1.0)).xyz;
 	out_uv = in_uv;
+	out_material_factors = material_factors;
 }
\ No newline at end of file
@@ -0,0 +1,332 @@
+#include "BlockCompression.h"
+#include "Dds.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <filesystem>
+
+#undef min
+#undef max
+
+#pragma region BlockEncoder
+uint16_t packRgb565(const float *color)
+{
+	uint32_t r = uint32_t(std::clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	uint32_t g = uint32_t(std::clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+	uint32_t b = uint32_t(std::clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	return uint16_t((r << 11) | (g << 5) | b);
+}
+
+void unpackRgb565(uint16_t packed, float *color)
+{
+	uint32_t r = (packed >> 11) & 31;
+	uint32_t g = (packed >> 5) & 63;
+	uint32_t b = packed & 31;
+	color[0] = float((r << 3) | (r >> 2));
+	color[1] = float((g << 2) | (g >> 4));
+	color[2] = float((b << 3) | (b >> 2));
+}
+
+// Encodes the colors of the block in 4 color mode, the endpoints are the extremes along the principal axis
+void compressColorBlock(const uint8_t *rgba, uint8_t *block)
+{
+	float pixels[16][3];
+	float mean[3] = {0, 0, 0};
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			pixels[i][c] = float(rgba[i * 4 + c]);
+			mean[c] += pixels[i][c] / 16.0f;
+		}
+	}
+
+	float covariance[3][3] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float d[3] = {pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2]};
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				covariance[r][c] += d[r] * d[c];
+			}
+		}
+	}
+
+	// A few power iterations are enough to find the dominant direction
+	float axis[3] = {1, 1, 1};
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[3];
+		for (int r = 0; r < 3; r++)
+		{
+			next[r] = covariance[r][0] * axis[0] + covariance[r][1] * axis[1] + covariance[r][2] * axis[2];
+		}
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length < 1e-6f)
+			break;
+		for (int c = 0; c < 3; c++)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+
+	float t_min = 0, t_max = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] + (pixels[i][2] - mean[2]) * axis[2];
+		t_min = std::min(t_min, t);
+		t_max = std::max(t_max, t);
+	}
+	// Insetting the endpoints a little reduces the average error, the extremes are rarely hit exactly
+	float inset = (t_max - t_min) / 16.0f;
+	t_min += inset;
+	t_max -= inset;
+	float endpoint_0[3], endpoint_1[3];
+	for (int c = 0; c < 3; c++)
+	{
+		endpoint_0[c] = mean[c] + axis[c] * t_max;
+		endpoint_1[c] = mean[c] + axis[c] * t_min;
+	}
+
+	uint16_t color_0 = packRgb565(endpoint_0);
+	uint16_t color_1 = packRgb565(endpoint_1);
+	// color_0 > color_1 selects the 4 color mode
+	if (color_0 < color_1)
+		std::swap(color_0, color_1);
+
+	uint32_t indices = 0;
+	if (color_0 != color_1)
+	{
+		float palette[4][3];
+		unpackRgb565(color_0, palette[0]);
+		unpackRgb565(color_1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			uint32_t best_index = 0;
+			float best_distance = INFINITY;
+			for (uint32_t p = 0; p < 4; p++)
+			{
+				float d0 = pixels[i][0] - palette[p][0];
+				float d1 = pixels[i][1] - palette[p][1];
+				float d2 = pixels[i][2] - palette[p][2];
+				float distance = d0 * d0 + d1 * d1 + d2 * d2;
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best_index = p;
+				}
+			}
+			indices |= best_index << (2 * i);
+		}
+	}
+
+	std::memcpy(block, &color_0, 2);
+	std::memcpy(block + 2, &color_1, 2);
+	std::memcpy(block + 4, &indices, 4);
+}
+
+// Encodes the alpha channel in 8 value mode between the minimum and maximum alpha of the block
+void compressAlphaBlock(const uint8_t *rgba, uint8_t *block)
+{
+	uint8_t alpha_0 = 0, alpha_1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		alpha_0 = std::max(alpha_0, rgba[i * 4 + 3]);
+		alpha_1 = std::min(alpha_1, rgba[i * 4 + 3]);
+	}
+
+	uint64_t indices = 0;
+	if (alpha_0 != alpha_1)
+	{
+		float palette[8] = {float(alpha_0), float(alpha_1)};
+		for (int p = 1; p < 7; p++)
+		{
+			palette[p + 1] = (float(7 - p) * alpha_0 + float(p) * alpha_1) / 7.0f;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			uint64_t best_index = 0;
+			float best_distance = INFINITY;
+			for (uint64_t p = 0; p < 8; p++)
+			{
+				float distance = std::abs(float(rgba[i * 4 + 3]) - palette[p]);
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best_index = p;
+				}
+			}
+			indices |= best_index << (3 * i);
+		}
+	}
+
+	block[0] = alpha_0;
+	block[1] = alpha_1;
+	for (int i = 0; i < 6; i++)
+	{
+		block[2 + i] = uint8_t(indices >> (8 * i));
+	}
+}
+
+void compressBc1Block(const uint8_t *rgba, uint8_t *block)
+{
+	compressColorBlock(rgba, block);
+}
+
+void compressBc3Block(const uint8_t *rgba, uint8_t *block)
+{
+	compressAlphaBlock(rgba, block);
+	compressColorBlock(rgba, block + 8);
+}
+#pragma endregion
+
+std::vector<uint8_t> compressImage(const uint8_t *rgba, VkExtent2D extent, bool has_alpha, uint32_t thread_count)
+{
+	uint32_t blocks_x = std::max(1u, (extent.width + 3) / 4);
+	uint32_t blocks_y = std::max(1u, (extent.height + 3) / 4);
+	size_t block_size = has_alpha ? 16 : 8;
+	std::vector<uint8_t> result(size_t(blocks_x) * blocks_y * block_size);
+
+	// Rows of blocks are distributed over the threads
+	auto compress_rows = [&](uint32_t first_row, uint32_t end_row)
+	{
+		uint8_t pixels[16 * 4];
+		for (uint32_t by = first_row; by < end_row; by++)
+		{
+			for (uint32_t bx = 0; bx < blocks_x; bx++)
+			{
+				// Blocks at the border of images which are not a multiple of 4 repeat the last row and column
+				for (uint32_t y = 0; y < 4; y++)
+				{
+					for (uint32_t x = 0; x < 4; x++)
+					{
+						uint32_t px = std::min(bx * 4 + x, extent.width - 1);
+						uint32_t py = std::min(by * 4 + y, extent.height - 1);
+						std::memcpy(pixels + (y * 4 + x) * 4, rgba + (size_t(py) * extent.width + px) * 4, 4);
+					}
+				}
+				uint8_t *block = result.data() + (size_t(by) * blocks_x + bx) * block_size;
+				if (has_alpha)
+					compressBc3Block(pixels, block);
+				else
+					compressBc1Block(pixels, block);
+			}
+		}
+	};
+
+	thread_count = std::clamp(thread_count, 1u, blocks_y);
+	uint32_t rows_per_thread = (blocks_y + thread_count - 1) / thread_count;
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < thread_count; i++)
+	{
+		threads.emplace_back(compress_rows, std::min(i * rows_per_thread, blocks_y), std::min((i + 1) * rows_per_thread, blocks_y));
+	}
+	compress_rows(0, std::min(rows_per_thread, blocks_y));
+	for (auto &&thread : threads)
+	{
+		thread.join();
+	}
+	return result;
+}
+
+// Halves the extent with a box filter, odd rows and columns are clamped
+std::vector<uint8_t> downsampleImage(const std::vector<uint8_t> &rgba, VkExtent2D extent, VkExtent2D &next_extent)
+{
+	next_extent = {std::max(1u, extent.width / 2), std::max(1u, extent.height / 2)};
+	std::vector<uint8_t> result(size_t(next_extent.width) * next_extent.height * 4);
+	for (uint32_t y = 0; y < next_extent.height; y++)
+	{
+		for (uint32_t x = 0; x < next_extent.width; x++)
+		{
+			uint32_t x0 = std::min(x * 2, extent.width - 1), x1 = std::min(x * 2 + 1, extent.width - 1);
+			uint32_t y0 = std::min(y * 2, extent.height - 1), y1 = std::min(y * 2 + 1, extent.height - 1);
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				uint32_t sum = rgba[(size_t(y0) * extent.width + x0) * 4 + c] + rgba[(size_t(y0) * extent.width + x1) * 4 + c] +
+							   rgba[(size_t(y1) * extent.width + x0) * 4 + c] + rgba[(size_t(y1) * extent.width + x1) * 4 + c];
+				result[(size_t(y) * next_extent.width + x) * 4 + c] = uint8_t((sum + 2) / 4);
+			}
+		}
+	}
+	return result;
+}
+
+// Copies a level of the file and converts it to RGBA
+std::vector<uint8_t> readRgbaLevel(const MappedFile &mapping, const DdsLevel &level, bool bgra)
+{
+	std::vector<uint8_t> rgba(level.size);
+	std::memcpy(rgba.data(), mapping.data + level.offset, level.size);
+	if (bgra)
+	{
+		for (size_t i = 0; i < rgba.size(); i += 4)
+		{
+			std::swap(rgba[i], rgba[i + 2]);
+		}
+	}
+	return rgba;
+}
+
+bool compressDdsFile(const std::string &source_path, const std::string &cache_path, uint32_t thread_count)
+{
+	MappedFile mapping(source_path);
+	DdsImage dds;
+	if (!parseDdsHeader(mapping.data, mapping.size, dds))
+		return false;
+	if (dds.format != VK_FORMAT_R8G8B8A8_UNORM && dds.format != VK_FORMAT_B8G8R8A8_UNORM)
+		return false;
+	bool bgra = dds.format == VK_FORMAT_B8G8R8A8_UNORM;
+
+	std::vector<uint8_t> rgba = readRgbaLevel(mapping, dds.levels[0], bgra);
+	bool has_alpha = false;
+	for (size_t i = 3; i < rgba.size(); i += 4)
+	{
+		has_alpha |= rgba[i] != 255;
+	}
+
+	// Block compressed levels cannot be generated on the GPU, so the full chain is built here.
+	// Levels of the file are used as long as it has them, the rest is downsampled from the previous level.
+	std::vector<std::vector<uint8_t>> levels;
+	VkExtent2D extent = dds.extent;
+	for (uint32_t level = 0;; level++)
+	{
+		levels.push_back(compressImage(rgba.data(), extent, has_alpha, thread_count));
+		if (extent.width == 1 && extent.height == 1)
+			break;
+		if (level + 1 < dds.levels.size())
+		{
+			extent = dds.levels[level + 1].extent;
+			rgba = readRgbaLevel(mapping, dds.levels[level + 1], bgra);
+		}
+		else
+		{
+			VkExtent2D next_extent;
+			rgba = downsampleImage(rgba, extent, next_extent);
+			extent = next_extent;
+		}
+	}
+
+	VkFormat format = has_alpha ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	return writeDdsFile(cache_path, format, dds.extent, levels);
+}
+
+std::string compressedDdsPath(const std::string &source_path, uint32_t thread_count)
+{
+	std::filesystem::path cache_path = std::filesystem::path(source_path).replace_extension(".bc.dds");
+	std::error_code error;
+	auto cache_time = std::filesystem::last_write_time(cache_path, error);
+	if (!error && cache_time >= std::filesystem::last_write_time(source_path, error) && !error)
+		return cache_path.string();
+	if (compressDdsFile(source_path, cache_path.string(), thread_count))
+		return cache_path.string();
+	return source_path;
+}
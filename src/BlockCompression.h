@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Encodes a 4x4 block of RGBA8 pixels, stored row by row
+void compressBc1Block(const uint8_t *rgba, uint8_t *block);
+void compressBc3Block(const uint8_t *rgba, uint8_t *block);
+
+// Encodes a whole RGBA8 image on up to thread_count threads, returns BC3 data if has_alpha is set and BC1 data otherwise
+std::vector<uint8_t> compressImage(const uint8_t *rgba, VkExtent2D extent, bool has_alpha, uint32_t thread_count);
+
+// Converts an uncompressed DDS file to BC1 (opaque) or BC3 (with alpha) including a full mip chain and writes it to
+// cache_path. Returns false if the source is not an uncompressed RGBA8 or BGRA8 file.
+bool compressDdsFile(const std::string &source_path, const std::string &cache_path, uint32_t thread_count);
+// Returns the path of the block compressed copy of an uncompressed file next to it, encoding it first if the copy
+// is missing or older than the source. Files the encoder does not support are returned as they are.
+// Callers that encode several files at once split the cores between them with thread_count.
+std::string compressedDdsPath(const std::string &source_path, uint32_t thread_count);
@@ -0,0 +1,363 @@
+#include "Bvh.h"
+
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+#undef min
+#undef max
+
+BvhBounds instanceBounds(MeshInstance &instance)
+{
+	glm::mat4 m = instance.get_model_matrix();
+	glm::vec3 aabb_min = instance.mesh->get_aabb_min();
+	glm::vec3 aabb_max = instance.mesh->get_aabb_max();
+	glm::vec3 center = glm::vec3(m * glm::vec4((aabb_min + aabb_max) * 0.5f, 1.0f));
+	glm::vec3 half_size = (aabb_max - aabb_min) * 0.5f;
+	glm::vec3 extent = glm::abs(glm::vec3(m[0])) * half_size.x + glm::abs(glm::vec3(m[1])) * half_size.y + glm::abs(glm::vec3(m[2])) * half_size.z;
+	return {center - extent, center + extent};
+}
+
+static BvhBounds emptyBounds()
+{
+	return {glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max())};
+}
+
+static void expandBounds(BvhBounds &bounds, const BvhBounds &other)
+{
+	bounds.aabb_min = glm::min(bounds.aabb_min, other.aabb_min);
+	bounds.aabb_max = glm::max(bounds.aabb_max, other.aabb_max);
+}
+
+static float surfaceArea(const BvhBounds &bounds)
+{
+	glm::vec3 size = glm::max(bounds.aabb_max - bounds.aabb_min, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// False if the box lies completely outside one of the planes
+static bool boxIntersectsFrustum(const std::array<glm::vec4, 6> &planes, glm::vec3 aabb_min, glm::vec3 aabb_max, bool &inside)
+{
+	glm::vec3 center = (aabb_min + aabb_max) * 0.5f;
+	glm::vec3 extent = (aabb_max - aabb_min) * 0.5f;
+	inside = true;
+	for (auto &&plane : planes)
+	{
+		float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+		float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+		if (distance < -radius)
+			return false;
+		inside = inside && distance >= radius;
+	}
+	return true;
+}
+
+static bool boxesOverlap(glm::vec3 a_min, glm::vec3 a_max, glm::vec3 b_min, glm::vec3 b_max)
+{
+	return glm::all(glm::lessThanEqual(a_min, b_max)) && glm::all(glm::lessThanEqual(b_min, a_max));
+}
+
+static bool boxOverlapsSphere(glm::vec3 aabb_min, glm::vec3 aabb_max, glm::vec3 center, float radius)
+{
+	glm::vec3 offset = center - glm::clamp(center, aabb_min, aabb_max);
+	return glm::dot(offset, offset) <= radius * radius;
+}
+
+#pragma region InstanceBvh
+void InstanceBvh::build(const std::vector<std::unique_ptr<MeshInstance>> &instances)
+{
+	uint32_t count = uint32_t(instances.size());
+	bounds.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		bounds[i] = instanceBounds(*instances[i]);
+	}
+	items.resize(count);
+	std::iota(items.begin(), items.end(), 0);
+	nodes.clear();
+	if (count == 0)
+		return;
+
+	// A binary tree with at least one item per leaf has at most 2n - 1 nodes, so threads never reallocate them
+	nodes.resize(2 * size_t(count) - 1);
+	node_count = 1;
+	uint32_t parallel_depth = uint32_t(std::log2(float(std::max(std::thread::hardware_concurrency(), 1u))));
+	build_node(0, 0, count, parallel_depth);
+	nodes.resize(node_count);
+}
+
+void InstanceBvh::build_node(uint32_t node_index, uint32_t first, uint32_t count, uint32_t parallel_depth)
+{
+	BvhBounds node_bounds = emptyBounds();
+	BvhBounds centroid_bounds = emptyBounds();
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		const BvhBounds &item = bounds[items[i]];
+		glm::vec3 centroid = (item.aabb_min + item.aabb_max) * 0.5f;
+		expandBounds(node_bounds, item);
+		expandBounds(centroid_bounds, {centroid, centroid});
+	}
+	BvhNode &node = nodes[node_index];
+	node = {node_bounds.aabb_min, first, node_bounds.aabb_max, count};
+	if (count <= BVH_MAX_LEAF_SIZE)
+		return;
+
+	glm::vec3 centroid_extent = centroid_bounds.aabb_max - centroid_bounds.aabb_min;
+	int axis = centroid_extent.x > centroid_extent.y ? (centroid_extent.x > centroid_extent.z ? 0 : 2) : (centroid_extent.y > centroid_extent.z ? 1 : 2);
+	// All centroids coincide, no plane separates them
+	if (centroid_extent[axis] <= 0.0f)
+		return;
+
+	float bin_scale = float(BVH_SAH_BINS) / centroid_extent[axis];
+	auto bin_of = [&](uint32_t item)
+	{
+		float centroid = (bounds[item].aabb_min[axis] + bounds[item].aabb_max[axis]) * 0.5f;
+		return std::min(uint32_t((centroid - centroid_bounds.aabb_min[axis]) * bin_scale), BVH_SAH_BINS - 1);
+	};
+	std::array<BvhBounds, BVH_SAH_BINS> bin_bounds;
+	std::array<uint32_t, BVH_SAH_BINS> bin_counts = {};
+	bin_bounds.fill(emptyBounds());
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		uint32_t bin = bin_of(items[i]);
+		expandBounds(bin_bounds[bin], bounds[items[i]]);
+		bin_counts[bin]++;
+	}
+
+	// Split s puts bins 0..s to the left, the sweeps accumulate both sides of every split
+	std::array<float, BVH_SAH_BINS - 1> left_cost;
+	BvhBounds left_bounds = emptyBounds();
+	uint32_t left_count = 0;
+	for (uint32_t s = 0; s < BVH_SAH_BINS - 1; s++)
+	{
+		expandBounds(left_bounds, bin_bounds[s]);
+		left_count += bin_counts[s];
+		left_cost[s] = surfaceArea(left_bounds) * float(left_count);
+	}
+	// Traversing a node costs as much as testing one item, the cost of a leaf is its item count
+	float node_area = std::max(surfaceArea(node_bounds), std::numeric_limits<float>::min());
+	float best_cost = float(count);
+	uint32_t best_split = BVH_SAH_BINS;
+	BvhBounds right_bounds = emptyBounds();
+	uint32_t right_count = 0;
+	for (uint32_t s = BVH_SAH_BINS - 1; s > 0; s--)
+	{
+		expandBounds(right_bounds, bin_bounds[s]);
+		right_count += bin_counts[s];
+		if (right_count == 0 || right_count == count)
+			continue;
+		float cost = 1.0f + (left_cost[s - 1] + surfaceArea(right_bounds) * float(right_count)) / node_area;
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			best_split = s - 1;
+		}
+	}
+	if (best_split == BVH_SAH_BINS)
+		return;
+
+	auto middle = std::partition(items.begin() + first, items.begin() + first + count, [&](uint32_t item)
+								 { return bin_of(item) <= best_split; });
+	uint32_t split_count = uint32_t(middle - (items.begin() + first));
+	uint32_t left = node_count.fetch_add(2);
+	node.first = left;
+	node.count = 0;
+	if (parallel_depth > 0 && count >= BVH_PARALLEL_MIN_ITEMS)
+	{
+		std::thread left_thread(&InstanceBvh::build_node, this, left, first, split_count, parallel_depth - 1);
+		build_node(left + 1, first + split_count, count - split_count, parallel_depth - 1);
+		left_thread.join();
+	}
+	else
+	{
+		build_node(left, first, split_count, 0);
+		build_node(left + 1, first + split_count, count - split_count, 0);
+	}
+}
+
+void InstanceBvh::refit(const std::vector<std::unique_ptr<MeshInstance>> &instances)
+{
+	for (size_t i = 0; i < bounds.size(); i++)
+	{
+		bounds[i] = instanceBounds(*instances[i]);
+	}
+	for (size_t n = nodes.size(); n-- > 0;)
+	{
+		BvhNode &node = nodes[n];
+		BvhBounds node_bounds = emptyBounds();
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				expandBounds(node_bounds, bounds[items[i]]);
+			}
+		}
+		else
+		{
+			expandBounds(node_bounds, {nodes[node.first].aabb_min, nodes[node.first].aabb_max});
+			expandBounds(node_bounds, {nodes[node.first + 1].aabb_min, nodes[node.first + 1].aabb_max});
+		}
+		node.aabb_min = node_bounds.aabb_min;
+		node.aabb_max = node_bounds.aabb_max;
+	}
+}
+
+void InstanceBvh::gather(uint32_t node_index, std::vector<uint32_t> &result)
+{
+	const BvhNode &node = nodes[node_index];
+	if (node.count > 0)
+	{
+		result.insert(result.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+		return;
+	}
+	gather(node.first, result);
+	gather(node.first + 1, result);
+}
+
+void InstanceBvh::query_frustum(const std::array<glm::vec4, 6> &planes, std::vector<uint32_t> &result)
+{
+	result.clear();
+	if (nodes.empty())
+		return;
+	std::vector<uint32_t> stack = {0};
+	while (!stack.empty())
+	{
+		uint32_t node_index = stack.back();
+		const BvhNode &node = nodes[node_index];
+		stack.pop_back();
+		bool inside = false;
+		if (!boxIntersectsFrustum(planes, node.aabb_min, node.aabb_max, inside))
+			continue;
+		// Everything below a node inside all planes is visible
+		if (inside)
+		{
+			gather(node_index, result);
+		}
+		else if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				if (boxIntersectsFrustum(planes, bounds[items[i]].aabb_min, bounds[items[i]].aabb_max, inside))
+					result.push_back(items[i]);
+			}
+		}
+		else
+		{
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+		}
+	}
+}
+
+void InstanceBvh::query_box(glm::vec3 aabb_min, glm::vec3 aabb_max, std::vector<uint32_t> &result)
+{
+	result.clear();
+	if (nodes.empty())
+		return;
+	std::vector<uint32_t> stack = {0};
+	while (!stack.empty())
+	{
+		const BvhNode &node = nodes[stack.back()];
+		stack.pop_back();
+		if (!boxesOverlap(node.aabb_min, node.aabb_max, aabb_min, aabb_max))
+			continue;
+		if (node.count == 0)
+		{
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			if (boxesOverlap(bounds[items[i]].aabb_min, bounds[items[i]].aabb_max, aabb_min, aabb_max))
+				result.push_back(items[i]);
+		}
+	}
+}
+
+void InstanceBvh::query_sphere(glm::vec3 center, float radius, std::vector<uint32_t> &result)
+{
+	result.clear();
+	if (nodes.empty())
+		return;
+	std::vector<uint32_t> stack = {0};
+	while (!stack.empty())
+	{
+		const BvhNode &node = nodes[stack.back()];
+		stack.pop_back();
+		if (!boxOverlapsSphere(node.aabb_min, node.aabb_max, center, radius))
+			continue;
+		if (node.count == 0)
+		{
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			if (boxOverlapsSphere(bounds[items[i]].aabb_min, bounds[items[i]].aabb_max, center, radius))
+				result.push_back(items[i]);
+		}
+	}
+}
+
+float InstanceBvh::query_ray(glm::vec3 origin, glm::vec3 direction, float max_distance, const std::function<float(uint32_t instance, float max_distance)> &intersect)
+{
+	if (nodes.empty())
+		return max_distance;
+
+	// Slab test, returns the distance at which the ray enters the box or infinity if it misses it
+	glm::vec3 inverse_direction = 1.0f / direction;
+	const float miss = std::numeric_limits<float>::infinity();
+	auto enter = [&](glm::vec3 aabb_min, glm::vec3 aabb_max)
+	{
+		glm::vec3 t0 = (aabb_min - origin) * inverse_direction;
+		glm::vec3 t1 = (aabb_max - origin) * inverse_direction;
+		glm::vec3 t_near = glm::min(t0, t1);
+		glm::vec3 t_far = glm::max(t0, t1);
+		float t_enter = std::max({t_near.x, t_near.y, t_near.z, 0.0f});
+		float t_exit = std::min({t_far.x, t_far.y, t_far.z});
+		return t_enter <= t_exit && t_enter < max_distance ? t_enter : miss;
+	};
+
+	struct Entry
+	{
+		uint32_t node;
+		float distance;
+	};
+	std::vector<Entry> stack;
+	float root_distance = enter(nodes[0].aabb_min, nodes[0].aabb_max);
+	if (root_distance != miss)
+		stack.push_back({0, root_distance});
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		// A closer hit was found since the node was pushed
+		if (entry.distance >= max_distance)
+			continue;
+		const BvhNode &node = nodes[entry.node];
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				if (enter(bounds[items[i]].aabb_min, bounds[items[i]].aabb_max) != miss)
+					max_distance = std::min(max_distance, intersect(items[i], max_distance));
+			}
+			continue;
+		}
+
+		// The nearer child is pushed last and visited first
+		Entry left = {node.first, enter(nodes[node.first].aabb_min, nodes[node.first].aabb_max)};
+		Entry right = {node.first + 1, enter(nodes[node.first + 1].aabb_min, nodes[node.first + 1].aabb_max)};
+		if (left.distance < right.distance)
+			std::swap(left, right);
+		if (left.distance != miss)
+			stack.push_back(left);
+		if (right.distance != miss)
+			stack.push_back(right);
+	}
+	return max_distance;
+}
+#pragma endregion
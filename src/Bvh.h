@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <array>
+#include <atomic>
+#include <functional>
+
+const uint32_t BVH_MAX_LEAF_SIZE = 4;
+const uint32_t BVH_SAH_BINS = 16;
+// Subtrees with fewer items are built on the thread of their parent
+const uint32_t BVH_PARALLEL_MIN_ITEMS = 4096;
+
+// 32 bytes, two nodes share a cache line. The children of an inner node are stored next to each other,
+// always after their parent, so a reverse pass over the nodes visits children before parents.
+struct BvhNode
+{
+	glm::vec3 aabb_min;
+	// inner nodes: the left child, the right one follows it; leaves: the first of their items
+	uint32_t first;
+	glm::vec3 aabb_max;
+	// 0 for inner nodes
+	uint32_t count;
+};
+
+// World space bounds of an instance, see instanceBounds
+struct BvhBounds
+{
+	glm::vec3 aabb_min;
+	glm::vec3 aabb_max;
+};
+
+// The world space AABB around the transformed object space AABB of the mesh
+BvhBounds instanceBounds(MeshInstance &instance);
+
+// A bounding volume hierarchy over the world space bounds of the scene instances.
+// The hierarchy is built with binned SAH, large subtrees are built in parallel. Moving instances are handled by
+// refitting the bounds, which keeps the topology and with it the query cost of the build it started from.
+// Queries return instance indices in no particular order.
+class InstanceBvh
+{
+private:
+	std::vector<BvhNode> nodes;
+	// instance indices, every leaf covers a range of them
+	std::vector<uint32_t> items;
+	std::vector<BvhBounds> bounds;
+	std::atomic<uint32_t> node_count = 0;
+
+	void build_node(uint32_t node_index, uint32_t first, uint32_t count, uint32_t parallel_depth);
+	void gather(uint32_t node_index, std::vector<uint32_t> &result);
+
+public:
+	void build(const std::vector<std::unique_ptr<MeshInstance>> &instances);
+	// Updates the bounds of all nodes for the current model matrices of the same instances
+	void refit(const std::vector<std::unique_ptr<MeshInstance>> &instances);
+
+	// Instances whose bounds intersect the frustum, planes as returned by frustumPlanes
+	void query_frustum(const std::array<glm::vec4, 6> &planes, std::vector<uint32_t> &result);
+	// Instances whose bounds overlap the box
+	void query_box(glm::vec3 aabb_min, glm::vec3 aabb_max, std::vector<uint32_t> &result);
+	// Instances whose bounds overlap the sphere
+	void query_sphere(glm::vec3 center, float radius, std::vector<uint32_t> &result);
+	// Visits the instances whose bounds the ray enters within max_distance, nearer nodes first.
+	// intersect returns the distance of its hit with the instance or max_distance, later visits are limited to it.
+	// Returns the closest hit distance or max_distance without hit.
+	float query_ray(glm::vec3 origin, glm::vec3 direction, float max_distance, const std::function<float(uint32_t instance, float max_distance)> &intersect);
+
+	bool empty()
+	{
+		return nodes.empty();
+	}
+};
@@ -6,6 +6,8 @@
 #include "Utils.h"
 #include "Descriptors.h"
 
+#include <limits>
+
 #pragma region Camera
 Camera::Camera(float fovRad, glm::vec2 viewportSize, float nearPlane, float farPlane, glm::vec3 position, glm::vec3 angles)
 {
@@ -106,4 +108,31 @@ void OrbitControls::update()
 	camera->angles.y = 1.0f * azimuth;
 	camera->updateView();
 }
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+float screenFootprint(Camera &camera, glm::vec4 sphere)
+{
+	float distance = glm::length(glm::vec3(sphere) - camera.position);
+	if (distance <= sphere.w)
+		return std::numeric_limits<float>::max();
+	return sphere.w / (distance * std::tan(camera.fovRad * 0.5f)) * camera.viewportSize.y;
+}
+
+std::array<glm::vec4, 6> frustumPlanes(Camera &camera)
+{
+	// Gribb and Hartmann, with the clip space depth range of Vulkan [0, w]
+	glm::mat4 m = glm::transpose(camera.projectionMatrix * camera.viewMatrix);
+	std::array<glm::vec4, 6> planes = {
+		m[3] + m[0],
+		m[3] - m[0],
+		m[3] + m[1],
+		m[3] - m[1],
+		m[2],
+		m[3] - m[2],
+	};
+	for (auto &&plane : planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+	return planes;
+}
@@ -11,6 +11,7 @@
 #include <iterator>
 #include <memory>
 #include <string>
+#include <array>
 
 struct CameraUniformBlock
 {
@@ -60,4 +61,10 @@ public:
 	OrbitControls(std::shared_ptr<Camera> camera);
 
 	void update();
-};
\ No newline at end of file
+};
+
+// Diameter of the projection of a world space bounding sphere in pixels
+float screenFootprint(Camera &camera, glm::vec4 sphere);
+// World space planes of the view frustum as xyz = inward unit normal, w = distance,
+// ordered left, right, bottom, top, near, far
+std::array<glm::vec4, 6> frustumPlanes(Camera &camera);
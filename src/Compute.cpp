@@ -0,0 +1,297 @@
+#include "Compute.h"
+
+#include "Utils.h"
+#include "vulkan_ext.h"
+
+#include <glslang/Public/ShaderLang.h>
+#include <glslang/SPIRV/GlslangToSpv.h>
+
+#include <fstream>
+#include <sstream>
+
+#pragma region ShaderCompilation
+TBuiltInResource createShaderResources()
+{
+	// Mirrors the relevant defaults of glslang's standalone ResourceLimits.cpp
+	TBuiltInResource resources = {};
+	resources.maxLights = 32;
+	resources.maxClipPlanes = 6;
+	resources.maxTextureUnits = 32;
+	resources.maxTextureCoords = 32;
+	resources.maxVertexAttribs = 64;
+	resources.maxVertexUniformComponents = 4096;
+	resources.maxVaryingFloats = 64;
+	resources.maxVertexTextureImageUnits = 32;
+	resources.maxCombinedTextureImageUnits = 80;
+	resources.maxTextureImageUnits = 32;
+	resources.maxFragmentUniformComponents = 4096;
+	resources.maxDrawBuffers = 32;
+	resources.maxVertexUniformVectors = 128;
+	resources.maxVaryingVectors = 8;
+	resources.maxFragmentUniformVectors = 16;
+	resources.maxVertexOutputVectors = 16;
+	resources.maxFragmentInputVectors = 15;
+	resources.minProgramTexelOffset = -8;
+	resources.maxProgramTexelOffset = 7;
+	resources.maxClipDistances = 8;
+	resources.maxComputeWorkGroupCountX = 65535;
+	resources.maxComputeWorkGroupCountY = 65535;
+	resources.maxComputeWorkGroupCountZ = 65535;
+	resources.maxComputeWorkGroupSizeX = 1024;
+	resources.maxComputeWorkGroupSizeY = 1024;
+	resources.maxComputeWorkGroupSizeZ = 64;
+	resources.maxComputeUniformComponents = 1024;
+	resources.maxComputeTextureImageUnits = 16;
+	resources.maxComputeImageUniforms = 8;
+	resources.maxComputeAtomicCounters = 8;
+	resources.maxComputeAtomicCounterBuffers = 1;
+	resources.maxVaryingComponents = 60;
+	resources.maxVertexOutputComponents = 64;
+	resources.maxGeometryInputComponents = 64;
+	resources.maxGeometryOutputComponents = 128;
+	resources.maxFragmentInputComponents = 128;
+	resources.maxImageUnits = 8;
+	resources.maxCombinedImageUnitsAndFragmentOutputs = 8;
+	resources.maxCombinedShaderOutputResources = 8;
+	resources.maxImageSamples = 0;
+	resources.maxVertexImageUniforms = 0;
+	resources.maxFragmentImageUniforms = 8;
+	resources.maxCombinedImageUniforms = 8;
+	resources.maxViewports = 16;
+	resources.maxVertexAtomicCounters = 0;
+	resources.maxFragmentAtomicCounters = 8;
+	resources.maxCombinedAtomicCounters = 8;
+	resources.maxAtomicCounterBindings = 1;
+	resources.maxVertexAtomicCounterBuffers = 0;
+	resources.maxFragmentAtomicCounterBuffers = 1;
+	resources.maxCombinedAtomicCounterBuffers = 1;
+	resources.maxAtomicCounterBufferSize = 16384;
+	resources.maxTransformFeedbackBuffers = 4;
+	resources.maxTransformFeedbackInterleavedComponents = 64;
+	resources.maxCullDistances = 8;
+	resources.maxCombinedClipAndCullDistances = 8;
+	resources.maxSamples = 4;
+	resources.limits.nonInductiveForLoops = true;
+	resources.limits.whileLoops = true;
+	resources.limits.doWhileLoops = true;
+	resources.limits.generalUniformIndexing = true;
+	resources.limits.generalAttributeMatrixVectorIndexing = true;
+	resources.limits.generalVaryingIndexing = true;
+	resources.limits.generalSamplerIndexing = true;
+	resources.limits.generalVariableIndexing = true;
+	resources.limits.generalConstantMatrixVectorIndexing = true;
+	return resources;
+}
+
+EShLanguage toGlslangStage(VkShaderStageFlagBits stage)
+{
+	switch (stage)
+	{
+	case VK_SHADER_STAGE_VERTEX_BIT:
+		return EShLangVertex;
+	case VK_SHADER_STAGE_FRAGMENT_BIT:
+		return EShLangFragment;
+	case VK_SHADER_STAGE_COMPUTE_BIT:
+		return EShLangCompute;
+	default:
+		VKL_EXIT_WITH_ERROR("Unsupported shader stage " << stage);
+	}
+}
+
+std::vector<uint32_t> compileGlslToSpirv(std::string path, VkShaderStageFlagBits stage)
+{
+	std::ifstream file(path);
+	if (!file.good())
+	{
+		VKL_EXIT_WITH_ERROR("Could not open shader file: " << path);
+	}
+	std::stringstream source_stream;
+	source_stream << file.rdbuf();
+	std::string source = source_stream.str();
+	const char *source_ptr = source.c_str();
+
+	// Reference counted, the framework initializes glslang as well
+	glslang::InitializeProcess();
+
+	EShLanguage glslang_stage = toGlslangStage(stage);
+	EShMessages messages = static_cast<EShMessages>(EShMsgSpvRules | EShMsgVulkanRules);
+	TBuiltInResource resources = createShaderResources();
+
+	std::vector<uint32_t> spirv;
+	{
+		glslang::TShader shader(glslang_stage);
+		shader.setStrings(&source_ptr, 1);
+		shader.setEnvInput(glslang::EShSourceGlsl, glslang_stage, glslang::EShClientVulkan, 100);
+		shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_1);
+		shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_3);
+		if (!shader.parse(&resources, 450, false, messages))
+		{
+			VKL_EXIT_WITH_ERROR("Failed to compile shader " << path << ":\n"
+															<< shader.getInfoLog());
+		}
+
+		glslang::TProgram program;
+		program.addShader(&shader);
+		if (!program.link(messages))
+		{
+			VKL_EXIT_WITH_ERROR("Failed to link shader " << path << ":\n"
+														 << program.getInfoLog());
+		}
+		glslang::GlslangToSpv(*program.getIntermediate(glslang_stage), spirv);
+	}
+
+	glslang::FinalizeProcess();
+	return spirv;
+}
+
+VkShaderModule createVkShaderModule(VkDevice vk_device, std::string path, VkShaderStageFlagBits stage)
+{
+	std::vector<uint32_t> spirv = compileGlslToSpirv(path, stage);
+	VkShaderModuleCreateInfo shader_module_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = spirv.size() * sizeof(uint32_t),
+		.pCode = spirv.data(),
+	};
+	VkShaderModule shader_module = VK_NULL_HANDLE;
+	VkResult error = vkCreateShaderModule(vk_device, &shader_module_create_info, nullptr, &shader_module);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return shader_module;
+}
+#pragma endregion
+
+ComputePipeline createVkComputePipeline(VkDevice vk_device, std::string shader_name, std::vector<VkDescriptorSetLayout> set_layouts)
+{
+	std::string shader_path = gcgLoadShaderFilePath("assets/shaders_vk/" + shader_name);
+	VkShaderModule shader_module = createVkShaderModule(vk_device, shader_path, VK_SHADER_STAGE_COMPUTE_BIT);
+
+	ComputePipeline result = {};
+	VkPipelineLayoutCreateInfo layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = uint32_t(set_layouts.size()),
+		.pSetLayouts = set_layouts.data(),
+	};
+	VkResult error = vkCreatePipelineLayout(vk_device, &layout_create_info, nullptr, &result.layout);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkComputePipelineCreateInfo pipeline_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = shader_module,
+			.pName = "main",
+		},
+		.layout = result.layout,
+	};
+	error = vkCreateComputePipelines(vk_device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &result.pipeline);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	vkDestroyShaderModule(vk_device, shader_module, nullptr);
+	return result;
+}
+
+void destroyVkComputePipeline(VkDevice vk_device, ComputePipeline pipeline)
+{
+	vkDestroyPipeline(vk_device, pipeline.pipeline, nullptr);
+	vkDestroyPipelineLayout(vk_device, pipeline.layout, nullptr);
+}
+
+#pragma region ComputeCommands
+ComputeCommands::ComputeCommands(VkDevice vk_device, uint32_t queue_family)
+{
+	this->device = vk_device;
+
+	VkCommandPoolCreateInfo command_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = queue_family,
+	};
+	VkResult error = vkCreateCommandPool(vk_device, &command_pool_create_info, nullptr, &command_pool);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkCommandBufferAllocateInfo command_buffer_alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	error = vkAllocateCommandBuffers(vk_device, &command_buffer_alloc_info, &command_buffer);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkFenceCreateInfo fence_create_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.flags = VK_FENCE_CREATE_SIGNALED_BIT,
+	};
+	error = vkCreateFence(vk_device, &fence_create_info, nullptr, &fence);
+	VKL_CHECK_VULKAN_ERROR(error);
+}
+
+VkCommandBuffer ComputeCommands::begin()
+{
+	VkResult error = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	VKL_CHECK_VULKAN_ERROR(error);
+	error = vkResetFences(device, 1, &fence);
+	VKL_CHECK_VULKAN_ERROR(error);
+	error = vkResetCommandBuffer(command_buffer, 0);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	error = vkBeginCommandBuffer(command_buffer, &begin_info);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	// The previous frame may still read the buffers that are about to be overwritten (write-after-read)
+	VkMemoryBarrier2 war_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+		.srcAccessMask = 0,
+		// buffers may also be cleared before the compute shaders write them
+		.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.dstAccessMask = 0,
+	};
+	VkDependencyInfo war_dep_info = {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &war_barrier,
+	};
+	vkCmdPipelineBarrier2KHR(command_buffer, &war_dep_info);
+
+	return command_buffer;
+}
+
+void ComputeCommands::submit(VkQueue vk_queue)
+{
+	VkMemoryBarrier2 raw_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+		.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT,
+	};
+	VkDependencyInfo raw_dep_info = {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &raw_barrier,
+	};
+	vkCmdPipelineBarrier2KHR(command_buffer, &raw_dep_info);
+
+	VkResult error = vkEndCommandBuffer(command_buffer);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &command_buffer,
+	};
+	error = vkQueueSubmit(vk_queue, 1, &submit_info, fence);
+	VKL_CHECK_VULKAN_ERROR(error);
+}
+
+void ComputeCommands::destroy(VkDevice device)
+{
+	vkDestroyFence(device, fence, nullptr);
+	vkDestroyCommandPool(device, command_pool, nullptr);
+}
+#pragma endregion
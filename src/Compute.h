@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <VulkanLaunchpad.h>
+
+#include "MyUtils.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+
+// Compiles a GLSL file to SPIR-V using the glslang libraries the framework already links against.
+std::vector<uint32_t> compileGlslToSpirv(std::string path, VkShaderStageFlagBits stage);
+VkShaderModule createVkShaderModule(VkDevice vk_device, std::string path, VkShaderStageFlagBits stage);
+
+struct ComputePipeline
+{
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+};
+
+// The framework only creates graphics pipelines, compute pipelines are created manually
+ComputePipeline createVkComputePipeline(VkDevice vk_device, std::string shader_name, std::vector<VkDescriptorSetLayout> set_layouts);
+void destroyVkComputePipeline(VkDevice vk_device, ComputePipeline pipeline);
+
+// A command buffer which is recorded and submitted before the framework's frame command buffer.
+// The framework begins its render pass immediately, so any compute work has to be submitted separately.
+// Submission order on the same queue together with the barriers below makes the results visible to the frame.
+class ComputeCommands : public ITrash
+{
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkCommandPool command_pool = VK_NULL_HANDLE;
+	VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+
+public:
+	ComputeCommands(VkDevice vk_device, uint32_t queue_family);
+
+	VkCommandBuffer begin();
+	void submit(VkQueue vk_queue);
+	void destroy(VkDevice device);
+};
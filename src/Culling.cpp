@@ -0,0 +1,414 @@
+#include "Culling.h"
+
+#include <VulkanLaunchpad.h>
+#include "Descriptors.h"
+#include "vulkan_ext.h"
+
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <numeric>
+
+#undef min
+#undef max
+
+#pragma region FrustumCuller
+void FrustumCuller::cull(Camera &camera, const std::vector<std::unique_ptr<MeshInstance>> &instances, std::vector<uint32_t> &visible)
+{
+	size_t batch_count = (instances.size() + CULLING_BATCH_SIZE - 1) / CULLING_BATCH_SIZE;
+	batches.resize(batch_count);
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		BoundsBatch &batch = batches[i / CULLING_BATCH_SIZE];
+		size_t lane = i % CULLING_BATCH_SIZE;
+		MeshInstance &instance = *instances[i];
+		glm::mat4 m = instance.get_model_matrix();
+		glm::vec3 aabb_min = instance.mesh->get_aabb_min();
+		glm::vec3 aabb_max = instance.mesh->get_aabb_max();
+		glm::vec3 center = glm::vec3(m * glm::vec4((aabb_min + aabb_max) * 0.5f, 1.0f));
+		glm::vec3 half_size = (aabb_max - aabb_min) * 0.5f;
+		// Arvo's method, the extent along each world axis sums the absolute projections of the box axes
+		glm::vec3 extent = glm::abs(glm::vec3(m[0])) * half_size.x + glm::abs(glm::vec3(m[1])) * half_size.y + glm::abs(glm::vec3(m[2])) * half_size.z;
+		batch.center_x[lane] = center.x;
+		batch.center_y[lane] = center.y;
+		batch.center_z[lane] = center.z;
+		batch.extent_x[lane] = extent.x;
+		batch.extent_y[lane] = extent.y;
+		batch.extent_z[lane] = extent.z;
+		batch.radius[lane] = instance.get_bounding_sphere().w;
+	}
+
+	std::array<glm::vec4, 6> planes = frustumPlanes(camera);
+	visible.clear();
+	for (size_t b = 0; b < batch_count; b++)
+	{
+		const BoundsBatch &batch = batches[b];
+		uint32_t inside[CULLING_BATCH_SIZE];
+		for (uint32_t lane = 0; lane < CULLING_BATCH_SIZE; lane++)
+		{
+			inside[lane] = 1;
+		}
+		for (auto &&plane : planes)
+		{
+			glm::vec3 abs_normal = glm::abs(glm::vec3(plane));
+			for (uint32_t lane = 0; lane < CULLING_BATCH_SIZE; lane++)
+			{
+				float distance = plane.x * batch.center_x[lane] + plane.y * batch.center_y[lane] + plane.z * batch.center_z[lane] + plane.w;
+				// Box and sphere share the center, the tighter of both bounds the instance
+				float box_radius = abs_normal.x * batch.extent_x[lane] + abs_normal.y * batch.extent_y[lane] + abs_normal.z * batch.extent_z[lane];
+				float radius = std::min(box_radius, batch.radius[lane]);
+				inside[lane] &= uint32_t(distance >= -radius);
+			}
+		}
+
+		size_t lane_count = std::min<size_t>(CULLING_BATCH_SIZE, instances.size() - b * CULLING_BATCH_SIZE);
+		for (size_t lane = 0; lane < lane_count; lane++)
+		{
+			if (inside[lane])
+				visible.push_back(uint32_t(b * CULLING_BATCH_SIZE + lane));
+		}
+	}
+
+	counters.visible = uint32_t(visible.size());
+	counters.culled = uint32_t(instances.size() - visible.size());
+}
+#pragma endregion
+
+#pragma region DrawSorter
+uint64_t drawSortKey(PipelineMatrixManager::Shader shader, VertexLayout layout, float view_depth)
+{
+	uint64_t bucket = uint64_t(shader) * 2 + uint64_t(layout);
+	// The bits of non-negative floats order like the floats themselves
+	return (bucket << 32) | glm::floatBitsToUint(std::max(view_depth, 0.0f));
+}
+
+void DrawSorter::sort(Camera &camera, const std::vector<std::unique_ptr<MeshInstance>> &instances, std::vector<uint32_t> &visible)
+{
+	if (order.size() != instances.size())
+	{
+		order.resize(instances.size());
+		std::iota(order.begin(), order.end(), 0);
+		keys.resize(instances.size());
+	}
+
+	// Distance of the nearest point of the bounding sphere along the view direction
+	glm::vec4 view_row = glm::vec4(camera.viewMatrix[0][2], camera.viewMatrix[1][2], camera.viewMatrix[2][2], camera.viewMatrix[3][2]);
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		MeshInstance &instance = *instances[i];
+		glm::vec4 sphere = instance.get_bounding_sphere();
+		float view_depth = -glm::dot(view_row, glm::vec4(glm::vec3(sphere), 1.0f)) - sphere.w;
+		keys[i] = drawSortKey(instance.get_shader(), instance.mesh->get_vertex_layout(), view_depth);
+	}
+
+	for (size_t i = 1; i < order.size(); i++)
+	{
+		uint32_t index = order[i];
+		uint64_t key = keys[index];
+		size_t j = i;
+		for (; j > 0 && keys[order[j - 1]] > key; j--)
+		{
+			order[j] = order[j - 1];
+		}
+		order[j] = index;
+	}
+
+	is_visible.assign(instances.size(), 0);
+	for (uint32_t index : visible)
+	{
+		is_visible[index] = 1;
+	}
+	visible.clear();
+	for (uint32_t index : order)
+	{
+		if (is_visible[index])
+			visible.push_back(index);
+	}
+}
+#pragma endregion
+
+#pragma region GpuCulling
+GpuCulling::GpuCulling(VkPhysicalDevice physical_device, VkDevice device, VkDescriptorPool descriptor_pool, uint32_t max_instances, uint32_t max_groups, bool draw_indirect_count)
+{
+	this->max_instances = max_instances;
+	this->max_groups = max_groups;
+	this->draw_indirect_count = draw_indirect_count && vkCmdDrawIndexedIndirectCountKHR != nullptr;
+
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(physical_device, &features);
+	multi_draw_indirect = features.multiDrawIndirect == VK_TRUE;
+
+	uniform_buffer = vklCreateHostCoherentBufferWithBackingMemory(sizeof(GpuCullingUniformBlock), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+	instance_buffer = vklCreateHostCoherentBufferWithBackingMemory(max_instances * sizeof(GpuInstance), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	group_buffer = vklCreateHostCoherentBufferWithBackingMemory(max_groups * sizeof(GpuDrawGroup), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	command_buffer = vklCreateHostCoherentBufferWithBackingMemory(max_instances * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	count_buffer = vklCreateHostCoherentBufferWithBackingMemory(max_groups * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+	compute_descriptor_layout = createVkDescriptorSetLayout(
+		device,
+		{{.binding = 0,
+		  .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+		 {.binding = 1,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 2,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 3,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 4,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 5,
+		  .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER}});
+	compute_descriptor_set = createVkDescriptorSet(device, descriptor_pool, compute_descriptor_layout);
+	writeDescriptorSetBuffer(device, compute_descriptor_set, 0, uniform_buffer, sizeof(uniform_block));
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 1, instance_buffer);
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 2, group_buffer);
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 3, command_buffer);
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 4, count_buffer);
+
+	pipeline = createVkComputePipeline(device, "cull_instances.comp", {compute_descriptor_layout});
+}
+
+void GpuCulling::init_uniforms(VkDevice device, VkDescriptorSet descriptor_set, uint32_t binding)
+{
+	writeDescriptorSetStorageBuffer(device, descriptor_set, binding, instance_buffer);
+}
+
+void GpuCulling::init_occlusion(VkPhysicalDevice physical_device, VkDevice device, VkExtent2D extent, bool enabled)
+{
+	pyramid = std::make_shared<HiZPyramid>(physical_device, device, extent, instance_buffer);
+	occlusion_culling = enabled;
+	writeDescriptorSetImage(device, compute_descriptor_set, 5, pyramid->get_sampler(), pyramid->get_view(), VK_IMAGE_LAYOUT_GENERAL);
+}
+
+void GpuCulling::set_instances(const std::vector<std::unique_ptr<MeshInstance>> &instances)
+{
+	std::map<std::tuple<int, Mesh *, int32_t>, uint32_t> group_indices;
+	std::vector<GpuDrawGroup> group_data;
+	groups.clear();
+	uploaded_instances.clear();
+	instance_data.clear();
+	// Instances left out of a previous call keep reporting into the old list
+	changed_instances = std::make_shared<std::vector<uint32_t>>();
+	for (auto &&i : instances)
+	{
+		MeshInstance &instance = *i;
+		if (instance_data.size() == max_instances)
+		{
+			VKL_WARNING("Too many instances for GPU culling, only the first " << max_instances << " are drawn");
+			break;
+		}
+
+		auto key = std::make_tuple(int(instance.get_shader()), instance.mesh.get(), instance.get_texture_index());
+		auto group = group_indices.find(key);
+		if (group == group_indices.end())
+		{
+			if (groups.size() == max_groups)
+			{
+				VKL_WARNING("Too many draw groups for GPU culling, an instance is not drawn");
+				continue;
+			}
+			const std::vector<MeshLod> &lods = instance.mesh->get_lods();
+			GpuDrawGroup data = {
+				.lod_count = uint32_t(std::min<size_t>(lods.size(), GPU_CULLING_MAX_LODS)),
+			};
+			for (uint32_t l = 0; l < data.lod_count; l++)
+			{
+				data.lod_error[l] = lods[l].error;
+				data.lod_first_index[l] = lods[l].first_index;
+				data.lod_index_count[l] = lods[l].index_count;
+			}
+			group = group_indices.emplace(key, uint32_t(groups.size())).first;
+			groups.push_back({&instance, 0, 0});
+			group_data.push_back(data);
+
+			// The instance buffer replaces the uniforms of the instance whose descriptor set is bound
+			MeshInstanceUniformBlock uniforms = instance.get_uniforms();
+			uniforms.instancing.x = 1;
+			instance.set_uniforms(uniforms);
+		}
+
+		MeshInstanceUniformBlock uniforms = instance.get_uniforms();
+		DrawGroup &draw_group = groups[group->second];
+		glm::vec3 aabb_min = instance.mesh->get_aabb_min();
+		glm::vec3 aabb_max = instance.mesh->get_aabb_max();
+		instance_data.push_back({
+			.model_matrix = uniforms.model_matrix,
+			.color = uniforms.color,
+			.material_factors = uniforms.material_factors,
+			.bounding_sphere = instance.mesh->get_bounding_sphere(),
+			.aabb_min = glm::vec4(aabb_min, 0.0f),
+			.aabb_max = glm::vec4(aabb_max, 0.0f),
+			.draw = glm::uvec4(group->second, draw_group.command_count, 0, 0),
+		});
+		instance.track_changes(changed_instances, uint32_t(uploaded_instances.size()));
+		uploaded_instances.push_back(&instance);
+		draw_group.command_count++;
+	}
+
+	// The uploaded data is current already
+	changed_instances->clear();
+	uint32_t command_count = 0;
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		groups[g].first_command = command_count;
+		group_data[g].first_command = command_count;
+		command_count += groups[g].command_count;
+	}
+	instance_count = uint32_t(instance_data.size());
+	has_previous_commands = false;
+	if (!instance_data.empty())
+	{
+		vklCopyDataIntoHostCoherentBuffer(instance_buffer, instance_data.data(), instance_data.size() * sizeof(GpuInstance));
+		vklCopyDataIntoHostCoherentBuffer(group_buffer, group_data.data(), group_data.size() * sizeof(GpuDrawGroup));
+	}
+}
+
+void GpuCulling::update(Camera &camera, float pixel_error)
+{
+	std::array<glm::vec4, 6> planes = frustumPlanes(camera);
+	std::copy(planes.begin(), planes.end(), uniform_block.frustum_planes);
+	// Matches the projected error of MeshInstance::update_lod
+	float pixels_per_unit = camera.viewportSize.y / (2.0f * std::tan(camera.fovRad * 0.5f));
+	uniform_block.camera_position = glm::vec4(camera.position, pixels_per_unit);
+	uniform_block.counts = glm::uvec4(instance_count, draw_indirect_count ? 1 : 0, 0, 0);
+	uniform_block.lod = glm::vec4(pixel_error, 0.0f, 0.0f, 0.0f);
+	uniform_block.view_projection_matrix = camera.projectionMatrix * camera.viewMatrix;
+	if (pyramid)
+	{
+		VkExtent2D extent = pyramid->get_extent();
+		bool test = occlusion_culling && has_previous_commands;
+		uniform_block.occlusion = glm::vec4(extent.width, extent.height, pyramid->get_level_count(), test ? 1.0f : 0.0f);
+	}
+	vklCopyDataIntoHostCoherentBuffer(uniform_buffer, &uniform_block, sizeof(uniform_block));
+
+	// Only the changed instances are copied, one copy per run of consecutive indices
+	std::vector<uint32_t> &changed = *changed_instances;
+	std::sort(changed.begin(), changed.end());
+	changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+	size_t begin = 0;
+	while (begin < changed.size())
+	{
+		size_t end = begin + 1;
+		while (end < changed.size() && changed[end] == changed[end - 1] + 1)
+			end++;
+		for (size_t c = begin; c < end; c++)
+		{
+			MeshInstanceUniformBlock uniforms = uploaded_instances[changed[c]]->get_uniforms();
+			GpuInstance &data = instance_data[changed[c]];
+			data.model_matrix = uniforms.model_matrix;
+			data.color = uniforms.color;
+			data.material_factors = uniforms.material_factors;
+		}
+		vklCopyDataIntoHostCoherentBuffer(instance_buffer, changed[begin] * sizeof(GpuInstance), &instance_data[changed[begin]], (end - begin) * sizeof(GpuInstance));
+		begin = end;
+	}
+	changed.clear();
+}
+
+void GpuCulling::dispatch(VkCommandBuffer cmd_buffer)
+{
+	if (instance_count == 0)
+		return;
+
+	if (uniform_block.occlusion.w != 0.0f)
+	{
+		pyramid->begin(cmd_buffer, uniform_block.view_projection_matrix);
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			pyramid->bind_mesh(cmd_buffer, *groups[g].instance->mesh);
+			draw_commands(cmd_buffer, g);
+		}
+		pyramid->end(cmd_buffer);
+
+		// The commands and counts are overwritten below
+		VkMemoryBarrier2 war_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+			.srcAccessMask = 0,
+			.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.dstAccessMask = 0,
+		};
+		VkDependencyInfo war_dep_info = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &war_barrier,
+		};
+		vkCmdPipelineBarrier2KHR(cmd_buffer, &war_dep_info);
+	}
+
+	if (draw_indirect_count)
+	{
+		vkCmdFillBuffer(cmd_buffer, count_buffer, 0, VK_WHOLE_SIZE, 0);
+		VkMemoryBarrier2 clear_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+			.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+		};
+		VkDependencyInfo clear_dep_info = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &clear_barrier,
+		};
+		vkCmdPipelineBarrier2KHR(cmd_buffer, &clear_dep_info);
+	}
+
+	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &compute_descriptor_set, 0, nullptr);
+	vkCmdDispatch(cmd_buffer, (instance_count + 63) / 64, 1, 1);
+	has_previous_commands = true;
+}
+
+void GpuCulling::draw(VkCommandBuffer cmd_buffer, PipelineMatrixManager &pipelines)
+{
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		DrawGroup &group = groups[g];
+		MeshInstance &instance = *group.instance;
+		pipelines.set_shader(instance.get_shader());
+		pipelines.set_vertex_layout(instance.mesh->get_vertex_layout());
+		instance.bind_uniforms(cmd_buffer, pipelines.bind_selected(cmd_buffer));
+		if (pipelines.get_pass() == PipelineMatrixManager::Pass::Depth)
+			instance.mesh->bind_positions(cmd_buffer);
+		else
+			instance.mesh->bind(cmd_buffer);
+		draw_commands(cmd_buffer, g);
+	}
+}
+
+void GpuCulling::draw_commands(VkCommandBuffer cmd_buffer, size_t group)
+{
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	uint32_t command_count = groups[group].command_count;
+	VkDeviceSize offset = groups[group].first_command * stride;
+	if (draw_indirect_count)
+	{
+		vkCmdDrawIndexedIndirectCountKHR(cmd_buffer, command_buffer, offset, count_buffer, group * sizeof(uint32_t), command_count, stride);
+	}
+	else if (multi_draw_indirect)
+	{
+		vkCmdDrawIndexedIndirect(cmd_buffer, command_buffer, offset, command_count, stride);
+	}
+	else
+	{
+		for (uint32_t c = 0; c < command_count; c++)
+		{
+			vkCmdDrawIndexedIndirect(cmd_buffer, command_buffer, offset + c * stride, 1, stride);
+		}
+	}
+}
+
+void GpuCulling::destroy(VkDevice device)
+{
+	if (pyramid)
+		pyramid->destroy(device);
+	destroyVkComputePipeline(device, pipeline);
+	vkDestroyDescriptorSetLayout(device, compute_descriptor_layout, nullptr);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(uniform_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(instance_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(group_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(command_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(count_buffer);
+}
+#pragma endregion
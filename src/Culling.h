@@ -0,0 +1,185 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "MyUtils.h"
+#include "Camera.h"
+#include "Compute.h"
+#include "Pipelines.h"
+#include "Mesh.h"
+#include "Occlusion.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+
+const uint32_t CULLING_BATCH_SIZE = 8;
+
+struct CullingCounters
+{
+	uint32_t visible = 0;
+	uint32_t culled = 0;
+};
+
+// Tests the bounds of instances against the view frustum on the CPU.
+// Bounds are transformed into world space and stored in SoA batches of eight instances, so every plane test is a
+// loop over the lanes of a batch which the compiler vectorizes.
+class FrustumCuller
+{
+private:
+	struct BoundsBatch
+	{
+		float center_x[CULLING_BATCH_SIZE];
+		float center_y[CULLING_BATCH_SIZE];
+		float center_z[CULLING_BATCH_SIZE];
+		// half size of the world space AABB around the transformed object space AABB
+		float extent_x[CULLING_BATCH_SIZE];
+		float extent_y[CULLING_BATCH_SIZE];
+		float extent_z[CULLING_BATCH_SIZE];
+		float radius[CULLING_BATCH_SIZE];
+	};
+
+	std::vector<BoundsBatch> batches;
+	CullingCounters counters = {};
+
+public:
+	// Replaces visible with the indices of the instances that intersect the frustum
+	void cull(Camera &camera, const std::vector<std::unique_ptr<MeshInstance>> &instances, std::vector<uint32_t> &visible);
+	// Counts of the last cull
+	CullingCounters get_counters()
+	{
+		return counters;
+	}
+};
+
+// Sort key of an opaque draw, the pipeline bucket in the upper half keeps draws sharing a pipeline together,
+// the view depth in the lower half orders them front to back within their bucket
+uint64_t drawSortKey(PipelineMatrixManager::Shader shader, VertexLayout layout, float view_depth);
+
+// Orders the visible instances front to back within their pipeline buckets, so early depth tests reject most hidden
+// fragments without a depth prepass.
+// The order of all instances is kept between frames and insertion sorted, which is close to linear while the camera
+// moves smoothly.
+class DrawSorter
+{
+private:
+	// all instances, sorted by the keys of the last frame
+	std::vector<uint32_t> order;
+	// indexed by instance
+	std::vector<uint64_t> keys;
+	std::vector<uint8_t> is_visible;
+
+public:
+	// Reorders visible, instances not in it are sorted as well and keep their place for later frames
+	void sort(Camera &camera, const std::vector<std::unique_ptr<MeshInstance>> &instances, std::vector<uint32_t> &visible);
+};
+
+const uint32_t GPU_CULLING_MAX_LODS = 8;
+
+// An instance as seen by cull_instances.comp and the Instances buffer of the vertex shaders
+struct GpuInstance
+{
+	glm::mat4 model_matrix;
+	glm::vec4 color;
+	glm::vec4 material_factors;
+	// object space bounds of the mesh
+	glm::vec4 bounding_sphere;
+	glm::vec4 aabb_min;
+	glm::vec4 aabb_max;
+	// x: draw group, y: command of the instance within the group if commands are not compacted
+	glm::uvec4 draw;
+};
+
+// The levels of detail of a mesh and the command range of the instances drawing it, std430 layout
+struct GpuDrawGroup
+{
+	uint32_t first_command;
+	uint32_t lod_count;
+	uint32_t padding[2];
+	float lod_error[GPU_CULLING_MAX_LODS];
+	uint32_t lod_first_index[GPU_CULLING_MAX_LODS];
+	uint32_t lod_index_count[GPU_CULLING_MAX_LODS];
+};
+
+struct GpuCullingUniformBlock
+{
+	glm::vec4 frustum_planes[6];
+	// xyz: camera position, w: pixels per world space unit at distance 1
+	glm::vec4 camera_position;
+	// x: instance count, y: 1 if visible commands are compacted and counted
+	glm::uvec4 counts;
+	// x: largest projected error in pixels of a selected level, 0 always selects level 0
+	glm::vec4 lod;
+	glm::mat4 view_projection_matrix;
+	// xy: size of the Hi-Z pyramid, z: its level count, w: 1 if instances are tested against it
+	glm::vec4 occlusion;
+};
+
+// Culls all instances against the view frustum and selects their levels of detail in a compute pass,
+// which writes the indirect draw commands of the visible instances.
+// Instances are grouped by shader, mesh and texture, every group is drawn with a single indirect draw whose
+// draw count is read from the GPU, so the CPU cost of a frame does not depend on the instance count.
+// The draw groups are built once. The instances report every set_uniforms, so a frame only re-uploads the model
+// matrix, color and material factors of those. Changes to their mesh, texture or shader are not seen.
+// With occlusion culling, the instances drawn in the previous frame are first drawn into the depth buffer of a Hi-Z
+// pyramid with the current camera. Instances behind it are culled, as the occluders are drawn in this frame again.
+class GpuCulling : public ITrash
+{
+private:
+	struct DrawGroup
+	{
+		// its descriptor set is bound for the whole group, it shares mesh, texture and shader with all others
+		MeshInstance *instance;
+		uint32_t first_command;
+		uint32_t command_count;
+	};
+
+	GpuCullingUniformBlock uniform_block = {};
+	VkBuffer uniform_buffer = VK_NULL_HANDLE;
+	VkBuffer instance_buffer = VK_NULL_HANDLE;
+	VkBuffer group_buffer = VK_NULL_HANDLE;
+	VkBuffer command_buffer = VK_NULL_HANDLE;
+	// visible commands of every group
+	VkBuffer count_buffer = VK_NULL_HANDLE;
+	VkDescriptorSetLayout compute_descriptor_layout = VK_NULL_HANDLE;
+	VkDescriptorSet compute_descriptor_set = VK_NULL_HANDLE;
+	ComputePipeline pipeline = {};
+	uint32_t max_instances = 0;
+	uint32_t max_groups = 0;
+	// Without VK_KHR_draw_indirect_count every instance keeps its command, culled ones draw no indices
+	bool draw_indirect_count = false;
+	bool multi_draw_indirect = false;
+
+	std::vector<DrawGroup> groups;
+	uint32_t instance_count = 0;
+	// the uploaded instances and their data as last uploaded, in the order of the instance buffer
+	std::vector<MeshInstance *> uploaded_instances;
+	std::vector<GpuInstance> instance_data;
+	// indices into the instance buffer of the instances whose uniforms were set since the last update
+	std::shared_ptr<std::vector<uint32_t>> changed_instances = std::make_shared<std::vector<uint32_t>>();
+
+	std::shared_ptr<HiZPyramid> pyramid = nullptr;
+	bool occlusion_culling = false;
+	// the commands of the previous frame are complete, so they can draw the occluders
+	bool has_previous_commands = false;
+
+	void draw_commands(VkCommandBuffer cmd_buffer, size_t group);
+
+public:
+	GpuCulling(VkPhysicalDevice physical_device, VkDevice device, VkDescriptorPool descriptor_pool, uint32_t max_instances, uint32_t max_groups, bool draw_indirect_count);
+
+	// Binds the instance buffer, the descriptor set of every instance needs it
+	void init_uniforms(VkDevice device, VkDescriptorSet descriptor_set, uint32_t binding);
+	// Uploads the instances and builds the draw groups, parametric instances keep their current tessellation
+	void set_instances(const std::vector<std::unique_ptr<MeshInstance>> &instances);
+	// Creates the Hi-Z pyramid, it is required once instances are culled. extent is the size of the viewport.
+	void init_occlusion(VkPhysicalDevice physical_device, VkDevice device, VkExtent2D extent, bool enabled);
+	// Uploads the camera and the instances whose transform or material changed
+	void update(Camera &camera, float pixel_error);
+	void dispatch(VkCommandBuffer cmd_buffer);
+	// Records one indirect draw per group with the pipelines of the current pass
+	void draw(VkCommandBuffer cmd_buffer, PipelineMatrixManager &pipelines);
+	void destroy(VkDevice device);
+};
@@ -0,0 +1,275 @@
+#include "Dds.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+
+#pragma region DdsFormat
+// See https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dds-header
+struct DdsPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t four_cc;
+	uint32_t rgb_bit_count;
+	uint32_t r_bit_mask;
+	uint32_t g_bit_mask;
+	uint32_t b_bit_mask;
+	uint32_t a_bit_mask;
+};
+
+struct DdsHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitch_or_linear_size;
+	uint32_t depth;
+	uint32_t mip_map_count;
+	uint32_t reserved1[11];
+	DdsPixelFormat pixel_format;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+struct DdsHeaderDx10
+{
+	uint32_t dxgi_format;
+	uint32_t resource_dimension;
+	uint32_t misc_flag;
+	uint32_t array_size;
+	uint32_t misc_flags2;
+};
+
+const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+const uint32_t DDSD_CAPS = 0x1;
+const uint32_t DDSD_HEIGHT = 0x2;
+const uint32_t DDSD_WIDTH = 0x4;
+const uint32_t DDSD_PIXELFORMAT = 0x1000;
+const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+const uint32_t DDSD_LINEARSIZE = 0x80000;
+const uint32_t DDPF_FOURCC = 0x4;
+const uint32_t DDPF_RGB = 0x40;
+const uint32_t DDSCAPS_COMPLEX = 0x8;
+const uint32_t DDSCAPS_TEXTURE = 0x1000;
+const uint32_t DDSCAPS_MIPMAP = 0x400000;
+
+constexpr uint32_t fourCC(char a, char b, char c, char d)
+{
+	return uint32_t(a) | (uint32_t(b) << 8) | (uint32_t(c) << 16) | (uint32_t(d) << 24);
+}
+
+VkFormat dxgiToVkFormat(uint32_t dxgi_format)
+{
+	switch (dxgi_format)
+	{
+	case 28:
+		return VK_FORMAT_R8G8B8A8_UNORM;
+	case 29:
+		return VK_FORMAT_R8G8B8A8_SRGB;
+	case 71:
+		return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 72:
+		return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case 74:
+		return VK_FORMAT_BC2_UNORM_BLOCK;
+	case 75:
+		return VK_FORMAT_BC2_SRGB_BLOCK;
+	case 77:
+		return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 78:
+		return VK_FORMAT_BC3_SRGB_BLOCK;
+	case 80:
+		return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81:
+		return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83:
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84:
+		return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 87:
+		return VK_FORMAT_B8G8R8A8_UNORM;
+	case 91:
+		return VK_FORMAT_B8G8R8A8_SRGB;
+	case 95:
+		return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+	case 96:
+		return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+	case 98:
+		return VK_FORMAT_BC7_UNORM_BLOCK;
+	case 99:
+		return VK_FORMAT_BC7_SRGB_BLOCK;
+	default:
+		return VK_FORMAT_UNDEFINED;
+	}
+}
+
+VkFormat pixelFormatToVkFormat(const DdsPixelFormat &pf)
+{
+	if (pf.flags & DDPF_FOURCC)
+	{
+		switch (pf.four_cc)
+		{
+		case fourCC('D', 'X', 'T', '1'):
+			return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		case fourCC('D', 'X', 'T', '3'):
+			return VK_FORMAT_BC2_UNORM_BLOCK;
+		case fourCC('D', 'X', 'T', '5'):
+			return VK_FORMAT_BC3_UNORM_BLOCK;
+		case fourCC('A', 'T', 'I', '1'):
+		case fourCC('B', 'C', '4', 'U'):
+			return VK_FORMAT_BC4_UNORM_BLOCK;
+		case fourCC('A', 'T', 'I', '2'):
+		case fourCC('B', 'C', '5', 'U'):
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		default:
+			return VK_FORMAT_UNDEFINED;
+		}
+	}
+	if ((pf.flags & DDPF_RGB) && pf.rgb_bit_count == 32)
+	{
+		if (pf.r_bit_mask == 0x000000ff && pf.g_bit_mask == 0x0000ff00 && pf.b_bit_mask == 0x00ff0000)
+			return VK_FORMAT_R8G8B8A8_UNORM;
+		if (pf.r_bit_mask == 0x00ff0000 && pf.g_bit_mask == 0x0000ff00 && pf.b_bit_mask == 0x000000ff)
+			return VK_FORMAT_B8G8R8A8_UNORM;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+// Returns the size of a 4x4 block for block compressed formats and 0 otherwise
+size_t blockSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+#pragma endregion
+
+size_t ddsLevelSize(VkFormat format, VkExtent2D extent)
+{
+	size_t block = blockSize(format);
+	if (block != 0)
+		return size_t(std::max(1u, (extent.width + 3) / 4)) * std::max(1u, (extent.height + 3) / 4) * block;
+	// All supported uncompressed formats have 4 bytes per pixel
+	return size_t(extent.width) * extent.height * 4;
+}
+
+bool ddsIsBlockCompressed(VkFormat format)
+{
+	return blockSize(format) != 0;
+}
+
+bool parseDdsHeader(const uint8_t *data, size_t size, DdsImage &image)
+{
+	uint32_t magic;
+	DdsHeader header;
+	if (size < sizeof(magic) + sizeof(header))
+		return false;
+	std::memcpy(&magic, data, sizeof(magic));
+	std::memcpy(&header, data + sizeof(magic), sizeof(header));
+	if (magic != DDS_MAGIC || header.size != sizeof(DdsHeader))
+		return false;
+
+	size_t offset = sizeof(magic) + sizeof(header);
+	if ((header.pixel_format.flags & DDPF_FOURCC) && header.pixel_format.four_cc == fourCC('D', 'X', '1', '0'))
+	{
+		DdsHeaderDx10 header_dx10;
+		if (size < offset + sizeof(header_dx10))
+			return false;
+		std::memcpy(&header_dx10, data + offset, sizeof(header_dx10));
+		offset += sizeof(header_dx10);
+		if (header_dx10.array_size > 1)
+			return false;
+		image.format = dxgiToVkFormat(header_dx10.dxgi_format);
+	}
+	else
+	{
+		image.format = pixelFormatToVkFormat(header.pixel_format);
+	}
+	if (image.format == VK_FORMAT_UNDEFINED)
+		return false;
+
+	image.extent = {header.width, header.height};
+	uint32_t level_count = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(1u, header.mip_map_count) : 1;
+	image.levels.clear();
+	image.levels.reserve(level_count);
+	image.data_size = 0;
+	for (uint32_t i = 0; i < level_count; i++)
+	{
+		VkExtent2D level_extent = {std::max(1u, header.width >> i), std::max(1u, header.height >> i)};
+		size_t level_size = ddsLevelSize(image.format, level_extent);
+		if (offset + level_size > size)
+			return false;
+		image.levels.push_back({level_extent, offset, level_size});
+		offset += level_size;
+		image.data_size += level_size;
+	}
+	return true;
+}
+
+bool writeDdsFile(const std::string &path, VkFormat format, VkExtent2D extent, const std::vector<std::vector<uint8_t>> &levels)
+{
+	DdsHeader header = {};
+	header.size = sizeof(DdsHeader);
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header.height = extent.height;
+	header.width = extent.width;
+	header.pitch_or_linear_size = uint32_t(levels[0].size());
+	header.mip_map_count = uint32_t(levels.size());
+	header.pixel_format.size = sizeof(DdsPixelFormat);
+	header.pixel_format.flags = DDPF_FOURCC;
+	header.caps = DDSCAPS_TEXTURE | (levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		header.pixel_format.four_cc = fourCC('D', 'X', 'T', '1');
+		break;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		header.pixel_format.four_cc = fourCC('D', 'X', 'T', '5');
+		break;
+	default:
+		return false;
+	}
+
+	// Written to a temporary file first, so a concurrent reader never sees a partial file
+	std::string temporary_path = path + ".tmp";
+	{
+		std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+		file.write(reinterpret_cast<const char *>(&DDS_MAGIC), sizeof(DDS_MAGIC));
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		for (auto &&level : levels)
+		{
+			file.write(reinterpret_cast<const char *>(level.data()), level.size());
+		}
+		if (!file)
+			return false;
+	}
+	std::error_code error;
+	std::filesystem::rename(temporary_path, path, error);
+	return !error;
+}
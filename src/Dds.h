@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+struct DdsLevel
+{
+	VkExtent2D extent;
+	// byte offset of the level data relative to the start of the file, or of the decoded data of supercompressed files
+	size_t offset;
+	size_t size;
+};
+
+// The header of a DDS file, parsed once. Only 2D textures without array layers are supported.
+// Levels are not required to be stored in order, each level has its own offset.
+struct DdsImage
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent2D extent = {};
+	std::vector<DdsLevel> levels;
+	// total size of all levels in bytes
+	size_t data_size = 0;
+};
+
+// Parses the header at the start of data, returns false if the file is not a supported DDS file
+bool parseDdsHeader(const uint8_t *data, size_t size, DdsImage &image);
+// Returns the size of a single level in bytes
+size_t ddsLevelSize(VkFormat format, VkExtent2D extent);
+bool ddsIsBlockCompressed(VkFormat format);
+// Writes a block compressed image, only BC1 and BC3 are supported
+bool writeDdsFile(const std::string &path, VkFormat format, VkExtent2D extent, const std::vector<std::vector<uint8_t>> &levels);
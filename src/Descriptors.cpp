@@ -2,15 +2,29 @@
 
 VkDescriptorPool createVkDescriptorPool(VkDevice vkDevice, uint32_t maxSets, uint32_t descriptorCount)
 {
-	VkDescriptorPoolSize descriptorPoolSize = {
-		.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-		.descriptorCount = descriptorCount,
+	VkDescriptorPoolSize descriptorPoolSizes[] = {
+		{
+			.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.descriptorCount = descriptorCount,
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = descriptorCount,
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = descriptorCount,
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.descriptorCount = descriptorCount,
+		},
 	};
 	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
 		.maxSets = maxSets,
-		.poolSizeCount = 1,
-		.pPoolSizes = &descriptorPoolSize,
+		.poolSizeCount = uint32_t(std::size(descriptorPoolSizes)),
+		.pPoolSizes = descriptorPoolSizes,
 	};
 	VkDescriptorPool vkDescriptorPool = VK_NULL_HANDLE;
 	VkResult error = vkCreateDescriptorPool(vkDevice, &descriptorPoolCreateInfo, nullptr, &vkDescriptorPool);
@@ -59,7 +73,7 @@ VkDescriptorSet createVkDescriptorSet(VkDevice vkDevice, VkDescriptorPool vkDesc
 	return vkDescriptorSet;
 }
 
-void writeDescriptorSetBuffer(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkBuffer buffer, size_t size, UniformBufferSlot range)
+static void writeDescriptorSetBufferOfType(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkDescriptorType type, VkBuffer buffer, UniformBufferSlot range)
 {
 	VkDescriptorBufferInfo bufferInfo = {
 		.buffer = buffer,
@@ -72,18 +86,28 @@ void writeDescriptorSetBuffer(VkDevice vkDevice, VkDescriptorSet dst, uint32_t b
 		.dstBinding = binding,
 		.dstArrayElement = 0,
 		.descriptorCount = 1,
-		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+		.descriptorType = type,
 		.pBufferInfo = &bufferInfo,
 	};
 	vkUpdateDescriptorSets(vkDevice, 1, &vkWriteDescriptorSet, 0, nullptr);
 }
 
-void writeDescriptorSetImage(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkSampler sampler, VkImageView view)
+void writeDescriptorSetBuffer(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkBuffer buffer, size_t size, UniformBufferSlot range)
+{
+	writeDescriptorSetBufferOfType(vkDevice, dst, binding, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, buffer, range);
+}
+
+void writeDescriptorSetStorageBuffer(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkBuffer buffer, UniformBufferSlot range)
+{
+	writeDescriptorSetBufferOfType(vkDevice, dst, binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffer, range);
+}
+
+void writeDescriptorSetImage(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkSampler sampler, VkImageView view, VkImageLayout layout)
 {
 	VkDescriptorImageInfo imageInfo = {
 		.sampler = sampler,
 		.imageView = view,
-		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		.imageLayout = layout,
 	};
 	VkWriteDescriptorSet vkWriteDescriptorSet = {
 		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -95,4 +119,58 @@ void writeDescriptorSetImage(VkDevice vkDevice, VkDescriptorSet dst, uint32_t bi
 		.pImageInfo = &imageInfo,
 	};
 	vkUpdateDescriptorSets(vkDevice, 1, &vkWriteDescriptorSet, 0, nullptr);
-}
\ No newline at end of file
+}
+
+void writeDescriptorSetStorageImage(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkImageView view)
+{
+	VkDescriptorImageInfo imageInfo = {
+		.imageView = view,
+		.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+	};
+	VkWriteDescriptorSet vkWriteDescriptorSet = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = dst,
+		.dstBinding = binding,
+		.dstArrayElement = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+		.pImageInfo = &imageInfo,
+	};
+	vkUpdateDescriptorSets(vkDevice, 1, &vkWriteDescriptorSet, 0, nullptr);
+}
+
+SwappableDescriptorSet::SwappableDescriptorSet(VkDevice device, VkDescriptorPool descriptor_pool, VkDescriptorSetLayout descriptor_layout, uint32_t binding_count)
+{
+	for (auto &&set : sets)
+	{
+		set = createVkDescriptorSet(device, descriptor_pool, descriptor_layout);
+	}
+	this->binding_count = binding_count;
+}
+
+bool SwappableDescriptorSet::can_swap(FrameRetirement &frames)
+{
+	return frames.is_retired(spare_frame);
+}
+
+void SwappableDescriptorSet::swap(VkDevice device, FrameRetirement &frames, const std::function<void(VkDescriptorSet)> &write)
+{
+	uint32_t spare = 1 - current;
+	std::vector<VkCopyDescriptorSet> copies;
+	for (uint32_t binding = 0; binding < binding_count; binding++)
+	{
+		copies.push_back({
+			.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET,
+			.srcSet = sets[current],
+			.srcBinding = binding,
+			.dstSet = sets[spare],
+			.dstBinding = binding,
+			.descriptorCount = 1,
+		});
+	}
+	vkUpdateDescriptorSets(device, 0, nullptr, uint32_t(copies.size()), copies.data());
+	write(sets[spare]);
+	// Frames up to the current one may have bound the set that is replaced
+	spare_frame = frames.current_frame();
+	current = spare;
+}
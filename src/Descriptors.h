@@ -4,11 +4,13 @@
 #include <VulkanLaunchpad.h>
 
 #include "MyUtils.h"
+#include "Frames.h"
 
 #include <vector>
 #include <algorithm>
 #include <iterator>
 #include <memory>
+#include <array>
 
 VkDescriptorPool createVkDescriptorPool(VkDevice vkDevice, uint32_t maxSets, uint32_t descriptorCount);
 
@@ -21,4 +23,34 @@ struct DescriptorSetLayoutParams
 VkDescriptorSetLayout createVkDescriptorSetLayout(VkDevice vkDevice, std::vector<DescriptorSetLayoutParams> params);
 VkDescriptorSet createVkDescriptorSet(VkDevice vkDevice, VkDescriptorPool vkDescriptorPool, VkDescriptorSetLayout vkDescriptorSetLayout);
 void writeDescriptorSetBuffer(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkBuffer buffer, size_t size, UniformBufferSlot range = {0, (VkDeviceSize)-1});
-void writeDescriptorSetImage(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkSampler sampler, VkImageView view);
\ No newline at end of file
+void writeDescriptorSetStorageBuffer(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkBuffer buffer, UniformBufferSlot range = {0, (VkDeviceSize)-1});
+void writeDescriptorSetImage(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkSampler sampler, VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+// The image has to be in VK_IMAGE_LAYOUT_GENERAL
+void writeDescriptorSetStorageImage(VkDevice vkDevice, VkDescriptorSet dst, uint32_t binding, VkImageView view);
+
+// A descriptor set which is changed while frames in flight may still use it, without waiting for them.
+// A change is written into a spare set, which is first copied from the current one and then replaces it.
+// The replaced set becomes the spare, it is written again once the frames which bound it completed.
+// The layout's bindings have to be numbered from 0 to binding_count - 1 and hold one descriptor each.
+class SwappableDescriptorSet
+{
+private:
+	std::array<VkDescriptorSet, 2> sets = {};
+	uint32_t current = 0;
+	uint32_t binding_count = 0;
+	// the last frame which may have bound the spare set
+	uint64_t spare_frame = 0;
+
+public:
+	SwappableDescriptorSet(VkDevice device, VkDescriptorPool descriptor_pool, VkDescriptorSetLayout descriptor_layout, uint32_t binding_count);
+
+	// The set to bind, initial writes go to it as well
+	VkDescriptorSet get()
+	{
+		return sets[current];
+	}
+	bool can_swap(FrameRetirement &frames);
+	// Copies the current set into the spare one, lets write change it and binds it from now on.
+	// Must only be called if can_swap returned true.
+	void swap(VkDevice device, FrameRetirement &frames, const std::function<void(VkDescriptorSet)> &write);
+};
@@ -0,0 +1,73 @@
+#include "Frames.h"
+#include "Staging.h"
+#include "vulkan_ext.h"
+
+#pragma region FrameRetirement
+FrameRetirement::FrameRetirement(VkDevice device)
+{
+	this->device = device;
+	this->timeline = createTimelineSemaphore(device);
+}
+
+bool FrameRetirement::is_retired(uint64_t frame)
+{
+	uint64_t value = 0;
+	VkResult error = vkGetSemaphoreCounterValueKHR(device, timeline, &value);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return value >= frame;
+}
+
+void FrameRetirement::defer(std::function<void()> release)
+{
+	releases.push_back({frame, release});
+}
+
+void FrameRetirement::end_frame(VkQueue queue)
+{
+	VkSemaphoreSubmitInfo signal_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+		.semaphore = timeline,
+		.value = frame,
+		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+	};
+	VkSubmitInfo2 submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+		.signalSemaphoreInfoCount = 1,
+		.pSignalSemaphoreInfos = &signal_info,
+	};
+	VkResult error = vkQueueSubmit2KHR(queue, 1, &submit_info, VK_NULL_HANDLE);
+	VKL_CHECK_VULKAN_ERROR(error);
+	frame++;
+
+	uint64_t completed = 0;
+	error = vkGetSemaphoreCounterValueKHR(device, timeline, &completed);
+	VKL_CHECK_VULKAN_ERROR(error);
+	auto pending = std::stable_partition(releases.begin(), releases.end(), [&](auto &r)
+										 { return r.first <= completed; });
+	for (auto it = releases.begin(); it != pending; it++)
+	{
+		it->second();
+	}
+	releases.erase(releases.begin(), pending);
+}
+
+void FrameRetirement::destroy(VkDevice device)
+{
+	// The current frame was never submitted, so only the frames before it are waited for
+	uint64_t last_frame = frame - 1;
+	VkSemaphoreWaitInfo wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.semaphoreCount = 1,
+		.pSemaphores = &timeline,
+		.pValues = &last_frame,
+	};
+	VkResult error = vkWaitSemaphoresKHR(device, &wait_info, UINT64_MAX);
+	VKL_CHECK_VULKAN_ERROR(error);
+	for (auto &&[release_frame, release] : releases)
+	{
+		release();
+	}
+	releases.clear();
+	vkDestroySemaphore(device, timeline, nullptr);
+}
+#pragma endregion
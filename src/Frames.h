@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <VulkanLaunchpad.h>
+
+#include "MyUtils.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <functional>
+#include <utility>
+
+// Tells when frames in flight have completed on the GPU, so the resources they use can be released without idling.
+// Every frame ends with an empty submission to the graphics queue which signals a timeline semaphore with the number
+// of the frame. It completes after all work submitted before it, including the frame's own command buffer.
+class FrameRetirement : public ITrash
+{
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkSemaphore timeline = VK_NULL_HANDLE;
+	// the frame being recorded, frames are numbered from 1
+	uint64_t frame = 1;
+	// releases and the last frame which may use their resources
+	std::vector<std::pair<uint64_t, std::function<void()>>> releases;
+
+public:
+	FrameRetirement(VkDevice device);
+
+	uint64_t current_frame()
+	{
+		return frame;
+	}
+	// Whether frame and all frames before it completed
+	bool is_retired(uint64_t frame);
+	// Calls release once all frames up to the current one completed
+	void defer(std::function<void()> release);
+	// Ends the current frame after everything submitted to queue so far and runs the releases of completed frames
+	void end_frame(VkQueue queue);
+	// Waits for all frames and runs the remaining releases
+	void destroy(VkDevice device);
+};
@@ -0,0 +1,144 @@
+#include "Ktx2.h"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#pragma region Ktx2Format
+// See https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+struct Ktx2Header
+{
+	uint8_t identifier[12];
+	uint32_t vk_format;
+	uint32_t type_size;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t layer_count;
+	uint32_t face_count;
+	uint32_t level_count;
+	uint32_t supercompression_scheme;
+	uint32_t dfd_byte_offset;
+	uint32_t dfd_byte_length;
+	uint32_t kvd_byte_offset;
+	uint32_t kvd_byte_length;
+	uint64_t sgd_byte_offset;
+	uint64_t sgd_byte_length;
+};
+
+struct Ktx2Level
+{
+	uint64_t byte_offset;
+	uint64_t byte_length;
+	uint64_t uncompressed_byte_length;
+};
+
+const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+const uint32_t KTX2_SUPERCOMPRESSION_NONE = 0;
+const uint32_t KTX2_SUPERCOMPRESSION_ZSTD = 2;
+
+bool isSupportedFormat(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		return true;
+	default:
+		return ddsIsBlockCompressed(format);
+	}
+}
+#pragma endregion
+
+// Decodes every level on its own, the levels are spread over up to one thread per level
+bool decodeZstdLevels(const uint8_t *data, const std::vector<Ktx2Level> &levels, const DdsImage &image, std::vector<uint8_t> &decoded)
+{
+	decoded.resize(image.data_size);
+	std::atomic<uint32_t> next_level = 0;
+	std::atomic<bool> corrupt = false;
+	auto decode_levels = [&]()
+	{
+		// The largest level comes first, so it starts right away
+		for (uint32_t i = next_level++; i < levels.size(); i = next_level++)
+		{
+			const DdsLevel &level = image.levels[i];
+			size_t result = ZSTD_decompress(decoded.data() + level.offset, level.size, data + levels[i].byte_offset, size_t(levels[i].byte_length));
+			if (ZSTD_isError(result) || result != level.size)
+				corrupt = true;
+		}
+	};
+	uint32_t thread_count = std::clamp(std::thread::hardware_concurrency(), 1u, uint32_t(levels.size()));
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < thread_count; i++)
+	{
+		threads.emplace_back(decode_levels);
+	}
+	decode_levels();
+	for (auto &&thread : threads)
+	{
+		thread.join();
+	}
+	return !corrupt;
+}
+
+bool parseKtx2Header(const uint8_t *data, size_t size, DdsImage &image, std::vector<uint8_t> &decoded)
+{
+	Ktx2Header header;
+	if (size < sizeof(header))
+		return false;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		return false;
+	// Basis Universal payloads (BasisLZ and UASTC) need a transcoder, which is left to a follow-up request
+	bool zstd = header.supercompression_scheme == KTX2_SUPERCOMPRESSION_ZSTD;
+	if (header.supercompression_scheme != KTX2_SUPERCOMPRESSION_NONE && !zstd)
+		return false;
+	if (header.pixel_depth > 0 || header.layer_count > 1 || header.face_count != 1)
+		return false;
+	image.format = VkFormat(header.vk_format);
+	if (!isSupportedFormat(image.format))
+		return false;
+
+	// A level count of 0 asks the loader to generate the mip chain
+	uint32_t level_count = std::max(1u, header.level_count);
+	if (size < sizeof(header) + level_count * sizeof(Ktx2Level))
+		return false;
+
+	image.extent = {header.pixel_width, std::max(1u, header.pixel_height)};
+	image.levels.clear();
+	image.levels.reserve(level_count);
+	image.data_size = 0;
+	std::vector<Ktx2Level> levels(level_count);
+	for (uint32_t i = 0; i < level_count; i++)
+	{
+		Ktx2Level &level = levels[i];
+		std::memcpy(&level, data + sizeof(header) + i * sizeof(Ktx2Level), sizeof(level));
+		VkExtent2D level_extent = {std::max(1u, image.extent.width >> i), std::max(1u, image.extent.height >> i)};
+		size_t level_size = ddsLevelSize(image.format, level_extent);
+		if (level.byte_offset + level.byte_length > size)
+			return false;
+		if (zstd)
+		{
+			// Decoded levels are packed from the largest to the smallest
+			if (level.uncompressed_byte_length != level_size)
+				return false;
+			image.levels.push_back({level_extent, image.data_size, level_size});
+		}
+		else
+		{
+			if (level.byte_length != level_size)
+				return false;
+			// Unlike DDS, the levels are stored from the smallest to the largest
+			image.levels.push_back({level_extent, size_t(level.byte_offset), level_size});
+		}
+		image.data_size += level_size;
+	}
+
+	decoded.clear();
+	return !zstd || decodeZstdLevels(data, levels, image, decoded);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "Dds.h"
+
+#include <cstdint>
+#include <vector>
+
+// Parses the header and level index of a KTX2 file into the same description used for DDS files.
+// Zstd supercompressed levels are decoded with the vendored zstd library into decoded, in parallel, and the level offsets then point into it instead
+// of the file. decoded stays empty for files without supercompression.
+// Returns false if the file is not a KTX2 file, is corrupt or uses features the loader does not support:
+// Basis Universal (not transcoded yet) and zlib supercompression, array layers, cube maps, 3D images and formats without a known size.
+bool parseKtx2Header(const uint8_t *data, size_t size, DdsImage &image, std::vector<uint8_t> &decoded);
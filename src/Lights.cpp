@@ -0,0 +1,82 @@
+#include "Lights.h"
+
+#include <VulkanLaunchpad.h>
+#include "Descriptors.h"
+
+#pragma region LightClusters
+LightClusters::LightClusters(VkPhysicalDevice physical_device, VkDevice device, VkDescriptorPool descriptor_pool)
+{
+	uint32_t cluster_count = LIGHT_CLUSTER_GRID_SIZE.x * LIGHT_CLUSTER_GRID_SIZE.y * LIGHT_CLUSTER_GRID_SIZE.z;
+	uniform_buffer = vklCreateHostCoherentBufferWithBackingMemory(sizeof(LightClusterUniformBlock), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+	light_buffer = vklCreateHostCoherentBufferWithBackingMemory(MAX_POINT_LIGHTS * sizeof(PointLight), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	cluster_buffer = createBufferWithMemory(physical_device, device, cluster_count * LIGHT_CLUSTER_STRIDE * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	overflow_buffer = createBufferWithMemory(physical_device, device, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	*static_cast<uint32_t *>(overflow_buffer.data) = 0;
+
+	compute_descriptor_layout = createVkDescriptorSetLayout(
+		device,
+		{{.binding = 0,
+		  .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+		 {.binding = 1,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 2,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 3,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER}});
+	compute_descriptor_set = createVkDescriptorSet(device, descriptor_pool, compute_descriptor_layout);
+	init_uniforms(device, compute_descriptor_set, 0, 1, 2);
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 3, overflow_buffer.buffer);
+
+	pipeline = createVkComputePipeline(device, "cluster_lights.comp", {compute_descriptor_layout});
+}
+
+void LightClusters::update(Camera &camera)
+{
+	if (lights.size() > MAX_POINT_LIGHTS)
+	{
+		VKL_WARNING("Too many point lights, only the first " << MAX_POINT_LIGHTS << " are used");
+		lights.resize(MAX_POINT_LIGHTS);
+	}
+	// Read without waiting for the dispatch, a frame late at worst
+	uint32_t max_cluster_lights = *static_cast<volatile uint32_t *>(overflow_buffer.data);
+	if (max_cluster_lights > 0 && !overflow_reported)
+	{
+		VKL_WARNING("A light cluster overlaps " << max_cluster_lights << " point lights, only the first " << LIGHT_CLUSTER_STRIDE - 1 << " are shaded");
+		overflow_reported = true;
+	}
+
+	uniform_block.view_matrix = camera.viewMatrix;
+	uniform_block.inverse_projection_matrix = glm::inverse(camera.projectionMatrix);
+	uniform_block.grid_size = glm::uvec4(LIGHT_CLUSTER_GRID_SIZE, uint32_t(lights.size()));
+	uniform_block.screen = {camera.viewportSize, camera.nearPlane, camera.farPlane};
+	vklCopyDataIntoHostCoherentBuffer(uniform_buffer, &uniform_block, sizeof(uniform_block));
+	if (!lights.empty())
+		vklCopyDataIntoHostCoherentBuffer(light_buffer, lights.data(), lights.size() * sizeof(PointLight));
+}
+
+void LightClusters::dispatch(VkCommandBuffer cmd_buffer)
+{
+	uint32_t cluster_count = LIGHT_CLUSTER_GRID_SIZE.x * LIGHT_CLUSTER_GRID_SIZE.y * LIGHT_CLUSTER_GRID_SIZE.z;
+	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &compute_descriptor_set, 0, nullptr);
+	// one invocation per cluster, the work group size is 64
+	vkCmdDispatch(cmd_buffer, (cluster_count + 63) / 64, 1, 1);
+}
+
+void LightClusters::init_uniforms(VkDevice device, VkDescriptorSet descriptor_set, uint32_t uniform_binding, uint32_t light_binding, uint32_t cluster_binding)
+{
+	writeDescriptorSetBuffer(device, descriptor_set, uniform_binding, uniform_buffer, sizeof(uniform_block));
+	writeDescriptorSetStorageBuffer(device, descriptor_set, light_binding, light_buffer);
+	writeDescriptorSetStorageBuffer(device, descriptor_set, cluster_binding, cluster_buffer.buffer);
+}
+
+void LightClusters::destroy(VkDevice device)
+{
+	destroyVkComputePipeline(device, pipeline);
+	vkDestroyDescriptorSetLayout(device, compute_descriptor_layout, nullptr);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(uniform_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(light_buffer);
+	destroyBufferWithMemory(device, cluster_buffer);
+	destroyBufferWithMemory(device, overflow_buffer);
+}
+#pragma endregion
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "MyUtils.h"
+#include "Camera.h"
+#include "Compute.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+
+// Must match the constants in cluster_lights.comp, phong.frag, gouraud.vert and box.vert
+const glm::uvec3 LIGHT_CLUSTER_GRID_SIZE = {16, 9, 24};
+// Each cluster stores its light count followed by up to CLUSTER_STRIDE - 1 light indices
+const uint32_t LIGHT_CLUSTER_STRIDE = 64;
+const uint32_t MAX_POINT_LIGHTS = 1024;
+
+struct DirectionalLightUniformBlock
+{
+	glm::vec4 direction;
+	glm::vec4 color;
+};
+
+struct PointLight
+{
+	// w is the radius of influence, lights with a radius of 0 are unbounded and end up in every cluster
+	glm::vec4 position;
+	glm::vec4 color;
+	glm::vec4 attenuation;
+};
+
+struct LightClusterUniformBlock
+{
+	glm::mat4 view_matrix;
+	glm::mat4 inverse_projection_matrix;
+	// xyz: cluster count per axis, w: point light count
+	glm::uvec4 grid_size;
+	// viewport width, viewport height, near plane, far plane
+	glm::vec4 screen;
+};
+
+// Clustered forward lighting: point lights live in a storage buffer and a compute pass
+// assigns them to view space clusters (screen tiles x exponential depth slices).
+// The lit shaders then only iterate the lights of the cluster they are in.
+// Clusters keep the first LIGHT_CLUSTER_STRIDE - 1 lights they overlap, update warns once if one overlapped more.
+// Phong picks the cluster per fragment. Gouraud and box light per vertex and therefore pick the cluster per vertex,
+// a triangle that spans several clusters interpolates between the lights of its corner clusters.
+class LightClusters : public ITrash
+{
+private:
+	LightClusterUniformBlock uniform_block = {};
+	VkBuffer uniform_buffer = VK_NULL_HANDLE;
+	VkBuffer light_buffer = VK_NULL_HANDLE;
+	// written and read on the device only
+	BufferWithMemory cluster_buffer = {};
+	// the largest light count of a cluster if it exceeded the stride, host visible
+	BufferWithMemory overflow_buffer = {};
+	bool overflow_reported = false;
+	VkDescriptorSetLayout compute_descriptor_layout = VK_NULL_HANDLE;
+	VkDescriptorSet compute_descriptor_set = VK_NULL_HANDLE;
+	ComputePipeline pipeline = {};
+
+public:
+	std::vector<PointLight> lights;
+
+	LightClusters(VkPhysicalDevice physical_device, VkDevice device, VkDescriptorPool descriptor_pool);
+
+	void update(Camera &camera);
+	void dispatch(VkCommandBuffer cmd_buffer);
+	void init_uniforms(VkDevice device, VkDescriptorSet descriptor_set, uint32_t uniform_binding, uint32_t light_binding, uint32_t cluster_binding);
+	void destroy(VkDevice device);
+};
@@ -15,6 +15,14 @@
 #include "Pipelines.h"
 #include "Input.h"
 #include "Texture.h"
+#include "TextureStreaming.h"
+#include "Frames.h"
+#include "Lights.h"
+#include "Compute.h"
+#include "Meshlets.h"
+#include "Culling.h"
+#include "Bvh.h"
+#include "Picking.h"
 #include "vulkan_ext.h"
 
 #include <vulkan/vulkan.h>
@@ -24,6 +32,8 @@
 #include <functional>
 #include <algorithm>
 #include <iterator>
+#include <numeric>
+#include <chrono>
 
 #undef min
 #undef max
@@ -37,31 +47,23 @@ struct ShaderConstantsUniformBlock
     glm::ivec4 user_input;
 };
 
-struct DirectionalLightUniformBlock
+// With parametric_lod, the primitives are re-tessellated for their size on screen instead of simplified,
+// equal primitives share their tessellations through tessellation_cache
+std::vector<std::unique_ptr<MeshInstance>> createScene(const MeshBuildOptions &mesh_options, bool parametric_lod, std::shared_ptr<TessellationCache> tessellation_cache)
 {
-    glm::vec4 direction;
-    glm::vec4 color;
-};
-
-struct PointLightUniformBlock
-{
-    glm::vec4 position;
-    glm::vec4 color;
-    glm::vec4 attenuation;
-};
-
-std::vector<std::unique_ptr<MeshInstance>> createScene()
-{
-    std::shared_ptr<Mesh> cornell_mesh(create_cornell_mesh(3, 3, 3));
-    std::shared_ptr<Mesh> cube_mesh(create_cube_mesh(0.34, 0.34, 0.34, {1.0, 1.0, 1.0}));
-    std::shared_ptr<Mesh> cylinder_mesh(create_cylinder_mesh(0.2, 1.5, 18, {1.0, 1.0, 1.0}));
-    std::shared_ptr<Mesh> sphere_mesh(create_sphere_mesh(0.24, 16, 32, {1.0, 1.0, 1.0}));
-    std::unique_ptr<BezierCurve> bezeier_curve(new BezierCurve({{-0.3f, 0.6f, 0.0f},
-                                                                {0.0f, 1.6f, 0.0f},
-                                                                {1.4f, 0.3f, 0.0f},
-                                                                {0.0f, 0.3f, 0.0f},
-                                                                {0.0f, -0.5f, 0.0f}}));
-    std::shared_ptr<Mesh> bezier_mesh(create_bezier_mesh(std::move(bezeier_curve), {0, 0, -1}, 0.2, 42, 18, {1.0, 1.0, 1.0}));
+    std::shared_ptr<Mesh> cornell_mesh(create_cornell_mesh(3, 3, 3, mesh_options));
+    std::shared_ptr<Mesh> cube_mesh(create_cube_mesh(0.34, 0.34, 0.34, {1.0, 1.0, 1.0}, mesh_options));
+    std::vector<glm::vec3> bezier_points = {{-0.3f, 0.6f, 0.0f},
+                                            {0.0f, 1.6f, 0.0f},
+                                            {1.4f, 0.3f, 0.0f},
+                                            {0.0f, 0.3f, 0.0f},
+                                            {0.0f, -0.5f, 0.0f}};
+    auto create_instance = [&](std::function<std::shared_ptr<ParametricMesh>()> create_parametric, std::function<std::unique_ptr<Mesh>()> create)
+    {
+        if (parametric_lod)
+            return new MeshInstance(create_parametric(), PipelineMatrixManager::Shader::Phong);
+        return new MeshInstance(std::shared_ptr<Mesh>(create()), PipelineMatrixManager::Shader::Phong);
+    };
 
     std::vector<std::unique_ptr<MeshInstance>> instances;
     MeshInstance *cornell_instance = new MeshInstance(cornell_mesh, PipelineMatrixManager::Shader::Box);
@@ -81,7 +83,10 @@ std::vector<std::unique_ptr<MeshInstance>> createScene()
     });
     cube_instance_1->set_texture_index(0);
 
-    MeshInstance *cylinder_instance = new MeshInstance(cylinder_mesh, PipelineMatrixManager::Shader::Phong);
+    MeshInstance *cylinder_instance = create_instance([&]
+                                                      { return create_parametric_cylinder_mesh(0.2, 1.5, 18, {1.0, 1.0, 1.0}, mesh_options, tessellation_cache); },
+                                                      [&]
+                                                      { return create_cylinder_mesh(0.2, 1.5, 18, {1.0, 1.0, 1.0}, mesh_options); });
     instances.push_back(std::unique_ptr<MeshInstance>(cylinder_instance));
     cylinder_instance->set_uniforms({
         .color = {1.0, 1.0, 1.0, 1.0},
@@ -90,7 +95,10 @@ std::vector<std::unique_ptr<MeshInstance>> createScene()
     });
     cylinder_instance->set_texture_index(0);
 
-    MeshInstance *bezier_instance = new MeshInstance(bezier_mesh, PipelineMatrixManager::Shader::Phong);
+    MeshInstance *bezier_instance = create_instance([&]
+                                                    { return create_parametric_bezier_mesh(bezier_points, {0, 0, -1}, 0.2, 42, 18, {1.0, 1.0, 1.0}, mesh_options, tessellation_cache); },
+                                                    [&]
+                                                    { return create_bezier_mesh(std::make_unique<BezierCurve>(bezier_points), {0, 0, -1}, 0.2, 42, 18, {1.0, 1.0, 1.0}, mesh_options); });
     instances.push_back(std::unique_ptr<MeshInstance>(bezier_instance));
     bezier_instance->set_uniforms({
         .color = {1.0, 1.0, 1.0, 1.0},
@@ -99,7 +107,10 @@ std::vector<std::unique_ptr<MeshInstance>> createScene()
     });
     bezier_instance->set_texture_index(1);
 
-    MeshInstance *sphere_instance_2 = new MeshInstance(sphere_mesh, PipelineMatrixManager::Shader::Phong);
+    MeshInstance *sphere_instance_2 = create_instance([&]
+                                                      { return create_parametric_sphere_mesh(0.24, 16, 32, {1.0, 1.0, 1.0}, mesh_options, tessellation_cache); },
+                                                      [&]
+                                                      { return create_sphere_mesh(0.24, 16, 32, {1.0, 1.0, 1.0}, mesh_options); });
     instances.push_back(std::unique_ptr<MeshInstance>(sphere_instance_2));
     sphere_instance_2->set_uniforms({
         .color = {1.0, 1.0, 1.0, 1.0},
@@ -111,6 +122,41 @@ std::vector<std::unique_ptr<MeshInstance>> createScene()
     return instances;
 }
 
+std::vector<PointLight> createLights(int dynamic_light_count)
+{
+    std::vector<PointLight> lights = {{
+        .position = {0, 0, 0, 0},
+        .color = {1.0, 1.0, 1.0, 1.0},
+        .attenuation = {1.0, 0.4, 0.1, 0},
+    }};
+
+    // Small colored lights spread on a spiral inside the cornell box
+    for (int i = 0; i < dynamic_light_count; i++)
+    {
+        float t = float(i) / float(dynamic_light_count);
+        float phi = glm::two_pi<float>() * t * 7.0f;
+        float radius = 0.4f + 0.9f * glm::fract(t * 3.0f);
+        glm::vec3 hue = 0.5f + 0.5f * glm::cos(glm::two_pi<float>() * (t + glm::vec3(0.0f, 1.0f / 3.0f, 2.0f / 3.0f)));
+        lights.push_back({
+            .position = {radius * glm::cos(phi), -1.4f + 2.8f * glm::fract(t * 11.0f), radius * glm::sin(phi), 0.6f},
+            .color = {hue, 0.5f},
+            .attenuation = {1.0, 0.0, 4.0, 0},
+        });
+    }
+    return lights;
+}
+
+void animateLights(const std::vector<PointLight> &initial, std::vector<PointLight> &lights, float time)
+{
+    // The first light is the static main light
+    for (size_t i = 1; i < initial.size(); i++)
+    {
+        float speed = 0.2f + 0.3f * float(i % 5);
+        glm::mat4 rotation = glm::rotate(glm::mat4(1.0), time * speed, {0, 1, 0});
+        lights[i].position = glm::vec4(glm::vec3(rotation * glm::vec4(glm::vec3(initial[i].position), 1.0)), initial[i].position.w);
+    }
+}
+
 #pragma endregion
 
 /* --------------------------------------------- */
@@ -136,10 +182,13 @@ int main(int argc, char **argv)
     VkSurfaceKHR vk_surface = createVkSurface(vk_instance, window);
     VkPhysicalDevice vk_physical_device = createVkPhysicalDevice(vk_instance, vk_surface);
     uint32_t graphics_queue_family = selectQueueFamilyIndex(vk_physical_device, vk_surface);
-    VkDevice vk_device = createVkDevice(vk_physical_device, graphics_queue_family);
+    uint32_t transfer_queue_family = selectTransferQueueFamilyIndex(vk_physical_device, graphics_queue_family);
+    VkDevice vk_device = createVkDevice(vk_physical_device, graphics_queue_family, transfer_queue_family);
     load_vulkan_extensions(vk_device);
     VkQueue vk_queue = VK_NULL_HANDLE;
     vkGetDeviceQueue(vk_device, graphics_queue_family, 0, &vk_queue);
+    VkQueue vk_transfer_queue = VK_NULL_HANDLE;
+    vkGetDeviceQueue(vk_device, transfer_queue_family, 0, &vk_transfer_queue);
     std::vector<VkDetailedImage> swapchain_color_attachments;
     VkDetailedImage swapchain_depth_attachment = {};
     VkSurfaceFormatKHR vk_surface_image_format = getSurfaceImageFormat(vk_physical_device, vk_surface);
@@ -201,21 +250,32 @@ int main(int argc, char **argv)
     std::shared_ptr<SharedUniformBuffer> uniform_buffer(new SharedUniformBuffer(vk_physical_device, sizeof(MeshInstanceUniformBlock), 20));
     trash.push_back(uniform_buffer);
 
-    VkDescriptorPool vk_descriptor_pool = createVkDescriptorPool(vk_device, 20, 20 * 5);
-    VkDescriptorSetLayout vk_descriptor_set_layout = createVkDescriptorSetLayout(
-        vk_device,
-        {{.binding = 0,
-          .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
-         {.binding = 1,
-          .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
-         {.binding = 2,
-          .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
-         {.binding = 3,
-          .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
-         {.binding = 4,
-          .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
-         {.binding = 5,
-          .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER}});
+    // Every instance has a spare descriptor set, see SwappableDescriptorSet
+    VkDescriptorPool vk_descriptor_pool = createVkDescriptorPool(vk_device, 43, 43 * 9);
+    std::vector<DescriptorSetLayoutParams> descriptor_set_layout_params = {
+        {.binding = 0,
+         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+        {.binding = 1,
+         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+        {.binding = 2,
+         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+        {.binding = 3,
+         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+        {.binding = 4,
+         .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+        {.binding = 5,
+         .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER},
+        {.binding = 6,
+         .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+        {.binding = 7,
+         .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+        {.binding = 8,
+         .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER}};
+    VkDescriptorSetLayout vk_descriptor_set_layout = createVkDescriptorSetLayout(vk_device, descriptor_set_layout_params);
+    // A position only pass fills the depth buffer first, so the color pass shades every pixel once
+    pipelines->init_depth_prepass(vk_device, vk_surface_image_format.format, swapchain_depth_attachment.format, swapchain_depth_attachment.extent, vk_descriptor_set_layout, renderer_ini_reader.GetBoolean("renderer", "depth_prepass", false));
+    std::shared_ptr<FragmentStatistics> fragment_statistics(new FragmentStatistics(vk_physical_device, vk_device));
+    trash.push_back(fragment_statistics);
 
     ShaderConstantsUniformBlock shader_constants = {
         .user_input = {renderer_ini_reader.GetBoolean("renderer", "normals", false), renderer_ini_reader.GetBoolean("renderer", "texcoords", false), 0, 0}};
@@ -229,43 +289,115 @@ int main(int argc, char **argv)
     VkBuffer directional_light_buffer = vklCreateHostCoherentBufferWithBackingMemory(sizeof(directional_light), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
     vklCopyDataIntoHostCoherentBuffer(directional_light_buffer, &directional_light, sizeof(directional_light));
 
-    PointLightUniformBlock point_light = {
-        .position = {0, 0, 0, 0},
-        .color = {1.0, 1.0, 1.0, 1.0},
-        .attenuation = {1.0, 0.4, 0.1, 0}};
-    VkBuffer point_light_buffer = vklCreateHostCoherentBufferWithBackingMemory(sizeof(point_light), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-    vklCopyDataIntoHostCoherentBuffer(point_light_buffer, &point_light, sizeof(point_light));
-
-    VkSampler texture_sampler = createSampler(vk_device, VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR);
-    auto textures = createTextureImages(vk_device, vk_queue, graphics_queue_family, {"wood_texture.dds", "tiles_diffuse.dds"});
-    for (auto &&tex : textures)
+    std::shared_ptr<LightClusters> light_clusters(new LightClusters(vk_physical_device, vk_device, vk_descriptor_pool));
+    trash.push_back(light_clusters);
+    std::vector<PointLight> initial_lights = createLights(renderer_ini_reader.GetInteger("renderer", "dynamic_lights", 0));
+    light_clusters->lights = initial_lights;
+
+    std::shared_ptr<ComputeCommands> compute_commands(new ComputeCommands(vk_device, graphics_queue_family));
+    trash.push_back(compute_commands);
+
+    std::shared_ptr<SamplerCache> sampler_cache(new SamplerCache(vk_physical_device, vk_device));
+    trash.push_back(sampler_cache);
+    // Anisotropy and LOD settings trade filtering quality against texture bandwidth
+    SamplerSettings texture_sampler_settings = {
+        .max_anisotropy = float(renderer_ini_reader.GetReal("renderer", "texture_anisotropy", 1.0)),
+        .lod_bias = float(renderer_ini_reader.GetReal("renderer", "texture_lod_bias", 0.0)),
+        .min_lod = float(renderer_ini_reader.GetReal("renderer", "texture_min_lod", 0.0)),
+        .max_lod = float(renderer_ini_reader.GetReal("renderer", "texture_max_lod", VK_LOD_CLAMP_NONE)),
+    };
+    VkSampler texture_sampler = sampler_cache->get(texture_sampler_settings);
+    // Resources replaced while frames in flight may still use them are released once these frames completed
+    std::shared_ptr<FrameRetirement> frame_retirement(new FrameRetirement(vk_device));
+    trash.push_back(frame_retirement);
+    // All uploads share one staging buffer, its size bounds the host memory used for uploads.
+    // Copies run on the transfer queue, so streamed uploads overlap with rendering.
+    std::shared_ptr<StagingBuffer> staging_buffer(new StagingBuffer(vk_physical_device, vk_device, vk_transfer_queue, transfer_queue_family, vk_queue, graphics_queue_family, 64 * 1024 * 1024));
+    trash.push_back(staging_buffer);
+    VkDeviceSize texture_budget = VkDeviceSize(renderer_ini_reader.GetInteger("renderer", "texture_budget_mb", 512)) * 1024 * 1024;
+    // When streaming, only the levels up to the base size are loaded before the first frame
+    bool texture_streaming = renderer_ini_reader.GetBoolean("renderer", "texture_streaming", false);
+    TextureLoadOptions texture_options = {
+        .stream_base_size = texture_streaming ? uint32_t(renderer_ini_reader.GetInteger("renderer", "texture_stream_base_size", 64)) : 0,
+        .compress = renderer_ini_reader.GetBoolean("renderer", "texture_compression", false),
+    };
+    std::shared_ptr<TextureCache> texture_cache(new TextureCache(vk_device, staging_buffer, frame_retirement, texture_budget, texture_options));
+    trash.push_back(texture_cache);
+    std::shared_ptr<TextureStreamer> texture_streamer(new TextureStreamer(vk_device, frame_retirement, staging_buffer, 4 * 1024 * 1024));
+    trash.push_back(texture_streamer);
+    auto textures = texture_cache->get({"wood_texture.dds", "tiles_diffuse.dds"});
+
+    // Culls meshlets of 64 vertices / 124 triangles against the frustum and their normal cones on the GPU
+    bool meshlet_culling = renderer_ini_reader.GetBoolean("renderer", "meshlet_culling", false);
+    MeshBuildOptions mesh_options = {
+        .optimize = renderer_ini_reader.GetBoolean("renderer", "mesh_optimization", true),
+        .vertex_layout = renderer_ini_reader.GetBoolean("renderer", "compact_vertices", false) ? VertexLayout::Compact : VertexLayout::Full,
+        .lod_levels = uint32_t(renderer_ini_reader.GetInteger("renderer", "mesh_lod_levels", 4)),
+        .meshlets = meshlet_culling,
+    };
+    // Largest projected simplification error in pixels at which a coarser level of detail is drawn
+    float lod_pixel_error = float(renderer_ini_reader.GetReal("renderer", "lod_pixel_error", 1.0));
+    // Culling, level selection and draw generation run in a compute pass, the frame records one draw per mesh instead of per instance
+    bool gpu_driven = renderer_ini_reader.GetBoolean("renderer", "gpu_driven", false);
+    // The GPU-driven path only selects among the simplified levels of a mesh, it never re-tessellates
+    bool parametric_lod = renderer_ini_reader.GetBoolean("renderer", "parametric_lod", false);
+    if (parametric_lod && gpu_driven)
     {
-        trash.push_back(tex);
+        VKL_WARNING("parametric_lod is not supported with gpu_driven, the primitives are simplified instead");
+        parametric_lod = false;
     }
-
-    auto mesh_instances = createScene();
+    std::shared_ptr<TessellationCache> tessellation_cache(new TessellationCache());
+    trash.push_back(tessellation_cache);
+    auto mesh_instances = createScene(mesh_options, parametric_lod, tessellation_cache);
+    uint32_t gpu_max_instances = gpu_driven ? uint32_t(renderer_ini_reader.GetInteger("renderer", "gpu_max_instances", 64 * 1024)) : 1;
+    std::shared_ptr<GpuCulling> gpu_culler(new GpuCulling(vk_physical_device, vk_device, vk_descriptor_pool, gpu_max_instances, 256, hasDeviceExtension(vk_physical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)));
+    trash.push_back(gpu_culler);
     for (size_t i = 0; i < mesh_instances.size(); i++)
     {
-        mesh_instances[i]->init_uniforms(vk_device, vk_descriptor_pool, vk_descriptor_set_layout, 1, uniform_buffer->buffer, uniform_buffer->slot(i));
-        trash.push_back(mesh_instances[i]->mesh);
+        std::shared_ptr<SwappableDescriptorSet> descriptor_sets(new SwappableDescriptorSet(vk_device, vk_descriptor_pool, vk_descriptor_set_layout, uint32_t(descriptor_set_layout_params.size())));
+        mesh_instances[i]->init_uniforms(vk_device, descriptor_sets, 1, uniform_buffer->buffer, uniform_buffer->slot(i));
+        // The tessellations of parametric instances belong to the cache
+        if (!mesh_instances[i]->parametric)
+            trash.push_back(mesh_instances[i]->mesh);
 
         // vklCreateGraphicsPipeline does not allow binding multiple descriptor sets simultaneously
         // thus it's required to hook the scene-static uniforms into every descriptor set
         // See: https://github.com/cg-tuwien/VulkanLaunchpad/issues/30
-        VkDescriptorSet descriptor_set = mesh_instances[i]->get_descriptor_set();
+        VkDescriptorSet descriptor_set = descriptor_sets->get();
         camera->init_uniforms(vk_device, descriptor_set, 0);
         writeDescriptorSetBuffer(vk_device, descriptor_set, 2, shader_constants_buffer, sizeof(shader_constants));
         writeDescriptorSetBuffer(vk_device, descriptor_set, 3, directional_light_buffer, sizeof(directional_light));
-        writeDescriptorSetBuffer(vk_device, descriptor_set, 4, point_light_buffer, sizeof(point_light));
+        light_clusters->init_uniforms(vk_device, descriptor_set, 4, 6, 7);
+        gpu_culler->init_uniforms(vk_device, descriptor_set, 8);
         int32_t texture_index = mesh_instances[i]->get_texture_index();
         // Without this it crashes during rendering on GitLab
         // The cornell box doesn't use the texture, but leaving the binding uninitialized still leads to an error for some reason
         if (texture_index == -1)
             texture_index = 0;
 
-        textures[texture_index]->init_uniforms(vk_device, descriptor_set, 5, texture_sampler);
+        textures[texture_index]->init_uniforms(vk_device, descriptor_sets, 5, texture_sampler);
+    }
+    if (gpu_driven)
+    {
+        gpu_culler->set_instances(mesh_instances);
+        // Instances hidden behind those drawn in the previous frame are culled against a Hi-Z pyramid
+        gpu_culler->init_occlusion(vk_physical_device, vk_device, swapchain_depth_attachment.extent, renderer_ini_reader.GetBoolean("renderer", "occlusion_culling", true));
     }
 
+    std::shared_ptr<MeshletCulling> meshlet_culler(new MeshletCulling(vk_physical_device, vk_device, vk_descriptor_pool, 64 * 1024, 1024, 64 * 1024));
+    trash.push_back(meshlet_culler);
+    // Only instances intersecting the view frustum are drawn
+    bool frustum_culling = renderer_ini_reader.GetBoolean("renderer", "frustum_culling", true);
+    FrustumCuller frustum_culler;
+    std::vector<uint32_t> visible_instances;
+    // The hierarchy over the instance bounds skips whole groups of instances outside the frustum
+    bool bvh_culling = renderer_ini_reader.GetBoolean("renderer", "bvh_culling", false);
+    std::shared_ptr<InstanceBvh> instance_bvh(new InstanceBvh());
+    instance_bvh->build(mesh_instances);
+    // Visible instances are drawn front to back within the instances sharing a pipeline
+    bool draw_sorting = renderer_ini_reader.GetBoolean("renderer", "draw_sorting", true);
+    DrawSorter draw_sorter;
+
     vklEnablePipelineHotReloading(window, GLFW_KEY_F5);
 
     while (!glfwWindowShouldClose(window))
@@ -290,28 +422,145 @@ int main(int argc, char **argv)
             shader_constants.user_input.y %= 2;
             vklCopyDataIntoHostCoherentBuffer(shader_constants_buffer, &shader_constants, sizeof(shader_constants));
         }
+        if (input->isKeyPress(GLFW_KEY_C))
+        {
+            // Counts of the last frame, taken from the path that produced visible_instances
+            if (gpu_driven)
+            {
+                VKL_LOG("GPU-driven culling: the visible instances are counted on the GPU and not read back");
+            }
+            else
+            {
+                const char *culling_path = !frustum_culling ? "No culling" : bvh_culling ? "BVH culling" : "Frustum culling";
+                size_t visible = visible_instances.size();
+                VKL_LOG(culling_path << ": " << visible << " visible, " << mesh_instances.size() - visible << " culled instances");
+            }
+        }
+        if (input->isKeyPress(GLFW_KEY_O))
+        {
+            fragment_statistics->log();
+        }
+        if (input->isMouseTap(GLFW_MOUSE_BUTTON_RIGHT))
+        {
+            // The cursor is in window coordinates, the camera viewport in framebuffer pixels
+            int window_width, window_height;
+            glfwGetWindowSize(window, &window_width, &window_height);
+            glm::vec2 cursor = input->mousePos() * camera->viewportSize / glm::vec2(window_width, window_height);
+            auto start = std::chrono::high_resolution_clock::now();
+            glm::vec3 ray_origin, ray_direction;
+            cursorRay(*camera, cursor, ray_origin, ray_direction);
+            instance_bvh->refit(mesh_instances);
+            PickResult picked = pick(*instance_bvh, mesh_instances, ray_origin, ray_direction);
+            auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+            if (picked.instance != nullptr)
+                VKL_LOG("Picked instance " << picked.instance_index << " at (" << picked.position.x << ", " << picked.position.y << ", " << picked.position.z << ") in " << microseconds << " us");
+            else
+                VKL_LOG("Picked nothing in " << microseconds << " us");
+        }
 
         pipelines->update();
         controls->update();
 
+        if (texture_streaming)
+        {
+            for (auto &&i : mesh_instances)
+            {
+                if (i->get_texture_index() != -1)
+                    texture_streamer->request(textures[i->get_texture_index()], screenFootprint(*camera, i->get_bounding_sphere()));
+            }
+            texture_streamer->update();
+        }
+
+        if (gpu_driven)
+        {
+            visible_instances.clear();
+        }
+        else if (frustum_culling && bvh_culling)
+        {
+            // Re-tessellation changes the bounds of parametric instances
+            instance_bvh->refit(mesh_instances);
+            instance_bvh->query_frustum(frustumPlanes(*camera), visible_instances);
+        }
+        else if (frustum_culling)
+        {
+            frustum_culler.cull(*camera, mesh_instances, visible_instances);
+        }
+        else
+        {
+            visible_instances.resize(mesh_instances.size());
+            std::iota(visible_instances.begin(), visible_instances.end(), 0);
+        }
+        // May replace the mesh of parametric instances
+        for (uint32_t index : visible_instances)
+        {
+            mesh_instances[index]->update_lod(*camera, lod_pixel_error);
+        }
+        if (draw_sorting && !gpu_driven)
+        {
+            draw_sorter.sort(*camera, mesh_instances, visible_instances);
+        }
+
+        animateLights(initial_lights, light_clusters->lights, float(glfwGetTime()));
+        light_clusters->update(*camera);
+        VkCommandBuffer vk_compute_cmd_buffer = compute_commands->begin();
+        fragment_statistics->reset(vk_compute_cmd_buffer);
+        light_clusters->dispatch(vk_compute_cmd_buffer);
+        if (gpu_driven)
+        {
+            gpu_culler->update(*camera, lod_pixel_error);
+            gpu_culler->dispatch(vk_compute_cmd_buffer);
+        }
+        else if (meshlet_culling)
+        {
+            meshlet_culler->update(*camera, mesh_instances, visible_instances, pipelines->get_culling_mode() == VK_CULL_MODE_BACK_BIT);
+            meshlet_culler->dispatch(vk_compute_cmd_buffer);
+        }
+        compute_commands->submit(vk_queue);
+
         vklWaitForNextSwapchainImage();
         vklStartRecordingCommands();
         VkCommandBuffer vk_cmd_buffer = vklGetCurrentCommandBuffer();
 
-        for (auto &&i : mesh_instances)
+        // Draws the visible instances with the pipelines of the current pass
+        auto draw_instances = [&]()
+        {
+            if (gpu_driven)
+                gpu_culler->draw(vk_cmd_buffer, *pipelines);
+            bool depth_only = pipelines->get_pass() == PipelineMatrixManager::Pass::Depth;
+            for (uint32_t index : visible_instances)
+            {
+                MeshInstance *i = mesh_instances[index].get();
+                pipelines->set_shader(i->get_shader());
+                pipelines->set_vertex_layout(i->mesh->get_vertex_layout());
+                VkPipelineLayout vk_pipeline_layout = pipelines->bind_selected(vk_cmd_buffer);
+
+                i->bind_uniforms(vk_cmd_buffer, vk_pipeline_layout);
+                if (depth_only)
+                    i->mesh->bind_positions(vk_cmd_buffer);
+                else
+                    i->mesh->bind(vk_cmd_buffer);
+                if (meshlet_culling)
+                    meshlet_culler->draw(vk_cmd_buffer, index, *i);
+                else
+                    i->mesh->draw(vk_cmd_buffer, i->get_lod());
+            }
+        };
+
+        bool depth_prepass = pipelines->uses_depth_prepass();
+        fragment_statistics->begin(vk_cmd_buffer, depth_prepass);
+        if (depth_prepass)
         {
-            pipelines->set_shader(i->get_shader());
-            VkPipeline vk_selected_pipeline = pipelines->selected();
-            vklCmdBindPipeline(vk_cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk_selected_pipeline);
-            VkPipelineLayout vk_pipeline_layout = vklGetLayoutForPipeline(vk_selected_pipeline);
-
-            i->bind_uniforms(vk_cmd_buffer, vk_pipeline_layout);
-            i->mesh->bind(vk_cmd_buffer);
-            i->mesh->draw(vk_cmd_buffer);
+            pipelines->set_pass(PipelineMatrixManager::Pass::Depth);
+            draw_instances();
+            pipelines->set_pass(PipelineMatrixManager::Pass::Equal);
         }
+        draw_instances();
+        pipelines->set_pass(PipelineMatrixManager::Pass::Standard);
+        fragment_statistics->end(vk_cmd_buffer);
 
         vklEndRecordingCommands();
         vklPresentCurrentSwapchainImage();
+        frame_retirement->end_frame(vk_queue);
 
         if (cmdline_args.run_headless)
         {
@@ -335,13 +584,11 @@ int main(int argc, char **argv)
     vkDestroyDescriptorPool(vk_device, vk_descriptor_pool, nullptr);
     vklDestroyHostCoherentBufferAndItsBackingMemory(shader_constants_buffer);
     vklDestroyHostCoherentBufferAndItsBackingMemory(directional_light_buffer);
-    vklDestroyHostCoherentBufferAndItsBackingMemory(point_light_buffer);
     vklDestroyDeviceLocalImageAndItsBackingMemory(swapchain_depth_attachment.image);
     for (auto &&i : trash)
     {
         i->destroy(vk_device);
     }
-    vkDestroySampler(vk_device, texture_sampler, nullptr);
     gcgDestroyFramework();
     vkDestroySwapchainKHR(vk_device, vk_swapchain, nullptr);
     vkDestroyDevice(vk_device, nullptr);
@@ -0,0 +1,98 @@
+#include "MappedFile.h"
+
+#include <VulkanLaunchpad.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#pragma region MappedFile
+#if defined(_WIN32)
+MappedFile::MappedFile(const std::string &path)
+{
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		VKL_EXIT_WITH_ERROR("Could not open file: " << path);
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file_handle, &file_size);
+	size = size_t(file_size.QuadPart);
+	if (size == 0)
+		return;
+
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle == nullptr)
+	{
+		VKL_EXIT_WITH_ERROR("Could not map file: " << path);
+	}
+	data = static_cast<const uint8_t *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr)
+	{
+		VKL_EXIT_WITH_ERROR("Could not map file: " << path);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping_handle != nullptr)
+		CloseHandle(mapping_handle);
+	if (file_handle != nullptr && file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+}
+
+void MappedFile::advise_sequential()
+{
+	// FILE_FLAG_SEQUENTIAL_SCAN already selects sequential read-ahead
+}
+#else
+MappedFile::MappedFile(const std::string &path)
+{
+	file_descriptor = open(path.c_str(), O_RDONLY);
+	if (file_descriptor == -1)
+	{
+		VKL_EXIT_WITH_ERROR("Could not open file: " << path);
+	}
+	struct stat file_stat;
+	if (fstat(file_descriptor, &file_stat) == -1)
+	{
+		VKL_EXIT_WITH_ERROR("Could not stat file: " << path);
+	}
+	size = size_t(file_stat.st_size);
+	if (size == 0)
+		return;
+
+	void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		VKL_EXIT_WITH_ERROR("Could not map file: " << path);
+	}
+	data = static_cast<const uint8_t *>(mapping);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data != nullptr)
+		munmap(const_cast<uint8_t *>(data), size);
+	if (file_descriptor != -1)
+		close(file_descriptor);
+}
+
+void MappedFile::advise_sequential()
+{
+	if (data == nullptr)
+		return;
+	madvise(const_cast<uint8_t *>(data), size, MADV_SEQUENTIAL);
+	madvise(const_cast<uint8_t *>(data), size, MADV_WILLNEED);
+}
+#endif
+#pragma endregion
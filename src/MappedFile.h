@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// A read-only memory mapping of a whole file
+class MappedFile
+{
+private:
+#if defined(_WIN32)
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+
+public:
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+
+	MappedFile(const std::string &path);
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// Hints that the mapping will be read front to back and starts the read-ahead
+	void advise_sequential();
+};
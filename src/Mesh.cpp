@@ -2,33 +2,219 @@
 
 #include <VulkanLaunchpad.h>
 #include "Descriptors.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "Meshlets.h"
+
+#include <limits>
+#include <cstring>
+#include <array>
+#include <cmath>
+
+uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t float_exponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+	int32_t exponent = int32_t(float_exponent) - 127 + 15;
+	if (float_exponent == 0xff)
+		return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+	if (exponent >= 31)
+		return sign | 0x7c00;
+	if (exponent <= 0)
+	{
+		// subnormal half
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			half++;
+		return sign | half;
+	}
+	// rounding may carry into the exponent, which still yields the nearest value
+	uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		half++;
+	return uint16_t(half);
+}
+
+// Projects the unit vector onto an octahedron which is unfolded into [-1, 1]^2
+glm::vec2 octahedralEncode(glm::vec3 n)
+{
+	n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (n.z >= 0.0f)
+		return glm::vec2(n.x, n.y);
+	return glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+int16_t floatToSnorm16(float value)
+{
+	return int16_t(std::round(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
 
 #pragma region Mesh
-Mesh::Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices)
+Mesh::Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices, VertexLayout layout, std::vector<MeshLod> lods, bool meshlets)
+{
+	// 16 bit indices halve the index memory and bandwidth whenever every vertex is addressable with them
+	if (vertices.size() <= std::numeric_limits<uint16_t>::max() + size_t(1))
+	{
+		std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+		this->indices = vklCreateHostCoherentBufferWithBackingMemory(short_indices.size() * sizeof(uint16_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+		vklCopyDataIntoHostCoherentBuffer(this->indices, &short_indices.front(), short_indices.size() * sizeof(uint16_t));
+		this->index_type = VK_INDEX_TYPE_UINT16;
+	}
+	else
+	{
+		this->indices = vklCreateHostCoherentBufferWithBackingMemory(indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+		vklCopyDataIntoHostCoherentBuffer(this->indices, &indices.front(), indices.size() * sizeof(uint32_t));
+		this->index_type = VK_INDEX_TYPE_UINT32;
+	}
+	this->lods = lods.empty() ? std::vector<MeshLod>{{0, uint32_t(indices.size()), 0.0f}} : lods;
+	if (meshlets)
+		this->meshlets = buildMeshlets(vertices, indices, this->lods);
+
+	const MeshLod &full_level = this->lods[0];
+	uint32_t triangle_count = full_level.index_count / 3;
+	triangle_batches.resize((triangle_count + TRIANGLE_BATCH_SIZE - 1) / TRIANGLE_BATCH_SIZE, TriangleBatch{});
+	for (uint32_t t = 0; t < triangle_count; t++)
+	{
+		TriangleBatch &batch = triangle_batches[t / TRIANGLE_BATCH_SIZE];
+		uint32_t lane = t % TRIANGLE_BATCH_SIZE;
+		glm::vec3 v0 = vertices[indices[full_level.first_index + t * 3]].position;
+		glm::vec3 e1 = vertices[indices[full_level.first_index + t * 3 + 1]].position - v0;
+		glm::vec3 e2 = vertices[indices[full_level.first_index + t * 3 + 2]].position - v0;
+		batch.v0_x[lane] = v0.x;
+		batch.v0_y[lane] = v0.y;
+		batch.v0_z[lane] = v0.z;
+		batch.e1_x[lane] = e1.x;
+		batch.e1_y[lane] = e1.y;
+		batch.e1_z[lane] = e1.z;
+		batch.e2_x[lane] = e2.x;
+		batch.e2_y[lane] = e2.y;
+		batch.e2_z[lane] = e2.z;
+	}
+
+	glm::vec3 min_position = vertices[0].position;
+	glm::vec3 max_position = vertices[0].position;
+	for (auto &&v : vertices)
+	{
+		min_position = glm::min(min_position, v.position);
+		max_position = glm::max(max_position, v.position);
+	}
+
+	bool uniform_color = std::all_of(vertices.begin(), vertices.end(), [&](const Vertex &v)
+									 { return v.color == vertices[0].color; });
+	if (layout == VertexLayout::Compact && uniform_color)
+	{
+		create_compact_vertex_streams(vertices, min_position, max_position);
+	}
+	else
+	{
+		create_vertex_streams(vertices);
+	}
+
+	glm::vec3 center = (min_position + max_position) * 0.5f;
+	float radius = 0.0f;
+	for (auto &&v : vertices)
+	{
+		radius = std::max(radius, glm::length(v.position - center));
+	}
+	this->bounding_sphere = glm::vec4(center, radius);
+	this->aabb_min = min_position;
+	this->aabb_max = max_position;
+}
+
+void Mesh::create_vertex_streams(const std::vector<Vertex> &vertices)
 {
-	this->vertices = vklCreateHostCoherentBufferWithBackingMemory(vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-	vklCopyDataIntoHostCoherentBuffer(this->vertices, &vertices.front(), vertices.size() * sizeof(Vertex));
-	this->indices = vklCreateHostCoherentBufferWithBackingMemory(indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-	vklCopyDataIntoHostCoherentBuffer(this->indices, &indices.front(), indices.size() * sizeof(uint32_t));
-	this->index_count = indices.size();
+	std::vector<glm::vec3> vertex_positions(vertices.size());
+	std::vector<VertexAttributes> vertex_attributes(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		vertex_positions[i] = vertices[i].position;
+		vertex_attributes[i] = {vertices[i].color, vertices[i].normal, vertices[i].uv};
+	}
+	this->positions = vklCreateHostCoherentBufferWithBackingMemory(vertex_positions.size() * sizeof(glm::vec3), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	vklCopyDataIntoHostCoherentBuffer(this->positions, &vertex_positions.front(), vertex_positions.size() * sizeof(glm::vec3));
+	this->attributes = vklCreateHostCoherentBufferWithBackingMemory(vertex_attributes.size() * sizeof(VertexAttributes), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	vklCopyDataIntoHostCoherentBuffer(this->attributes, &vertex_attributes.front(), vertex_attributes.size() * sizeof(VertexAttributes));
+}
+
+void Mesh::create_compact_vertex_streams(const std::vector<Vertex> &vertices, glm::vec3 min_position, glm::vec3 max_position)
+{
+	glm::vec3 extent = max_position - min_position;
+	std::vector<CompactPosition> vertex_positions(vertices.size());
+	std::vector<CompactVertexAttributes> vertex_attributes(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const Vertex &v = vertices[i];
+		CompactPosition &p = vertex_positions[i];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float t = extent[axis] > 0.0f ? (v.position[axis] - min_position[axis]) / extent[axis] : 0.0f;
+			p.position[axis] = uint16_t(std::round(std::clamp(t, 0.0f, 1.0f) * 65535.0f));
+		}
+		p.position[3] = 0;
+		CompactVertexAttributes &a = vertex_attributes[i];
+		glm::vec2 normal = octahedralEncode(v.normal);
+		a.normal[0] = floatToSnorm16(normal.x);
+		a.normal[1] = floatToSnorm16(normal.y);
+		a.uv[0] = floatToHalf(v.uv.x);
+		a.uv[1] = floatToHalf(v.uv.y);
+	}
+	this->positions = vklCreateHostCoherentBufferWithBackingMemory(vertex_positions.size() * sizeof(CompactPosition), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	vklCopyDataIntoHostCoherentBuffer(this->positions, &vertex_positions.front(), vertex_positions.size() * sizeof(CompactPosition));
+	this->attributes = vklCreateHostCoherentBufferWithBackingMemory(vertex_attributes.size() * sizeof(CompactVertexAttributes), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	vklCopyDataIntoHostCoherentBuffer(this->attributes, &vertex_attributes.front(), vertex_attributes.size() * sizeof(CompactVertexAttributes));
+
+	glm::vec4 color = glm::vec4(vertices[0].color, 1.0f);
+	this->constant_color = vklCreateHostCoherentBufferWithBackingMemory(sizeof(color), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	vklCopyDataIntoHostCoherentBuffer(this->constant_color, &color, sizeof(color));
+
+	this->vertex_layout = VertexLayout::Compact;
+	this->position_scale = glm::vec4(extent, 1.0f);
+	this->position_offset = glm::vec4(min_position, 0.0f);
+}
+
+void Mesh::fill_uniforms(MeshInstanceUniformBlock &uniform_block)
+{
+	uniform_block.position_scale = position_scale;
+	uniform_block.position_offset = position_offset;
+	uniform_block.vertex_layout = glm::uvec4(vertex_layout == VertexLayout::Compact ? 1 : 0, 0, 0, 0);
 }
 
 void Mesh::destroy(VkDevice device)
 {
-	vklDestroyHostCoherentBufferAndItsBackingMemory(vertices);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(positions);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(attributes);
 	vklDestroyHostCoherentBufferAndItsBackingMemory(indices);
+	if (constant_color != VK_NULL_HANDLE)
+		vklDestroyHostCoherentBufferAndItsBackingMemory(constant_color);
 }
 
 void Mesh::bind(VkCommandBuffer cmd_buffer)
+{
+	std::array<VkBuffer, 3> vertex_buffers = {positions, attributes, constant_color};
+	std::array<VkDeviceSize, 3> vertex_offsets = {0, 0, 0};
+	uint32_t binding_count = vertex_layout == VertexLayout::Compact ? 3 : 2;
+	vkCmdBindVertexBuffers(cmd_buffer, 0, binding_count, vertex_buffers.data(), vertex_offsets.data());
+	vkCmdBindIndexBuffer(cmd_buffer, indices, 0, index_type);
+}
+
+void Mesh::bind_positions(VkCommandBuffer cmd_buffer)
 {
 	VkDeviceSize vertex_offset = 0;
-	vkCmdBindVertexBuffers(cmd_buffer, 0, 1, &vertices, &vertex_offset);
-	vkCmdBindIndexBuffer(cmd_buffer, indices, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdBindVertexBuffers(cmd_buffer, 0, 1, &positions, &vertex_offset);
+	vkCmdBindIndexBuffer(cmd_buffer, indices, 0, index_type);
 }
 
-void Mesh::draw(VkCommandBuffer cmd_buffer)
+void Mesh::draw(VkCommandBuffer cmd_buffer, uint32_t lod)
 {
-	vkCmdDrawIndexed(cmd_buffer, index_count, 1, 0, 0, 0);
+	const MeshLod &level = lods[std::min(lod, uint32_t(lods.size() - 1))];
+	vkCmdDrawIndexed(cmd_buffer, level.index_count, 1, level.first_index, 0, 0);
 }
 #pragma endregion
 
@@ -39,10 +225,17 @@ MeshInstance::MeshInstance(std::shared_ptr<Mesh> mesh, PipelineMatrixManager::Sh
 	this->shader = shader;
 }
 
-void MeshInstance::init_uniforms(VkDevice device, VkDescriptorPool descriptor_pool, VkDescriptorSetLayout descriptor_layout, uint32_t binding, VkBuffer uniform_buffer, UniformBufferSlot slot)
+MeshInstance::MeshInstance(std::shared_ptr<ParametricMesh> parametric, PipelineMatrixManager::Shader shader)
+{
+	this->parametric = parametric;
+	this->mesh = parametric->get(0);
+	this->shader = shader;
+}
+
+void MeshInstance::init_uniforms(VkDevice device, std::shared_ptr<SwappableDescriptorSet> descriptor_set, uint32_t binding, VkBuffer uniform_buffer, UniformBufferSlot slot)
 {
-	this->descriptor_set = createVkDescriptorSet(device, descriptor_pool, descriptor_layout);
-	writeDescriptorSetBuffer(device, descriptor_set, binding, uniform_buffer, sizeof(uniform_block), slot);
+	this->descriptor_set = descriptor_set;
+	writeDescriptorSetBuffer(device, descriptor_set->get(), binding, uniform_buffer, sizeof(uniform_block), slot);
 	this->uniform_buffer = uniform_buffer;
 	this->uniform_slot = slot;
 	set_uniforms(uniform_block);
@@ -51,19 +244,72 @@ void MeshInstance::init_uniforms(VkDevice device, VkDescriptorPool descriptor_po
 void MeshInstance::set_uniforms(MeshInstanceUniformBlock data)
 {
 	uniform_block = data;
+	mesh->fill_uniforms(uniform_block);
 	if (uniform_buffer != VK_NULL_HANDLE)
 		vklCopyDataIntoHostCoherentBuffer(uniform_buffer, uniform_slot.offset, &uniform_block, uniform_slot.size);
+	if (changes)
+		changes->push_back(change_index);
+}
+
+void MeshInstance::track_changes(std::shared_ptr<std::vector<uint32_t>> changes, uint32_t index)
+{
+	this->changes = changes;
+	this->change_index = index;
 }
 
 void MeshInstance::bind_uniforms(VkCommandBuffer cmd_buffer, VkPipelineLayout pipeline_layout)
 {
-	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
+	VkDescriptorSet set = descriptor_set->get();
+	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &set, 0, nullptr);
 }
 
-VkDescriptorSet MeshInstance::get_descriptor_set()
+std::shared_ptr<SwappableDescriptorSet> MeshInstance::get_descriptor_set()
 {
 	return descriptor_set;
 }
+
+// Levels are ordered from fine to coarse, projected_error returns the error of a level in pixels
+uint32_t selectLod(uint32_t current, uint32_t level_count, std::function<float(uint32_t)> projected_error, float pixel_error)
+{
+	uint32_t level = std::min(current, level_count - 1);
+	while (level > 0 && projected_error(level) > pixel_error)
+		level--;
+	const float hysteresis = 0.75f;
+	while (level + 1 < level_count && projected_error(level + 1) <= pixel_error * hysteresis)
+		level++;
+	return level;
+}
+
+void MeshInstance::update_lod(Camera &camera, float pixel_error)
+{
+	// Pixels per object space unit, the footprint is the projected diameter of the bounding sphere
+	float pixels_per_unit = screenFootprint(camera, get_bounding_sphere()) / std::max(2.0f * mesh->get_bounding_sphere().w, 1e-6f);
+	if (parametric)
+	{
+		uint32_t level = selectLod(tessellation_level, parametric->get_level_count(), [&](uint32_t l)
+								   { return parametric->get_error(l) * pixels_per_unit; }, pixel_error);
+		if (level != tessellation_level)
+		{
+			tessellation_level = level;
+			mesh = parametric->get(level);
+			// The dequantization parameters differ between levels
+			set_uniforms(uniform_block);
+		}
+		return;
+	}
+
+	const std::vector<MeshLod> &lods = mesh->get_lods();
+	lod = selectLod(lod, uint32_t(lods.size()), [&](uint32_t l)
+					{ return lods[l].error * pixels_per_unit; }, pixel_error);
+}
+
+glm::vec4 MeshInstance::get_bounding_sphere()
+{
+	glm::vec4 sphere = mesh->get_bounding_sphere();
+	glm::mat4 &m = uniform_block.model_matrix;
+	float scale = std::max({glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))});
+	return glm::vec4(glm::vec3(m * glm::vec4(glm::vec3(sphere), 1.0f)), sphere.w * scale);
+}
 #pragma endregion
 
 #pragma region BezierCurve
@@ -137,6 +383,17 @@ glm::vec3 BezierCurve::tanget_at(float t)
 #pragma endregion
 
 #pragma region MeshBuilder
+std::unique_ptr<Mesh> buildMesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices, const MeshBuildOptions &options)
+{
+	// Generation order walks ring by ring, which thrashes the post-transform cache on finely tessellated meshes
+	if (options.optimize)
+		optimizeMesh(vertices, indices);
+	std::vector<MeshLod> lods;
+	if (options.lod_levels > 1)
+		lods = generateLods(vertices, indices, options.lod_levels);
+	return std::make_unique<Mesh>(vertices, indices, options.vertex_layout, lods, options.meshlets);
+}
+
 class MeshBuilder
 {
 private:
@@ -168,9 +425,9 @@ public:
 	{
 	}
 
-	std::unique_ptr<Mesh> build()
+	std::unique_ptr<Mesh> build(const MeshBuildOptions &options)
 	{
-		return make_unique<Mesh>(vertices, indices);
+		return buildMesh(std::move(vertices), std::move(indices), options);
 	}
 
 	uint32_t index()
@@ -268,7 +525,7 @@ void append_circle_cap(MeshBuilder &builder, float radius, int segments, glm::ve
 	}
 }
 
-std::unique_ptr<Mesh> create_cylinder_mesh(float radius, float height, int segments, glm::vec3 color)
+std::unique_ptr<Mesh> create_cylinder_mesh(float radius, float height, int segments, glm::vec3 color, const MeshBuildOptions &options)
 {
 	std::unique_ptr<MeshBuilder> builder = std::make_unique<MeshBuilder>();
 
@@ -304,10 +561,10 @@ std::unique_ptr<Mesh> create_cylinder_mesh(float radius, float height, int segme
 			top_cycle = builder->start_cycle(segments);
 	}
 
-	return builder->build();
+	return builder->build(options);
 }
 
-std::unique_ptr<Mesh> create_sphere_mesh(float radius, int rings, int segments, glm::vec3 color)
+std::unique_ptr<Mesh> create_sphere_mesh(float radius, int rings, int segments, glm::vec3 color, const MeshBuildOptions &options)
 {
 	std::unique_ptr<MeshBuilder> builder = std::make_unique<MeshBuilder>();
 
@@ -352,10 +609,10 @@ std::unique_ptr<Mesh> create_sphere_mesh(float radius, int rings, int segments,
 		prev_cycle = curr_cycle;
 	}
 
-	return builder->build();
+	return builder->build(options);
 }
 
-std::unique_ptr<Mesh> create_bezier_mesh(std::unique_ptr<BezierCurve> curve, glm::vec3 up, float radius, int resolution, int segments, glm::vec3 color)
+std::unique_ptr<Mesh> create_bezier_mesh(std::unique_ptr<BezierCurve> curve, glm::vec3 up, float radius, int resolution, int segments, glm::vec3 color, const MeshBuildOptions &options)
 {
 	std::unique_ptr<MeshBuilder> builder = std::make_unique<MeshBuilder>();
 
@@ -410,7 +667,7 @@ std::unique_ptr<Mesh> create_bezier_mesh(std::unique_ptr<BezierCurve> curve, glm
 		prev_p = p;
 	}
 
-	return builder->build();
+	return builder->build(options);
 }
 
 glm::vec3 cube_vertex_positions[]{
@@ -474,7 +731,7 @@ std::vector<CubeFace>
 		},
 };
 
-std::unique_ptr<Mesh> create_cube_mesh(float width, float height, float depth, glm::vec3 color)
+std::unique_ptr<Mesh> create_cube_mesh(float width, float height, float depth, glm::vec3 color, const MeshBuildOptions &options)
 {
 	std::vector<glm::vec3> positions(std::begin(cube_vertex_positions), std::end(cube_vertex_positions));
 
@@ -501,7 +758,7 @@ std::unique_ptr<Mesh> create_cube_mesh(float width, float height, float depth, g
 		index += 4;
 	}
 
-	return std::make_unique<Mesh>(vertices, indices);
+	return buildMesh(vertices, indices, options);
 }
 
 std::vector<uint32_t> cornell_indices = {
@@ -549,7 +806,7 @@ uint32_t cornell_position_swizzle[]{
 	// Back
 	7, 6, 4, 5};
 
-std::unique_ptr<Mesh> create_cornell_mesh(float width, float height, float depth)
+std::unique_ptr<Mesh> create_cornell_mesh(float width, float height, float depth, const MeshBuildOptions &options)
 {
 	std::vector<glm::vec3> positions(std::begin(cube_vertex_positions), std::end(cube_vertex_positions));
 
@@ -573,5 +830,166 @@ std::unique_ptr<Mesh> create_cornell_mesh(float width, float height, float depth
 		}
 	}
 
-	return std::make_unique<Mesh>(vertices, cornell_indices);
-}
\ No newline at end of file
+	return buildMesh(vertices, cornell_indices, options);
+}
+
+#pragma region ParametricMesh
+size_t TessellationCache::KeyHash::operator()(const Key &key) const
+{
+	size_t hash = size_t(key.primitive);
+	for (int32_t parameter : key.parameters)
+	{
+		hash = hash * 1000003 ^ size_t(uint32_t(parameter));
+	}
+	return hash;
+}
+
+std::shared_ptr<Mesh> TessellationCache::get(const Key &key, const std::function<std::unique_ptr<Mesh>()> &generate)
+{
+	auto cached = meshes.find(key);
+	if (cached != meshes.end())
+		return cached->second;
+	std::shared_ptr<Mesh> mesh = generate();
+	meshes.emplace(key, mesh);
+	return mesh;
+}
+
+void TessellationCache::destroy(VkDevice device)
+{
+	for (auto &&[key, mesh] : meshes)
+	{
+		mesh->destroy(device);
+	}
+	meshes.clear();
+}
+
+ParametricMesh::ParametricMesh(std::function<std::shared_ptr<Mesh>(uint32_t level)> generate, std::vector<float> errors)
+{
+	this->generate = generate;
+	this->errors = errors;
+	this->levels.resize(errors.size());
+}
+
+std::shared_ptr<Mesh> ParametricMesh::get(uint32_t level)
+{
+	level = std::min(level, uint32_t(levels.size() - 1));
+	if (!levels[level])
+		levels[level] = generate(level);
+	return levels[level];
+}
+
+// Arguments closer than 1e-4 share a key, the resolutions of the level and the build options are part of it
+TessellationCache::Key tessellationKey(ParametricPrimitive primitive, const std::vector<float> &values, const std::vector<int> &resolutions, const MeshBuildOptions &options)
+{
+	TessellationCache::Key key = {primitive};
+	for (float value : values)
+	{
+		key.parameters.push_back(int32_t(std::lround(double(value) * 1e4)));
+	}
+	key.parameters.insert(key.parameters.end(), resolutions.begin(), resolutions.end());
+	key.parameters.push_back(options.optimize);
+	key.parameters.push_back(int32_t(options.vertex_layout));
+	key.parameters.push_back(options.meshlets);
+	return key;
+}
+
+// Every tessellation is exact already, simplifying it would only add error
+MeshBuildOptions exactLevelOptions(MeshBuildOptions options)
+{
+	options.lod_levels = 1;
+	return options;
+}
+
+// Divides the resolution by 2^level, rounding up
+int reduceResolution(int resolution, uint32_t level, int minimum)
+{
+	return std::max(minimum, (resolution + (1 << level) - 1) >> level);
+}
+
+// Distance between the arc over angle and its chord
+float sagitta(float radius, float angle)
+{
+	return radius * (1.0f - glm::cos(angle / 2.0f));
+}
+
+// Levels until all resolutions reached their minimum
+std::vector<float> tessellationErrors(std::vector<int> resolutions, std::vector<int> minimums, std::function<float(uint32_t level)> error)
+{
+	std::vector<float> errors = {error(0)};
+	for (uint32_t level = 1; level < 31; level++)
+	{
+		bool reduced = false;
+		for (size_t i = 0; i < resolutions.size(); i++)
+		{
+			reduced |= reduceResolution(resolutions[i], level, minimums[i]) != reduceResolution(resolutions[i], level - 1, minimums[i]);
+		}
+		if (!reduced)
+			break;
+		errors.push_back(error(level));
+	}
+	return errors;
+}
+
+std::shared_ptr<ParametricMesh> create_parametric_cylinder_mesh(float radius, float height, int segments, glm::vec3 color, const MeshBuildOptions &options, std::shared_ptr<TessellationCache> cache)
+{
+	MeshBuildOptions level_options = exactLevelOptions(options);
+	auto generate = [=](uint32_t level)
+	{
+		int level_segments = reduceResolution(segments, level, 3);
+		return cache->get(tessellationKey(ParametricPrimitive::Cylinder, {radius, height, color.x, color.y, color.z}, {level_segments}, level_options), [&]
+						  { return create_cylinder_mesh(radius, height, level_segments, color, level_options); });
+	};
+	auto error = [=](uint32_t level)
+	{ return sagitta(radius, glm::two_pi<float>() / reduceResolution(segments, level, 3)); };
+	return std::make_shared<ParametricMesh>(generate, tessellationErrors({segments}, {3}, error));
+}
+
+std::shared_ptr<ParametricMesh> create_parametric_sphere_mesh(float radius, int rings, int segments, glm::vec3 color, const MeshBuildOptions &options, std::shared_ptr<TessellationCache> cache)
+{
+	MeshBuildOptions level_options = exactLevelOptions(options);
+	auto generate = [=](uint32_t level)
+	{
+		int level_rings = reduceResolution(rings, level, 3);
+		int level_segments = reduceResolution(segments, level, 3);
+		return cache->get(tessellationKey(ParametricPrimitive::Sphere, {radius, color.x, color.y, color.z}, {level_rings, level_segments}, level_options), [&]
+						  { return create_sphere_mesh(radius, level_rings, level_segments, color, level_options); });
+	};
+	// The center of a patch deviates by about the sum of the deviations along both directions
+	auto error = [=](uint32_t level)
+	{ return sagitta(radius, glm::pi<float>() / reduceResolution(rings, level, 3)) + sagitta(radius, glm::two_pi<float>() / reduceResolution(segments, level, 3)); };
+	return std::make_shared<ParametricMesh>(generate, tessellationErrors({rings, segments}, {3, 3}, error));
+}
+
+std::shared_ptr<ParametricMesh> create_parametric_bezier_mesh(std::vector<glm::vec3> points, glm::vec3 up, float radius, int resolution, int segments, glm::vec3 color, const MeshBuildOptions &options, std::shared_ptr<TessellationCache> cache)
+{
+	MeshBuildOptions level_options = exactLevelOptions(options);
+	std::vector<float> values = {up.x, up.y, up.z, radius, color.x, color.y, color.z};
+	for (glm::vec3 point : points)
+	{
+		values.insert(values.end(), {point.x, point.y, point.z});
+	}
+	auto generate = [=](uint32_t level)
+	{
+		int level_resolution = reduceResolution(resolution, level, 1);
+		int level_segments = reduceResolution(segments, level, 3);
+		return cache->get(tessellationKey(ParametricPrimitive::Bezier, values, {level_resolution, level_segments}, level_options), [&]
+						  { return create_bezier_mesh(std::make_unique<BezierCurve>(points), up, radius, level_resolution, level_segments, color, level_options); });
+	};
+	// The deviation of the curve from its polyline is estimated at the middle of every span
+	auto error = [=](uint32_t level)
+	{
+		BezierCurve curve(points);
+		int spans = reduceResolution(resolution, level, 1);
+		float curve_error = 0.0f;
+		for (int i = 0; i < spans; i++)
+		{
+			glm::vec3 a = curve.value_at(float(i) / spans);
+			glm::vec3 b = curve.value_at(float(i + 1) / spans);
+			glm::vec3 middle = curve.value_at((i + 0.5f) / spans);
+			curve_error = std::max(curve_error, glm::distance(middle, (a + b) * 0.5f));
+		}
+		return curve_error + sagitta(radius, glm::two_pi<float>() / reduceResolution(segments, level, 3));
+	};
+	return std::make_shared<ParametricMesh>(generate, tessellationErrors({resolution, segments}, {1, 3}, error));
+}
+#pragma endregion
@@ -8,9 +8,12 @@
 #include <algorithm>
 #include <iterator>
 #include <memory>
+#include <unordered_map>
 
 #include "MyUtils.h"
 #include "Pipelines.h"
+#include "Camera.h"
+#include "Descriptors.h"
 
 struct Vertex
 {
@@ -20,29 +23,222 @@ struct Vertex
 	glm::vec2 uv;
 };
 
+// Meshes store positions and the remaining attributes in separate vertex streams (bindings 0 and 1),
+// so depth only passes fetch nothing but positions
+struct VertexAttributes
+{
+	glm::vec3 color;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+// Streams of VertexLayout::Compact, 16 bytes per vertex in total. The color is stored once per mesh.
+struct CompactPosition
+{
+	// unorm16 relative to the bounds of the mesh, w is padding
+	uint16_t position[4];
+};
+
+struct CompactVertexAttributes
+{
+	// octahedral encoded unit vector as snorm16
+	int16_t normal[2];
+	// float16
+	uint16_t uv[2];
+};
+
+// A level of detail, a range of the shared index buffer
+struct MeshLod
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	// largest deviation from the original surface in object space
+	float error;
+	// the meshlets covering the index range
+	uint32_t first_meshlet = 0;
+	uint32_t meshlet_count = 0;
+};
+
+// A cluster of consecutive triangles, at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles.
+// The layout matches cull_meshlets.comp.
+struct Meshlet
+{
+	// xyz = center, w = radius in object space
+	glm::vec4 bounding_sphere;
+	glm::vec4 cone_apex;
+	// xyz = axis, w = cutoff. The triangles all face away from cameras at positions p with
+	// dot(normalize(cone_apex - p), axis) >= cutoff. A cutoff above 1 disables the test.
+	glm::vec4 cone;
+	uint32_t first_index;
+	uint32_t index_count;
+	uint32_t padding[2];
+};
+
+const uint32_t TRIANGLE_BATCH_SIZE = 8;
+
+// Object space triangles in SoA batches of eight as a first vertex and two edges, for ray tests on the CPU.
+// Unused lanes of the last batch hold degenerate triangles, which rays never hit.
+struct TriangleBatch
+{
+	float v0_x[TRIANGLE_BATCH_SIZE];
+	float v0_y[TRIANGLE_BATCH_SIZE];
+	float v0_z[TRIANGLE_BATCH_SIZE];
+	float e1_x[TRIANGLE_BATCH_SIZE];
+	float e1_y[TRIANGLE_BATCH_SIZE];
+	float e1_z[TRIANGLE_BATCH_SIZE];
+	float e2_x[TRIANGLE_BATCH_SIZE];
+	float e2_y[TRIANGLE_BATCH_SIZE];
+	float e2_z[TRIANGLE_BATCH_SIZE];
+};
+
 struct MeshInstanceUniformBlock
 {
 	glm::vec4 color;
 	glm::mat4 model_matrix;
 	glm::vec4 material_factors;
+	// Filled in from the mesh: object space position = stored position * scale + offset
+	glm::vec4 position_scale = glm::vec4(1.0f);
+	glm::vec4 position_offset = glm::vec4(0.0f);
+	// x = 1 if normals are octahedral encoded
+	glm::uvec4 vertex_layout = glm::uvec4(0);
+	// x = 1 if color, model matrix and material are read from the instance buffer at gl_InstanceIndex instead
+	glm::uvec4 instancing = glm::uvec4(0);
 };
 
 class Mesh : public ITrash
 {
 private:
-	VkBuffer vertices = VK_NULL_HANDLE;
+	// vertex stream 0
+	VkBuffer positions = VK_NULL_HANDLE;
+	// vertex stream 1
+	VkBuffer attributes = VK_NULL_HANDLE;
 	VkBuffer indices = VK_NULL_HANDLE;
-	uint32_t index_count;
+	// level 0 is the full resolution mesh, coarser levels follow
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+	// CPU copy of the triangles of level 0 with unquantized positions
+	std::vector<TriangleBatch> triangle_batches;
+	// VK_INDEX_TYPE_UINT16 if the mesh has few enough vertices, the index buffer is stored in this width
+	VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+	// xyz = center, w = radius in object space
+	glm::vec4 bounding_sphere;
+	// object space, the center is the center of the bounding sphere
+	glm::vec3 aabb_min;
+	glm::vec3 aabb_max;
+	VertexLayout vertex_layout = VertexLayout::Full;
+	// the color shared by all vertices of a compact mesh, bound as a per instance attribute
+	VkBuffer constant_color = VK_NULL_HANDLE;
+	glm::vec4 position_scale = glm::vec4(1.0f);
+	glm::vec4 position_offset = glm::vec4(0.0f);
+
+	void create_vertex_streams(const std::vector<Vertex> &vertices);
+	void create_compact_vertex_streams(const std::vector<Vertex> &vertices, glm::vec3 min_position, glm::vec3 max_position);
 
 public:
-	Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices);
+	// Meshes with varying vertex colors always use VertexLayout::Full
+	// Without lods, all indices form a single level
+	// Without meshlets, get_meshlets is empty and the levels have no meshlet range
+	Mesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices, VertexLayout layout = VertexLayout::Full, std::vector<MeshLod> lods = {}, bool meshlets = false);
+	glm::vec4 get_bounding_sphere()
+	{
+		return bounding_sphere;
+	}
+	glm::vec3 get_aabb_min()
+	{
+		return aabb_min;
+	}
+	glm::vec3 get_aabb_max()
+	{
+		return aabb_max;
+	}
+	VkIndexType get_index_type()
+	{
+		return index_type;
+	}
+	VertexLayout get_vertex_layout()
+	{
+		return vertex_layout;
+	}
+	const std::vector<MeshLod> &get_lods()
+	{
+		return lods;
+	}
+	const std::vector<Meshlet> &get_meshlets()
+	{
+		return meshlets;
+	}
+	const std::vector<TriangleBatch> &get_triangle_batches()
+	{
+		return triangle_batches;
+	}
+	// Writes the dequantization parameters of the vertex layout into the uniform block
+	void fill_uniforms(MeshInstanceUniformBlock &uniform_block);
 
 	void bind(VkCommandBuffer cmd_buffer);
-	void draw(VkCommandBuffer cmd_buffer);
+	// Binds only the position stream, for pipelines created with PipelineParams::position_only
+	void bind_positions(VkCommandBuffer cmd_buffer);
+	void draw(VkCommandBuffer cmd_buffer, uint32_t lod = 0);
+
+	void destroy(VkDevice device);
+};
+
+enum class ParametricPrimitive : uint32_t
+{
+	Cylinder,
+	Sphere,
+	Bezier
+};
+
+// Tessellations shared by all parametric meshes, keyed on the primitive and its quantized generator arguments.
+// The arguments include the resolution of the level and the build options. The cache owns the meshes.
+class TessellationCache : public ITrash
+{
+public:
+	struct Key
+	{
+		ParametricPrimitive primitive;
+		std::vector<int32_t> parameters;
+
+		bool operator==(const Key &other) const = default;
+	};
+
+private:
+	struct KeyHash
+	{
+		size_t operator()(const Key &key) const;
+	};
+	std::unordered_map<Key, std::shared_ptr<Mesh>, KeyHash> meshes;
 
+public:
+	// Returns the mesh for key, generate is only called if it is not cached yet
+	std::shared_ptr<Mesh> get(const Key &key, const std::function<std::unique_ptr<Mesh>()> &generate);
 	void destroy(VkDevice device);
 };
 
+// A primitive that keeps its generator parameters, so its levels of detail are exact tessellations of the shape
+// instead of simplifications. Level k divides the authored resolution by 2^k, levels are generated on first use
+// and come from a TessellationCache, which owns them.
+class ParametricMesh
+{
+private:
+	std::function<std::shared_ptr<Mesh>(uint32_t level)> generate;
+	// largest distance of each level from the exact surface in object space
+	std::vector<float> errors;
+	std::vector<std::shared_ptr<Mesh>> levels;
+
+public:
+	ParametricMesh(std::function<std::shared_ptr<Mesh>(uint32_t level)> generate, std::vector<float> errors);
+	uint32_t get_level_count()
+	{
+		return uint32_t(errors.size());
+	}
+	float get_error(uint32_t level)
+	{
+		return errors[level];
+	}
+	std::shared_ptr<Mesh> get(uint32_t level);
+};
+
 class MeshInstance
 {
 private:
@@ -52,20 +248,40 @@ private:
 		.material_factors = {0.05, 1.0, 1.0, 10.0},
 	};
 	VkBuffer uniform_buffer = VK_NULL_HANDLE;
-	VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+	std::shared_ptr<SwappableDescriptorSet> descriptor_set = nullptr;
 	UniformBufferSlot uniform_slot = {};
 	PipelineMatrixManager::Shader shader = PipelineMatrixManager::Shader::Phong;
 	int32_t texture_index = -1;
+	uint32_t lod = 0;
+	uint32_t tessellation_level = 0;
+	// set_uniforms appends change_index to it, see track_changes
+	std::shared_ptr<std::vector<uint32_t>> changes = nullptr;
+	uint32_t change_index = 0;
 
 public:
 	std::shared_ptr<Mesh> mesh = nullptr;
+	// If set, mesh is replaced by the tessellation level selected in update_lod, the levels belong to its cache
+	std::shared_ptr<ParametricMesh> parametric = nullptr;
 
 	MeshInstance(std::shared_ptr<Mesh> mesh, PipelineMatrixManager::Shader shader);
+	MeshInstance(std::shared_ptr<ParametricMesh> parametric, PipelineMatrixManager::Shader shader);
 
-	void init_uniforms(VkDevice device, VkDescriptorPool descriptor_pool, VkDescriptorSetLayout descriptor_layout, uint32_t binding, VkBuffer uniform_buffer, UniformBufferSlot slot);
+	void init_uniforms(VkDevice device, std::shared_ptr<SwappableDescriptorSet> descriptor_set, uint32_t binding, VkBuffer uniform_buffer, UniformBufferSlot slot);
 	void set_uniforms(MeshInstanceUniformBlock data);
+	// Every following set_uniforms appends index to changes, an index may appear more than once
+	void track_changes(std::shared_ptr<std::vector<uint32_t>> changes, uint32_t index);
+	MeshInstanceUniformBlock get_uniforms()
+	{
+		return uniform_block;
+	}
 	void bind_uniforms(VkCommandBuffer cmd_buffer, VkPipelineLayout pipeline_layout);
-	VkDescriptorSet get_descriptor_set();
+	std::shared_ptr<SwappableDescriptorSet> get_descriptor_set();
+	// The bounding sphere of the mesh in world space
+	glm::vec4 get_bounding_sphere();
+	glm::mat4 get_model_matrix()
+	{
+		return uniform_block.model_matrix;
+	}
 	PipelineMatrixManager::Shader get_shader()
 	{
 		return shader;
@@ -78,6 +294,14 @@ public:
 	{
 		return this->texture_index;
 	}
+	// Selects the coarsest level whose error projects to at most pixel_error pixels. A coarser level is only
+	// switched to once its error is well below the bound, so instances near the threshold do not flicker.
+	// Parametric instances select a tessellation level instead of a simplified level.
+	void update_lod(Camera &camera, float pixel_error);
+	uint32_t get_lod()
+	{
+		return lod;
+	}
 };
 
 class BezierCurve
@@ -100,8 +324,30 @@ public:
 	glm::vec3 tanget_at(float t);
 };
 
-std::unique_ptr<Mesh> create_cube_mesh(float width, float height, float depth, glm::vec3 color);
-std::unique_ptr<Mesh> create_cornell_mesh(float width, float height, float depth);
-std::unique_ptr<Mesh> create_cylinder_mesh(float radius, float height, int segments, glm::vec3 color);
-std::unique_ptr<Mesh> create_sphere_mesh(float radius, int rings, int segments, glm::vec3 color);
-std::unique_ptr<Mesh> create_bezier_mesh(std::unique_ptr<BezierCurve> curve, glm::vec3 up, float radius, int resolution, int segments, glm::vec3 color);
\ No newline at end of file
+struct MeshBuildOptions
+{
+	// Reorders the triangles and vertices for the vertex cache
+	bool optimize = true;
+	VertexLayout vertex_layout = VertexLayout::Full;
+	// Number of levels of detail including the full resolution, levels are generated by simplification
+	uint32_t lod_levels = 1;
+	// Splits every level into meshlets, only needed for meshlet culling
+	bool meshlets = false;
+};
+
+// Every mesh built from the create_*_mesh functions goes through the same path: optimization, simplified levels of
+// detail and the vertex layout are taken from options
+std::unique_ptr<Mesh> buildMesh(std::vector<Vertex> vertices, std::vector<uint32_t> indices, const MeshBuildOptions &options);
+
+std::unique_ptr<Mesh> create_cube_mesh(float width, float height, float depth, glm::vec3 color, const MeshBuildOptions &options);
+std::unique_ptr<Mesh> create_cornell_mesh(float width, float height, float depth, const MeshBuildOptions &options);
+std::unique_ptr<Mesh> create_cylinder_mesh(float radius, float height, int segments, glm::vec3 color, const MeshBuildOptions &options);
+std::unique_ptr<Mesh> create_sphere_mesh(float radius, int rings, int segments, glm::vec3 color, const MeshBuildOptions &options);
+std::unique_ptr<Mesh> create_bezier_mesh(std::unique_ptr<BezierCurve> curve, glm::vec3 up, float radius, int resolution, int segments, glm::vec3 color, const MeshBuildOptions &options);
+
+// Parametric versions of the primitives above, the given resolution is the one of level 0.
+// The levels are built with options but never simplified, every tessellation is exact already.
+// Primitives with the same arguments share their levels through cache.
+std::shared_ptr<ParametricMesh> create_parametric_cylinder_mesh(float radius, float height, int segments, glm::vec3 color, const MeshBuildOptions &options, std::shared_ptr<TessellationCache> cache);
+std::shared_ptr<ParametricMesh> create_parametric_sphere_mesh(float radius, int rings, int segments, glm::vec3 color, const MeshBuildOptions &options, std::shared_ptr<TessellationCache> cache);
+std::shared_ptr<ParametricMesh> create_parametric_bezier_mesh(std::vector<glm::vec3> points, glm::vec3 up, float radius, int resolution, int segments, glm::vec3 color, const MeshBuildOptions &options, std::shared_ptr<TessellationCache> cache);
@@ -0,0 +1,244 @@
+#include "MeshOptimizer.h"
+
+#include <VulkanLaunchpad.h>
+
+#include <numeric>
+#include <limits>
+
+#undef min
+#undef max
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size)
+{
+	// A vertex is in the cache if it was transformed less than cache_size transforms ago
+	std::vector<uint64_t> cache_time(vertex_count, 0);
+	std::vector<bool> referenced(vertex_count, false);
+	uint64_t transforms = 0;
+	size_t referenced_count = 0;
+	for (uint32_t index : indices)
+	{
+		if (cache_time[index] == 0 || transforms - cache_time[index] >= cache_size)
+		{
+			transforms++;
+			cache_time[index] = transforms;
+		}
+		if (!referenced[index])
+		{
+			referenced[index] = true;
+			referenced_count++;
+		}
+	}
+
+	size_t triangle_count = indices.size() / 3;
+	return {
+		.acmr = triangle_count == 0 ? 0.0f : float(transforms) / float(triangle_count),
+		.atvr = referenced_count == 0 ? 0.0f : float(transforms) / float(referenced_count),
+	};
+}
+
+std::vector<uint32_t> optimizeVertexCache(const std::vector<uint32_t> &indices, size_t vertex_count, std::vector<uint32_t> &cluster_starts, uint32_t cache_size)
+{
+	size_t triangle_count = indices.size() / 3;
+
+	// Triangles adjacent to each vertex, stored contiguously per vertex
+	std::vector<uint32_t> live_triangles(vertex_count, 0);
+	for (uint32_t index : indices)
+	{
+		live_triangles[index]++;
+	}
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+	std::partial_sum(live_triangles.begin(), live_triangles.end(), adjacency_offsets.begin() + 1);
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> adjacency_fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		adjacency[adjacency_fill[indices[i]]++] = uint32_t(i / 3);
+	}
+
+	std::vector<uint64_t> cache_time(vertex_count, 0);
+	std::vector<bool> emitted(triangle_count, false);
+	std::vector<uint32_t> dead_end_stack;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	cluster_starts.clear();
+
+	uint64_t time_stamp = cache_size + 1;
+	uint32_t cursor = 0;
+	int64_t fanning_vertex = vertex_count > 0 ? 0 : -1;
+	bool cold_cache = true;
+	while (fanning_vertex >= 0)
+	{
+		if (cold_cache)
+		{
+			cluster_starts.push_back(uint32_t(result.size()));
+			cold_cache = false;
+		}
+
+		// Emit all remaining triangles around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = adjacency_offsets[fanning_vertex]; a < adjacency_offsets[fanning_vertex + 1]; a++)
+		{
+			uint32_t triangle = adjacency[a];
+			if (emitted[triangle])
+				continue;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t v = indices[triangle * 3 + k];
+				result.push_back(v);
+				dead_end_stack.push_back(v);
+				candidates.push_back(v);
+				live_triangles[v]--;
+				if (time_stamp - cache_time[v] > cache_size)
+					cache_time[v] = time_stamp++;
+			}
+			emitted[triangle] = true;
+		}
+
+		// Continue with the candidate that stays in the cache the longest, as long as its triangles still fit
+		int64_t best = -1;
+		int64_t best_priority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (live_triangles[v] == 0)
+				continue;
+			int64_t priority = 0;
+			if (time_stamp - cache_time[v] + 2 * live_triangles[v] <= cache_size)
+				priority = int64_t(time_stamp - cache_time[v]);
+			if (priority > best_priority)
+			{
+				best = v;
+				best_priority = priority;
+			}
+		}
+		if (best != -1)
+		{
+			fanning_vertex = best;
+			continue;
+		}
+
+		// Dead end, prefer recently used vertices before scanning for any vertex with triangles left
+		fanning_vertex = -1;
+		while (!dead_end_stack.empty())
+		{
+			uint32_t v = dead_end_stack.back();
+			dead_end_stack.pop_back();
+			if (live_triangles[v] > 0)
+			{
+				fanning_vertex = v;
+				break;
+			}
+		}
+		if (fanning_vertex == -1)
+		{
+			while (cursor < vertex_count && live_triangles[cursor] == 0)
+			{
+				cursor++;
+			}
+			if (cursor < vertex_count)
+				fanning_vertex = cursor;
+		}
+		if (fanning_vertex != -1 && time_stamp - cache_time[fanning_vertex] > cache_size)
+			cold_cache = true;
+	}
+	return result;
+}
+
+std::vector<uint32_t> optimizeOverdraw(const std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &cluster_starts, float threshold)
+{
+	if (cluster_starts.size() < 2)
+		return indices;
+
+	struct Cluster
+	{
+		uint32_t begin;
+		uint32_t end;
+		float occlusion_potential;
+	};
+
+	glm::vec3 mesh_centroid = glm::vec3(0.0f);
+	for (auto &&v : vertices)
+	{
+		mesh_centroid += v.position;
+	}
+	mesh_centroid /= float(std::max<size_t>(vertices.size(), 1));
+
+	std::vector<Cluster> clusters;
+	for (size_t c = 0; c < cluster_starts.size(); c++)
+	{
+		uint32_t begin = cluster_starts[c];
+		uint32_t end = c + 1 < cluster_starts.size() ? cluster_starts[c + 1] : uint32_t(indices.size());
+		if (begin == end)
+			continue;
+
+		// Area weighted centroid and normal of the cluster
+		glm::vec3 centroid = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f);
+		float area = 0.0f;
+		for (uint32_t i = begin; i < end; i += 3)
+		{
+			glm::vec3 a = vertices[indices[i]].position;
+			glm::vec3 b = vertices[indices[i + 1]].position;
+			glm::vec3 c = vertices[indices[i + 2]].position;
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float triangle_area = glm::length(n);
+			centroid += (a + b + c) * (triangle_area / 3.0f);
+			normal += n;
+			area += triangle_area;
+		}
+		centroid = area > 0.0f ? centroid / area : vertices[indices[begin]].position;
+		float normal_length = glm::length(normal);
+		normal = normal_length > 0.0f ? normal / normal_length : glm::vec3(0.0f);
+		clusters.push_back({begin, end, glm::dot(centroid - mesh_centroid, normal)});
+	}
+
+	// Clusters on the outside of the mesh are likely to occlude the others, draw them first
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b)
+					 { return a.occlusion_potential > b.occlusion_potential; });
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (auto &&cluster : clusters)
+	{
+		result.insert(result.end(), indices.begin() + cluster.begin, indices.begin() + cluster.end);
+	}
+
+	float acmr_before = analyzeVertexCache(indices, vertices.size()).acmr;
+	float acmr_after = analyzeVertexCache(result, vertices.size()).acmr;
+	if (acmr_after > acmr_before * threshold)
+		return indices;
+	return result;
+}
+
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+	constexpr uint32_t unused = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> remap(vertices.size(), unused);
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+	for (auto &&index : indices)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = uint32_t(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices = std::move(reordered);
+}
+
+void optimizeMesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+	if (indices.empty())
+		return;
+
+	VertexCacheStatistics before = analyzeVertexCache(indices, vertices.size());
+	std::vector<uint32_t> cluster_starts;
+	indices = optimizeVertexCache(indices, vertices.size(), cluster_starts);
+	indices = optimizeOverdraw(indices, vertices, cluster_starts);
+	optimizeVertexFetch(vertices, indices);
+	VertexCacheStatistics after = analyzeVertexCache(indices, vertices.size());
+
+	VKL_LOG("Mesh with " << indices.size() / 3 << " triangles: ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+#include <vector>
+#include <cstdint>
+
+struct VertexCacheStatistics
+{
+	// average cache miss ratio, transformed vertices per triangle (0.5 is optimal for large grids, 3 the worst case)
+	float acmr;
+	// average transform to vertex ratio, transformed vertices per referenced vertex (1 is optimal)
+	float atvr;
+};
+
+// Simulates a FIFO post-transform cache of the given size
+VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size = 16);
+
+// Reorders triangles with Tipsify (Sander et al. 2007). cluster_starts receives the first index of every sequence
+// that starts with a cold cache, these are the points where triangles can be reordered without extra cache misses.
+std::vector<uint32_t> optimizeVertexCache(const std::vector<uint32_t> &indices, size_t vertex_count, std::vector<uint32_t> &cluster_starts, uint32_t cache_size = 16);
+// Sorts the clusters so the ones facing outwards are drawn first and occlude the rest of the mesh.
+// The order is kept if the ACMR would grow by more than the threshold factor.
+std::vector<uint32_t> optimizeOverdraw(const std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &cluster_starts, float threshold = 1.05f);
+// Renumbers vertices in the order they are first referenced, so vertex fetches walk the buffer linearly.
+// Unreferenced vertices are removed.
+void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+// Runs all passes above and logs the cache statistics before and after, for generated and loaded meshes alike
+void optimizeMesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
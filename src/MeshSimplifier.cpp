@@ -0,0 +1,347 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+#include <cmath>
+#include <array>
+#include <limits>
+
+#undef min
+#undef max
+
+struct Quadric
+{
+	double a2 = 0, ab = 0, ac = 0, ad = 0;
+	double b2 = 0, bc = 0, bd = 0;
+	double c2 = 0, cd = 0;
+	double d2 = 0;
+	double weight = 0;
+
+	void add_plane(glm::vec3 normal, float distance, double w)
+	{
+		double a = normal.x, b = normal.y, c = normal.z, d = distance;
+		a2 += w * a * a, ab += w * a * b, ac += w * a * c, ad += w * a * d;
+		b2 += w * b * b, bc += w * b * c, bd += w * b * d;
+		c2 += w * c * c, cd += w * c * d;
+		d2 += w * d * d;
+		weight += w;
+	}
+
+	Quadric operator+(const Quadric &o) const
+	{
+		return {a2 + o.a2, ab + o.ab, ac + o.ac, ad + o.ad, b2 + o.b2, bc + o.bc, bd + o.bd, c2 + o.c2, cd + o.cd, d2 + o.d2, weight + o.weight};
+	}
+
+	// Weighted mean of the squared distances to all planes
+	double evaluate(glm::vec3 p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x + b2 * y * y + 2 * bc * y * z + 2 * bd * y + c2 * z * z + 2 * cd * z + d2;
+		return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+	}
+};
+
+struct Collapse
+{
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+// Whether moving from onto to turns any remaining triangle around from over by more than 75 degrees
+bool collapseFlipsTriangle(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, const uint32_t *triangles, uint32_t triangle_count, uint32_t from, uint32_t to)
+{
+	for (uint32_t t = 0; t < triangle_count; t++)
+	{
+		const uint32_t *tri = &indices[triangles[t] * 3];
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+			continue;
+		glm::vec3 p[3], q[3];
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = positions[tri[k]];
+			q[k] = tri[k] == from ? positions[to] : p[k];
+		}
+		glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+		glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+		if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+			return true;
+	}
+	return false;
+}
+
+float pointTriangleDistance(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+	glm::vec3 normal = glm::cross(b - a, c - a);
+	float length = glm::length(normal);
+	if (length > 0.0f)
+	{
+		normal /= length;
+		float plane_distance = glm::dot(p - a, normal);
+		glm::vec3 projected = p - normal * plane_distance;
+		if (glm::dot(glm::cross(b - a, projected - a), normal) >= 0.0f && glm::dot(glm::cross(c - b, projected - b), normal) >= 0.0f &&
+			glm::dot(glm::cross(a - c, projected - c), normal) >= 0.0f)
+			return std::abs(plane_distance);
+	}
+	// The closest point lies on an edge
+	auto edge_distance = [&](glm::vec3 from, glm::vec3 to)
+	{
+		glm::vec3 edge = to - from;
+		float t = glm::dot(edge, edge) > 0.0f ? glm::clamp(glm::dot(p - from, edge) / glm::dot(edge, edge), 0.0f, 1.0f) : 0.0f;
+		return glm::length(p - (from + edge * t));
+	};
+	return std::min({edge_distance(a, b), edge_distance(b, c), edge_distance(c, a)});
+}
+
+// Largest distance of the given original vertices from the triangles around to after moving from onto it.
+// Triangles containing both vertices disappear with the collapse.
+float collapseDistance(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, const uint32_t *from_triangles, uint32_t from_triangle_count, const uint32_t *to_triangles, uint32_t to_triangle_count, uint32_t from, uint32_t to, const std::vector<uint32_t> &vertices)
+{
+	std::vector<std::array<glm::vec3, 3>> fan;
+	auto add_triangles = [&](const uint32_t *triangles, uint32_t triangle_count)
+	{
+		for (uint32_t t = 0; t < triangle_count; t++)
+		{
+			const uint32_t *tri = &indices[triangles[t] * 3];
+			bool has_from = tri[0] == from || tri[1] == from || tri[2] == from;
+			bool has_to = tri[0] == to || tri[1] == to || tri[2] == to;
+			if (has_from && has_to)
+				continue;
+			std::array<glm::vec3, 3> q;
+			for (int k = 0; k < 3; k++)
+			{
+				q[k] = tri[k] == from ? positions[to] : positions[tri[k]];
+			}
+			fan.push_back(q);
+		}
+	};
+	add_triangles(from_triangles, from_triangle_count);
+	add_triangles(to_triangles, to_triangle_count);
+	float distance = 0.0f;
+	for (uint32_t vertex : vertices)
+	{
+		float closest = std::numeric_limits<float>::max();
+		for (auto &&q : fan)
+		{
+			closest = std::min(closest, pointTriangleDistance(positions[vertex], q[0], q[1], q[2]));
+		}
+		distance = std::max(distance, fan.empty() ? 0.0f : closest);
+	}
+	return distance;
+}
+
+// The link condition: the edge may only be collapsed if its end points share no neighbors besides the ones of the
+// triangles on the edge, otherwise the collapse pinches the surface into a non-manifold fold
+bool collapseKeepsManifold(const std::vector<uint32_t> &indices, const uint32_t *from_triangles, uint32_t from_triangle_count, const uint32_t *to_triangles, uint32_t to_triangle_count, uint32_t from, uint32_t to)
+{
+	uint32_t shared_triangles = 0;
+	std::vector<uint32_t> from_neighbors;
+	for (uint32_t t = 0; t < from_triangle_count; t++)
+	{
+		const uint32_t *tri = &indices[from_triangles[t] * 3];
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+			shared_triangles++;
+		for (int k = 0; k < 3; k++)
+		{
+			if (tri[k] != from && tri[k] != to)
+				from_neighbors.push_back(tri[k]);
+		}
+	}
+	std::sort(from_neighbors.begin(), from_neighbors.end());
+	from_neighbors.erase(std::unique(from_neighbors.begin(), from_neighbors.end()), from_neighbors.end());
+
+	std::vector<uint32_t> shared_neighbors;
+	for (uint32_t t = 0; t < to_triangle_count; t++)
+	{
+		const uint32_t *tri = &indices[to_triangles[t] * 3];
+		for (int k = 0; k < 3; k++)
+		{
+			if (tri[k] != from && tri[k] != to && std::binary_search(from_neighbors.begin(), from_neighbors.end(), tri[k]))
+				shared_neighbors.push_back(tri[k]);
+		}
+	}
+	std::sort(shared_neighbors.begin(), shared_neighbors.end());
+	shared_neighbors.erase(std::unique(shared_neighbors.begin(), shared_neighbors.end()), shared_neighbors.end());
+	return shared_neighbors.size() == shared_triangles;
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, size_t target_index_count, float max_error, float &error)
+{
+	size_t vertex_count = positions.size();
+	std::vector<uint32_t> result = indices;
+	error = 0.0f;
+
+	std::vector<Quadric> quadrics(vertex_count);
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		glm::vec3 a = positions[result[i]], b = positions[result[i + 1]], c = positions[result[i + 2]];
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float area = glm::length(n);
+		if (area <= 0.0f)
+			continue;
+		n /= area;
+		for (int k = 0; k < 3; k++)
+		{
+			quadrics[result[i + k]].add_plane(n, -glm::dot(n, a), area);
+		}
+	}
+
+	// Edges without a twin in the opposite direction lie on a border, collapsing them would open holes
+	std::unordered_set<uint64_t> directed_edges;
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			directed_edges.insert(uint64_t(result[i + k]) << 32 | result[i + (k + 1) % 3]);
+		}
+	}
+	std::vector<bool> locked(vertex_count, false);
+	for (uint64_t edge : directed_edges)
+	{
+		uint32_t a = uint32_t(edge >> 32), b = uint32_t(edge);
+		if (!directed_edges.contains(uint64_t(b) << 32 | a))
+			locked[a] = locked[b] = true;
+	}
+
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<bool> touched(vertex_count);
+	std::vector<uint32_t> remap(vertex_count);
+	// The original vertices merged into each vertex, they are measured against the surface around it
+	std::vector<std::vector<uint32_t>> merged(vertex_count);
+	for (uint32_t i = 0; i < vertex_count; i++)
+	{
+		merged[i] = {i};
+	}
+	std::vector<uint32_t> moved;
+	while (result.size() > target_index_count)
+	{
+		// Triangles around each vertex
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+		for (uint32_t index : result)
+		{
+			adjacency_offsets[index + 1]++;
+		}
+		std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+		adjacency.resize(result.size());
+		std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			adjacency[fill[result[i]]++] = uint32_t(i / 3);
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t a = result[i + k], b = result[i + (k + 1) % 3];
+				Quadric q = quadrics[a] + quadrics[b];
+				if (!locked[a])
+					collapses.push_back({a, b, q.evaluate(positions[b])});
+				if (!locked[b])
+					collapses.push_back({b, a, q.evaluate(positions[a])});
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b)
+				  { return a.cost < b.cost; });
+
+		// Collapse the cheapest edges whose neighborhoods do not overlap, so every check sees the current mesh
+		std::fill(touched.begin(), touched.end(), false);
+		std::iota(remap.begin(), remap.end(), 0);
+		size_t remaining_index_count = result.size();
+		size_t collapse_count = 0;
+		double max_cost = double(max_error) * double(max_error);
+		for (auto &&collapse : collapses)
+		{
+			if (remaining_index_count <= target_index_count || collapse.cost > max_cost)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+			const uint32_t *triangles = &adjacency[adjacency_offsets[collapse.from]];
+			uint32_t triangle_count = adjacency_offsets[collapse.from + 1] - adjacency_offsets[collapse.from];
+			const uint32_t *to_triangles = &adjacency[adjacency_offsets[collapse.to]];
+			uint32_t to_triangle_count = adjacency_offsets[collapse.to + 1] - adjacency_offsets[collapse.to];
+			if (collapseFlipsTriangle(positions, result, triangles, triangle_count, collapse.from, collapse.to))
+				continue;
+			if (!collapseKeepsManifold(result, triangles, triangle_count, to_triangles, to_triangle_count, collapse.from, collapse.to))
+				continue;
+			// The quadric only orders the collapses, the error is the distance of the original vertices involved
+			moved = merged[collapse.from];
+			moved.insert(moved.end(), merged[collapse.to].begin(), merged[collapse.to].end());
+			float collapse_error = collapseDistance(positions, result, triangles, triangle_count, to_triangles, to_triangle_count, collapse.from, collapse.to, moved);
+			if (collapse_error > max_error)
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] = quadrics[collapse.to] + quadrics[collapse.from];
+			merged[collapse.to] = std::move(moved);
+			merged[collapse.from].clear();
+			error = std::max(error, collapse_error);
+			for (uint32_t t = 0; t < triangle_count; t++)
+			{
+				const uint32_t *tri = &result[triangles[t] * 3];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+					remaining_index_count -= 3;
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+			}
+			collapse_count++;
+		}
+		if (collapse_count == 0)
+			break;
+
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+	return result;
+}
+
+std::vector<MeshLod> generateLods(const std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, uint32_t level_count)
+{
+	std::vector<MeshLod> lods = {{0, uint32_t(indices.size()), 0.0f}};
+	if (vertices.empty())
+		return lods;
+	std::vector<glm::vec3> positions(vertices.size());
+	glm::vec3 min_position = vertices[0].position;
+	glm::vec3 max_position = vertices[0].position;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		positions[i] = vertices[i].position;
+		min_position = glm::min(min_position, positions[i]);
+		max_position = glm::max(max_position, positions[i]);
+	}
+	float max_error = 0.1f * glm::length(max_position - min_position);
+
+	// Every level is simplified from the original, so errors do not compound over the levels
+	std::vector<uint32_t> original(indices.begin(), indices.end());
+	size_t previous_index_count = original.size();
+	for (uint32_t level = 1; level < level_count; level++)
+	{
+		size_t target_index_count = previous_index_count / 6 * 3;
+		if (target_index_count < 3 * 16)
+			break;
+		float error = 0.0f;
+		std::vector<uint32_t> simplified = simplifyMesh(positions, original, target_index_count, max_error, error);
+		if (simplified.empty() || simplified.size() > previous_index_count * 9 / 10)
+			break;
+
+		std::vector<uint32_t> cluster_starts;
+		simplified = optimizeVertexCache(simplified, vertices.size(), cluster_starts);
+		lods.push_back({uint32_t(indices.size()), uint32_t(simplified.size()), error});
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		previous_index_count = simplified.size();
+	}
+	return lods;
+}
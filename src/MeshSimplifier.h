@@ -0,0 +1,20 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+#include <vector>
+#include <cstdint>
+
+// Reduces the triangle count with quadric error metrics (Garland and Heckbert 1997). Edges are collapsed into one of
+// their vertices, so the result indexes the same vertices. Vertices on open borders, including UV and normal seams,
+// are never moved. Collapses with an error above max_error are skipped, so the target may not be reached.
+// error receives the largest distance in object space of an original vertex from the triangles around the vertex it
+// was merged into, measured at every collapse. It estimates the deviation from the original surface on the large side.
+std::vector<uint32_t> simplifyMesh(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, size_t target_index_count, float max_error, float &error);
+
+// Appends up to level_count - 1 simplified levels with half the triangles of the previous one to indices.
+// Stops early once simplification stalls or the error would exceed a tenth of the mesh size.
+// Returns the index ranges of all levels, starting with the original.
+std::vector<MeshLod> generateLods(const std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, uint32_t level_count);
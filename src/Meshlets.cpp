@@ -0,0 +1,263 @@
+#include "Meshlets.h"
+
+#include <VulkanLaunchpad.h>
+#include "Descriptors.h"
+
+#include <limits>
+#include <cmath>
+
+#undef min
+#undef max
+
+#pragma region MeshletBuilder
+Meshlet createMeshlet(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, uint32_t begin, uint32_t end)
+{
+	glm::vec3 min_position = vertices[indices[begin]].position;
+	glm::vec3 max_position = min_position;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		min_position = glm::min(min_position, vertices[indices[i]].position);
+		max_position = glm::max(max_position, vertices[indices[i]].position);
+	}
+	glm::vec3 center = (min_position + max_position) * 0.5f;
+	float radius = 0.0f;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		radius = std::max(radius, glm::length(vertices[indices[i]].position - center));
+	}
+
+	// Normal cone (see meshoptimizer's meshopt_computeClusterBounds), the axis is the average triangle normal
+	struct Plane
+	{
+		glm::vec3 point;
+		glm::vec3 normal;
+	};
+	std::vector<Plane> planes;
+	glm::vec3 axis = glm::vec3(0.0f);
+	for (uint32_t i = begin; i < end; i += 3)
+	{
+		glm::vec3 a = vertices[indices[i]].position;
+		glm::vec3 n = glm::cross(vertices[indices[i + 1]].position - a, vertices[indices[i + 2]].position - a);
+		float area = glm::length(n);
+		if (area <= 0.0f)
+			continue;
+		planes.push_back({a, n / area});
+		axis += n / area;
+	}
+	float axis_length = glm::length(axis);
+	float min_dot = -1.0f;
+	if (axis_length > 0.0f)
+	{
+		axis /= axis_length;
+		min_dot = 1.0f;
+		for (auto &&plane : planes)
+		{
+			min_dot = std::min(min_dot, glm::dot(axis, plane.normal));
+		}
+	}
+
+	Meshlet meshlet = {
+		.bounding_sphere = glm::vec4(center, radius),
+		.cone_apex = glm::vec4(center, 1.0f),
+		.cone = glm::vec4(0.0f, 0.0f, 1.0f, 2.0f),
+		.first_index = begin,
+		.index_count = end - begin,
+	};
+	// Cones wider than about 84 degrees practically never cull anything
+	if (min_dot <= 0.1f)
+		return meshlet;
+
+	// Move the apex back along the axis until all triangle planes are in front of it
+	float max_t = 0.0f;
+	for (auto &&plane : planes)
+	{
+		max_t = std::max(max_t, glm::dot(center - plane.point, plane.normal) / glm::dot(axis, plane.normal));
+	}
+	meshlet.cone_apex = glm::vec4(center - axis * max_t, 1.0f);
+	meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - min_dot * min_dot));
+	return meshlet;
+}
+
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, std::vector<MeshLod> &lods)
+{
+	std::vector<Meshlet> meshlets;
+	// The meshlet that last referenced each vertex, so the per meshlet vertex sets never need clearing
+	std::vector<uint32_t> vertex_meshlet(vertices.size(), std::numeric_limits<uint32_t>::max());
+	uint32_t meshlet_id = 0;
+	for (auto &&lod : lods)
+	{
+		lod.first_meshlet = uint32_t(meshlets.size());
+		uint32_t end = lod.first_index + lod.index_count;
+		uint32_t begin = lod.first_index;
+		uint32_t vertex_count = 0;
+		for (uint32_t i = lod.first_index; i < end; i += 3)
+		{
+			const uint32_t *tri = &indices[i];
+			auto new_vertex_count = [&]()
+			{
+				uint32_t count = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+					if (vertex_meshlet[tri[k]] != meshlet_id && !repeated)
+						count++;
+				}
+				return count;
+			};
+			if (vertex_count + new_vertex_count() > MESHLET_MAX_VERTICES || (i - begin) / 3 == MESHLET_MAX_TRIANGLES)
+			{
+				meshlets.push_back(createMeshlet(vertices, indices, begin, i));
+				meshlet_id++;
+				begin = i;
+				vertex_count = 0;
+			}
+			vertex_count += new_vertex_count();
+			for (int k = 0; k < 3; k++)
+			{
+				vertex_meshlet[tri[k]] = meshlet_id;
+			}
+		}
+		if (begin < end)
+		{
+			meshlets.push_back(createMeshlet(vertices, indices, begin, end));
+			meshlet_id++;
+		}
+		lod.meshlet_count = uint32_t(meshlets.size()) - lod.first_meshlet;
+	}
+	return meshlets;
+}
+#pragma endregion
+
+#pragma region MeshletCulling
+MeshletCulling::MeshletCulling(VkPhysicalDevice physical_device, VkDevice device, VkDescriptorPool descriptor_pool, uint32_t max_meshlets, uint32_t max_instances, uint32_t max_commands)
+{
+	this->max_meshlets = max_meshlets;
+	this->max_instances = max_instances;
+	this->max_commands = max_commands;
+
+	// Without multiDrawIndirect every meshlet needs its own indirect draw
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(physical_device, &features);
+	multi_draw_indirect = features.multiDrawIndirect == VK_TRUE;
+
+	uniform_buffer = vklCreateHostCoherentBufferWithBackingMemory(sizeof(MeshletCullingUniformBlock), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+	meshlet_buffer = vklCreateHostCoherentBufferWithBackingMemory(max_meshlets * sizeof(Meshlet), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	instance_buffer = vklCreateHostCoherentBufferWithBackingMemory(max_instances * sizeof(MeshletInstance), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	command_buffer = vklCreateHostCoherentBufferWithBackingMemory(max_commands * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+	compute_descriptor_layout = createVkDescriptorSetLayout(
+		device,
+		{{.binding = 0,
+		  .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER},
+		 {.binding = 1,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 2,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER},
+		 {.binding = 3,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER}});
+	compute_descriptor_set = createVkDescriptorSet(device, descriptor_pool, compute_descriptor_layout);
+	writeDescriptorSetBuffer(device, compute_descriptor_set, 0, uniform_buffer, sizeof(uniform_block));
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 1, meshlet_buffer);
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 2, instance_buffer);
+	writeDescriptorSetStorageBuffer(device, compute_descriptor_set, 3, command_buffer);
+
+	pipeline = createVkComputePipeline(device, "cull_meshlets.comp", {compute_descriptor_layout});
+}
+
+void MeshletCulling::update(Camera &camera, const std::vector<std::unique_ptr<MeshInstance>> &instances, const std::vector<uint32_t> &visible, bool cull_backfaces)
+{
+	draws.assign(instances.size(), {0, 0});
+	std::vector<MeshletInstance> instance_data;
+	uint32_t command_count = 0;
+	max_instance_meshlets = 0;
+	for (uint32_t i : visible)
+	{
+		MeshInstance &instance = *instances[i];
+		Mesh *mesh = instance.mesh.get();
+		auto offset = mesh_offsets.find(mesh);
+		if (offset == mesh_offsets.end())
+		{
+			const std::vector<Meshlet> &meshlets = mesh->get_meshlets();
+			uint32_t first_meshlet = std::numeric_limits<uint32_t>::max();
+			if (meshlet_count + meshlets.size() <= max_meshlets)
+			{
+				first_meshlet = meshlet_count;
+				vklCopyDataIntoHostCoherentBuffer(meshlet_buffer, first_meshlet * sizeof(Meshlet), meshlets.data(), meshlets.size() * sizeof(Meshlet));
+				meshlet_count += uint32_t(meshlets.size());
+			}
+			else
+			{
+				VKL_WARNING("Too many meshlets, a mesh with " << meshlets.size() << " meshlets is drawn without meshlet culling");
+			}
+			offset = mesh_offsets.emplace(mesh, first_meshlet).first;
+		}
+
+		const std::vector<MeshLod> &lods = mesh->get_lods();
+		const MeshLod &lod = lods[std::min(instance.get_lod(), uint32_t(lods.size() - 1))];
+		if (offset->second == std::numeric_limits<uint32_t>::max() || instance_data.size() == max_instances || command_count + lod.meshlet_count > max_commands)
+			continue;
+
+		glm::mat4 model_matrix = instance.get_model_matrix();
+		float scale = std::max({glm::length(glm::vec3(model_matrix[0])), glm::length(glm::vec3(model_matrix[1])), glm::length(glm::vec3(model_matrix[2]))});
+		// The cone test is invariant under affine transforms, it runs in object space
+		glm::vec3 camera_position = glm::vec3(glm::inverse(model_matrix) * glm::vec4(camera.position, 1.0f));
+		instance_data.push_back({
+			.model_matrix = model_matrix,
+			.camera_position = glm::vec4(camera_position, scale),
+			.meshlets = glm::uvec4(offset->second + lod.first_meshlet, lod.meshlet_count, command_count, 0),
+		});
+		draws[i] = {command_count, lod.meshlet_count};
+		command_count += lod.meshlet_count;
+		max_instance_meshlets = std::max(max_instance_meshlets, lod.meshlet_count);
+	}
+
+	std::array<glm::vec4, 6> planes = frustumPlanes(camera);
+	std::copy(planes.begin(), planes.end(), uniform_block.frustum_planes);
+	uniform_block.counts = glm::uvec4(uint32_t(instance_data.size()), cull_backfaces ? 1 : 0, 0, 0);
+	culled_instance_count = uint32_t(instance_data.size());
+	vklCopyDataIntoHostCoherentBuffer(uniform_buffer, &uniform_block, sizeof(uniform_block));
+	if (!instance_data.empty())
+		vklCopyDataIntoHostCoherentBuffer(instance_buffer, instance_data.data(), instance_data.size() * sizeof(MeshletInstance));
+}
+
+void MeshletCulling::dispatch(VkCommandBuffer cmd_buffer)
+{
+	if (culled_instance_count == 0)
+		return;
+	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &compute_descriptor_set, 0, nullptr);
+	// x: meshlets of an instance in work groups of 64, y: instances
+	vkCmdDispatch(cmd_buffer, (max_instance_meshlets + 63) / 64, culled_instance_count, 1);
+}
+
+void MeshletCulling::draw(VkCommandBuffer cmd_buffer, size_t index, MeshInstance &instance)
+{
+	InstanceDraw draw = index < draws.size() ? draws[index] : InstanceDraw{0, 0};
+	if (draw.command_count == 0)
+	{
+		instance.mesh->draw(cmd_buffer, instance.get_lod());
+		return;
+	}
+
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	if (multi_draw_indirect)
+	{
+		vkCmdDrawIndexedIndirect(cmd_buffer, command_buffer, draw.first_command * stride, draw.command_count, stride);
+		return;
+	}
+	for (uint32_t c = 0; c < draw.command_count; c++)
+	{
+		vkCmdDrawIndexedIndirect(cmd_buffer, command_buffer, (draw.first_command + c) * stride, 1, stride);
+	}
+}
+
+void MeshletCulling::destroy(VkDevice device)
+{
+	destroyVkComputePipeline(device, pipeline);
+	vkDestroyDescriptorSetLayout(device, compute_descriptor_layout, nullptr);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(uniform_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(meshlet_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(instance_buffer);
+	vklDestroyHostCoherentBufferAndItsBackingMemory(command_buffer);
+}
+#pragma endregion
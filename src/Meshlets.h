@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "MyUtils.h"
+#include "Camera.h"
+#include "Compute.h"
+#include "Mesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// Splits every level into meshlets of consecutive triangles and fills in the meshlet ranges of the levels.
+// The triangle order is kept, after optimizeVertexCache consecutive triangles are close to each other.
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, std::vector<MeshLod> &lods);
+
+struct MeshletCullingUniformBlock
+{
+	glm::vec4 frustum_planes[6];
+	// x: instance count, y: 1 if backfacing meshlets are culled
+	glm::uvec4 counts;
+};
+
+struct MeshletInstance
+{
+	glm::mat4 model_matrix;
+	// xyz: camera position in object space, w: largest scale of the model matrix
+	glm::vec4 camera_position;
+	// x: first meshlet, y: meshlet count, z: first draw command
+	glm::uvec4 meshlets;
+};
+
+// Culls the meshlets of all instances against the view frustum and their normal cones in a compute pass.
+// Cone culling removes back faces only, it is enabled if the pipelines cull back faces as well.
+// Every meshlet of the selected level gets an indirect draw command, culled meshlets draw no indices.
+// Meshlets of meshes are uploaded the first time an instance of the mesh is culled.
+class MeshletCulling : public ITrash
+{
+private:
+	struct InstanceDraw
+	{
+		uint32_t first_command;
+		// 0 if the instance did not fit into the buffers, it is drawn without culling then
+		uint32_t command_count;
+	};
+
+	MeshletCullingUniformBlock uniform_block = {};
+	VkBuffer uniform_buffer = VK_NULL_HANDLE;
+	VkBuffer meshlet_buffer = VK_NULL_HANDLE;
+	VkBuffer instance_buffer = VK_NULL_HANDLE;
+	VkBuffer command_buffer = VK_NULL_HANDLE;
+	VkDescriptorSetLayout compute_descriptor_layout = VK_NULL_HANDLE;
+	VkDescriptorSet compute_descriptor_set = VK_NULL_HANDLE;
+	ComputePipeline pipeline = {};
+	uint32_t max_meshlets = 0;
+	uint32_t max_instances = 0;
+	uint32_t max_commands = 0;
+	bool multi_draw_indirect = false;
+
+	// first meshlet of every uploaded mesh in meshlet_buffer
+	std::unordered_map<Mesh *, uint32_t> mesh_offsets;
+	uint32_t meshlet_count = 0;
+	std::vector<InstanceDraw> draws;
+	uint32_t culled_instance_count = 0;
+	uint32_t max_instance_meshlets = 0;
+
+public:
+	MeshletCulling(VkPhysicalDevice physical_device, VkDevice device, VkDescriptorPool descriptor_pool, uint32_t max_meshlets, uint32_t max_instances, uint32_t max_commands);
+
+	// Uploads the transforms and selected levels of the visible instances, given as indices into instances.
+	// draw takes the index into instances, other instances are drawn without culling.
+	void update(Camera &camera, const std::vector<std::unique_ptr<MeshInstance>> &instances, const std::vector<uint32_t> &visible, bool cull_backfaces);
+	void dispatch(VkCommandBuffer cmd_buffer);
+	// Draws the meshlets of the instance which survived culling, the mesh has to be bound already
+	void draw(VkCommandBuffer cmd_buffer, size_t index, MeshInstance &instance);
+	void destroy(VkDevice device);
+};
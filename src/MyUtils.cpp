@@ -25,4 +25,55 @@ void SharedUniformBuffer::destroy(VkDevice device)
 	vklDestroyHostCoherentBufferAndItsBackingMemory(buffer);
 }
 
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+uint32_t findMemoryTypeIndex(VkPhysicalDevice physical_device, uint32_t type_bits, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties memory_props = {};
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_props);
+	for (uint32_t i = 0; i < memory_props.memoryTypeCount; i++)
+	{
+		if ((type_bits & (1u << i)) && (memory_props.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	}
+	VKL_EXIT_WITH_ERROR("Unable to find a suitable memory type.");
+}
+
+BufferWithMemory createBufferWithMemory(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+{
+	BufferWithMemory result = {};
+	VkBufferCreateInfo buffer_create_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	VkResult error = vkCreateBuffer(device, &buffer_create_info, nullptr, &result.buffer);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkMemoryRequirements memory_requirements = {};
+	vkGetBufferMemoryRequirements(device, result.buffer, &memory_requirements);
+	VkMemoryAllocateInfo memory_alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = memory_requirements.size,
+		.memoryTypeIndex = findMemoryTypeIndex(physical_device, memory_requirements.memoryTypeBits, properties),
+	};
+	error = vkAllocateMemory(device, &memory_alloc_info, nullptr, &result.memory);
+	VKL_CHECK_VULKAN_ERROR(error);
+	error = vkBindBufferMemory(device, result.buffer, result.memory, 0);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		error = vkMapMemory(device, result.memory, 0, VK_WHOLE_SIZE, 0, &result.data);
+		VKL_CHECK_VULKAN_ERROR(error);
+	}
+	return result;
+}
+
+void destroyBufferWithMemory(VkDevice device, BufferWithMemory &buffer)
+{
+	vkDestroyBuffer(device, buffer.buffer, nullptr);
+	vkFreeMemory(device, buffer.memory, nullptr);
+	buffer = {};
+}
@@ -36,6 +36,20 @@ public:
 	void destroy(VkDevice device);
 };
 
+// Returns the index of a memory type that is allowed by type_bits and has all of the given properties
+uint32_t findMemoryTypeIndex(VkPhysicalDevice physical_device, uint32_t type_bits, VkMemoryPropertyFlags properties);
+
+// A buffer with memory of its own, data points to the mapped memory if it is host visible and is nullptr otherwise
+struct BufferWithMemory
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	void *data = nullptr;
+};
+
+BufferWithMemory createBufferWithMemory(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+void destroyBufferWithMemory(VkDevice device, BufferWithMemory &buffer);
+
 struct VkDetailedImage
 {
 	VkImage image;
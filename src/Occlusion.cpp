@@ -0,0 +1,389 @@
+#include "Occlusion.h"
+
+#include <VulkanLaunchpad.h>
+#include "Descriptors.h"
+#include "Utils.h"
+#include "vulkan_ext.h"
+
+#include <cmath>
+
+#pragma region HiZPyramid
+HiZPyramid::HiZPyramid(VkPhysicalDevice physical_device, VkDevice device, VkExtent2D extent, VkBuffer instance_buffer)
+{
+	this->extent = extent;
+	this->level_count = uint32_t(std::floor(std::log2(float(std::max(extent.width, extent.height))))) + 1;
+
+	depth_image = create_image(physical_device, device, VK_FORMAT_D32_SFLOAT, 1, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, depth_memory);
+	depth_view = create_view(device, depth_image, VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1);
+	pyramid_image = create_image(physical_device, device, VK_FORMAT_R32_SFLOAT, level_count, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, pyramid_memory);
+	pyramid_view = create_view(device, pyramid_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, level_count);
+	for (uint32_t level = 0; level < level_count; level++)
+	{
+		level_views.push_back(create_view(device, pyramid_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, level, 1));
+	}
+
+	// Only read with texelFetch
+	VkSamplerCreateInfo sampler_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_NEAREST,
+		.minFilter = VK_FILTER_NEAREST,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.maxLod = VK_LOD_CLAMP_NONE,
+	};
+	VkResult error = vkCreateSampler(device, &sampler_create_info, nullptr, &sampler);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkAttachmentDescription depth_attachment = {
+		.format = VK_FORMAT_D32_SFLOAT,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	};
+	VkAttachmentReference depth_reference = {
+		.attachment = 0,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	};
+	VkSubpassDescription subpass = {
+		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+		.pDepthStencilAttachment = &depth_reference,
+	};
+	// The reduction of the previous build reads the depth buffer, the reduction of this build waits for the depth
+	VkSubpassDependency dependencies[] = {
+		{
+			.srcSubpass = VK_SUBPASS_EXTERNAL,
+			.dstSubpass = 0,
+			.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			.srcAccessMask = 0,
+			.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		},
+		{
+			.srcSubpass = 0,
+			.dstSubpass = VK_SUBPASS_EXTERNAL,
+			.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		},
+	};
+	VkRenderPassCreateInfo render_pass_create_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+		.attachmentCount = 1,
+		.pAttachments = &depth_attachment,
+		.subpassCount = 1,
+		.pSubpasses = &subpass,
+		.dependencyCount = uint32_t(std::size(dependencies)),
+		.pDependencies = dependencies,
+	};
+	error = vkCreateRenderPass(device, &render_pass_create_info, nullptr, &render_pass);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkFramebufferCreateInfo framebuffer_create_info = {
+		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+		.renderPass = render_pass,
+		.attachmentCount = 1,
+		.pAttachments = &depth_view,
+		.width = extent.width,
+		.height = extent.height,
+		.layers = 1,
+	};
+	error = vkCreateFramebuffer(device, &framebuffer_create_info, nullptr, &framebuffer);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	descriptor_pool = createVkDescriptorPool(device, level_count + 1, level_count + 1);
+	depth_descriptor_layout = createVkDescriptorSetLayout(
+		device,
+		{{.binding = 0,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER}});
+	depth_descriptor_set = createVkDescriptorSet(device, descriptor_pool, depth_descriptor_layout);
+	writeDescriptorSetStorageBuffer(device, depth_descriptor_set, 0, instance_buffer);
+	create_depth_pipelines(device);
+
+	reduce_descriptor_layout = createVkDescriptorSetLayout(
+		device,
+		{{.binding = 0,
+		  .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER},
+		 {.binding = 1,
+		  .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE}});
+	for (uint32_t level = 0; level < level_count; level++)
+	{
+		VkDescriptorSet descriptor_set = createVkDescriptorSet(device, descriptor_pool, reduce_descriptor_layout);
+		// Level 0 has the size of the depth buffer, every further level halves the previous one
+		if (level == 0)
+			writeDescriptorSetImage(device, descriptor_set, 0, sampler, depth_view);
+		else
+			writeDescriptorSetImage(device, descriptor_set, 0, sampler, level_views[level - 1], VK_IMAGE_LAYOUT_GENERAL);
+		writeDescriptorSetStorageImage(device, descriptor_set, 1, level_views[level]);
+		reduce_descriptor_sets.push_back(descriptor_set);
+	}
+	reduce_pipeline = createVkComputePipeline(device, "hiz_reduce.comp", {reduce_descriptor_layout});
+}
+
+VkImage HiZPyramid::create_image(VkPhysicalDevice physical_device, VkDevice device, VkFormat format, uint32_t levels, VkImageUsageFlags usage, VkDeviceMemory &memory)
+{
+	VkImageCreateInfo image_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = format,
+		.extent = {extent.width, extent.height, 1},
+		.mipLevels = levels,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	VkImage image = VK_NULL_HANDLE;
+	VkResult error = vkCreateImage(device, &image_create_info, nullptr, &image);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkMemoryRequirements memory_requirements = {};
+	vkGetImageMemoryRequirements(device, image, &memory_requirements);
+	VkMemoryAllocateInfo memory_alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = memory_requirements.size,
+		.memoryTypeIndex = findMemoryTypeIndex(physical_device, memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+	};
+	error = vkAllocateMemory(device, &memory_alloc_info, nullptr, &memory);
+	VKL_CHECK_VULKAN_ERROR(error);
+	error = vkBindImageMemory(device, image, memory, 0);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return image;
+}
+
+VkImageView HiZPyramid::create_view(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t base_level, uint32_t levels)
+{
+	VkImageViewCreateInfo image_view_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = format,
+		.components = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY},
+		.subresourceRange = {
+			.aspectMask = aspect,
+			.baseMipLevel = base_level,
+			.levelCount = levels,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+	};
+	VkImageView view = VK_NULL_HANDLE;
+	VkResult error = vkCreateImageView(device, &image_view_create_info, nullptr, &view);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return view;
+}
+
+void HiZPyramid::create_depth_pipelines(VkDevice device)
+{
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.offset = 0,
+		.size = sizeof(OcclusionDepthPushConstants),
+	};
+	VkPipelineLayoutCreateInfo layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &depth_descriptor_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+	VkResult error = vkCreatePipelineLayout(device, &layout_create_info, nullptr, &depth_pipeline_layout);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	std::string shader_path = gcgLoadShaderFilePath("assets/shaders_vk/occlusion_depth.vert");
+	VkShaderModule shader_module = createVkShaderModule(device, shader_path, VK_SHADER_STAGE_VERTEX_BIT);
+	VkPipelineShaderStageCreateInfo stage = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.module = shader_module,
+		.pName = "main",
+	};
+	VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	};
+	VkViewport viewport = {0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f};
+	VkRect2D scissor = {{0, 0}, extent};
+	VkPipelineViewportStateCreateInfo viewport_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.pViewports = &viewport,
+		.scissorCount = 1,
+		.pScissors = &scissor,
+	};
+	// Open meshes like the cornell box are seen from both sides
+	VkPipelineRasterizationStateCreateInfo rasterization = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = VK_CULL_MODE_NONE,
+		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+		.lineWidth = 1.0f,
+	};
+	VkPipelineMultisampleStateCreateInfo multisample = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+	};
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = VK_TRUE,
+		.depthWriteEnable = VK_TRUE,
+		.depthCompareOp = VK_COMPARE_OP_LESS,
+	};
+
+	for (VertexLayout layout : {VertexLayout::Full, VertexLayout::Compact})
+	{
+		std::vector<VkVertexInputBindingDescription> buffers;
+		std::vector<VkVertexInputAttributeDescription> attributes;
+		describeVertexInput(layout, true, buffers, attributes);
+		VkPipelineVertexInputStateCreateInfo vertex_input = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+			.vertexBindingDescriptionCount = uint32_t(buffers.size()),
+			.pVertexBindingDescriptions = buffers.data(),
+			.vertexAttributeDescriptionCount = uint32_t(attributes.size()),
+			.pVertexAttributeDescriptions = attributes.data(),
+		};
+		// Depth only, there is neither a fragment shader nor a color attachment
+		VkGraphicsPipelineCreateInfo pipeline_create_info = {
+			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+			.stageCount = 1,
+			.pStages = &stage,
+			.pVertexInputState = &vertex_input,
+			.pInputAssemblyState = &input_assembly,
+			.pViewportState = &viewport_state,
+			.pRasterizationState = &rasterization,
+			.pMultisampleState = &multisample,
+			.pDepthStencilState = &depth_stencil,
+			.layout = depth_pipeline_layout,
+			.renderPass = render_pass,
+			.subpass = 0,
+		};
+		error = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &depth_pipelines[size_t(layout)]);
+		VKL_CHECK_VULKAN_ERROR(error);
+	}
+	vkDestroyShaderModule(device, shader_module, nullptr);
+}
+
+void HiZPyramid::begin(VkCommandBuffer cmd_buffer, glm::mat4 view_projection_matrix)
+{
+	this->view_projection_matrix = view_projection_matrix;
+	VkClearValue clear_value = {.depthStencil = {1.0f, 0}};
+	VkRenderPassBeginInfo render_pass_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.renderPass = render_pass,
+		.framebuffer = framebuffer,
+		.renderArea = {{0, 0}, extent},
+		.clearValueCount = 1,
+		.pClearValues = &clear_value,
+	};
+	vkCmdBeginRenderPass(cmd_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pipeline_layout, 0, 1, &depth_descriptor_set, 0, nullptr);
+}
+
+void HiZPyramid::bind_mesh(VkCommandBuffer cmd_buffer, Mesh &mesh)
+{
+	MeshInstanceUniformBlock uniforms = {};
+	mesh.fill_uniforms(uniforms);
+	OcclusionDepthPushConstants constants = {
+		.view_projection_matrix = view_projection_matrix,
+		.position_scale = uniforms.position_scale,
+		.position_offset = uniforms.position_offset,
+	};
+	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_pipelines[size_t(mesh.get_vertex_layout())]);
+	vkCmdPushConstants(cmd_buffer, depth_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+	mesh.bind_positions(cmd_buffer);
+}
+
+void HiZPyramid::end(VkCommandBuffer cmd_buffer)
+{
+	vkCmdEndRenderPass(cmd_buffer);
+
+	VkImageSubresourceRange all_levels = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = level_count,
+		.baseArrayLayer = 0,
+		.layerCount = 1,
+	};
+	if (!initialized)
+	{
+		VkImageMemoryBarrier2 layout_barrier = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+			.srcAccessMask = 0,
+			.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.dstAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = pyramid_image,
+			.subresourceRange = all_levels,
+		};
+		VkDependencyInfo layout_dep_info = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.imageMemoryBarrierCount = 1,
+			.pImageMemoryBarriers = &layout_barrier,
+		};
+		vkCmdPipelineBarrier2KHR(cmd_buffer, &layout_dep_info);
+		initialized = true;
+	}
+
+	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_pipeline.pipeline);
+	for (uint32_t level = 0; level < level_count; level++)
+	{
+		uint32_t width = std::max(extent.width >> level, 1u);
+		uint32_t height = std::max(extent.height >> level, 1u);
+		vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_pipeline.layout, 0, 1, &reduce_descriptor_sets[level], 0, nullptr);
+		vkCmdDispatch(cmd_buffer, (width + 7) / 8, (height + 7) / 8, 1);
+
+		// The next level and the occlusion test read this level
+		VkMemoryBarrier2 level_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT,
+		};
+		VkDependencyInfo level_dep_info = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &level_barrier,
+		};
+		vkCmdPipelineBarrier2KHR(cmd_buffer, &level_dep_info);
+	}
+}
+
+void HiZPyramid::destroy(VkDevice device)
+{
+	destroyVkComputePipeline(device, reduce_pipeline);
+	for (VkPipeline pipeline : depth_pipelines)
+	{
+		vkDestroyPipeline(device, pipeline, nullptr);
+	}
+	vkDestroyPipelineLayout(device, depth_pipeline_layout, nullptr);
+	vkDestroyDescriptorSetLayout(device, reduce_descriptor_layout, nullptr);
+	vkDestroyDescriptorSetLayout(device, depth_descriptor_layout, nullptr);
+	vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+	vkDestroyFramebuffer(device, framebuffer, nullptr);
+	vkDestroyRenderPass(device, render_pass, nullptr);
+	vkDestroySampler(device, sampler, nullptr);
+	for (VkImageView view : level_views)
+	{
+		vkDestroyImageView(device, view, nullptr);
+	}
+	vkDestroyImageView(device, pyramid_view, nullptr);
+	vkDestroyImageView(device, depth_view, nullptr);
+	vkDestroyImage(device, pyramid_image, nullptr);
+	vkDestroyImage(device, depth_image, nullptr);
+	vkFreeMemory(device, pyramid_memory, nullptr);
+	vkFreeMemory(device, depth_memory, nullptr);
+}
+#pragma endregion
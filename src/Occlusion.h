@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "MyUtils.h"
+#include "Compute.h"
+#include "Pipelines.h"
+#include "Mesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <array>
+
+struct OcclusionDepthPushConstants
+{
+	glm::mat4 view_projection_matrix;
+	glm::vec4 position_scale;
+	glm::vec4 position_offset;
+};
+
+// A depth buffer of its own and a pyramid whose texels hold the farthest depth of the texels they cover.
+// The framework's render pass neither keeps its depth attachment nor can be interrupted, so occluders are drawn
+// into the separate depth buffer in the compute command buffer, using the instance buffer of GpuCulling.
+class HiZPyramid : public ITrash
+{
+private:
+	VkExtent2D extent = {};
+	uint32_t level_count = 0;
+	VkImage depth_image = VK_NULL_HANDLE;
+	VkDeviceMemory depth_memory = VK_NULL_HANDLE;
+	VkImageView depth_view = VK_NULL_HANDLE;
+	VkImage pyramid_image = VK_NULL_HANDLE;
+	VkDeviceMemory pyramid_memory = VK_NULL_HANDLE;
+	// all levels, for the occlusion test
+	VkImageView pyramid_view = VK_NULL_HANDLE;
+	// one view per level, for the reduction
+	std::vector<VkImageView> level_views;
+	VkSampler sampler = VK_NULL_HANDLE;
+	// the pyramid is in VK_IMAGE_LAYOUT_GENERAL after the first build
+	bool initialized = false;
+
+	VkRenderPass render_pass = VK_NULL_HANDLE;
+	VkFramebuffer framebuffer = VK_NULL_HANDLE;
+	// The number of sets depends on the level count, so the pyramid has a pool of its own
+	VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+	VkDescriptorSetLayout depth_descriptor_layout = VK_NULL_HANDLE;
+	VkDescriptorSet depth_descriptor_set = VK_NULL_HANDLE;
+	VkPipelineLayout depth_pipeline_layout = VK_NULL_HANDLE;
+	// indexed by vertex layout
+	std::array<VkPipeline, 2> depth_pipelines = {};
+	VkDescriptorSetLayout reduce_descriptor_layout = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> reduce_descriptor_sets;
+	ComputePipeline reduce_pipeline = {};
+	glm::mat4 view_projection_matrix = glm::mat4(1.0f);
+
+	VkImage create_image(VkPhysicalDevice physical_device, VkDevice device, VkFormat format, uint32_t levels, VkImageUsageFlags usage, VkDeviceMemory &memory);
+	VkImageView create_view(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t base_level, uint32_t levels);
+	void create_depth_pipelines(VkDevice device);
+
+public:
+	// instance_buffer holds the GpuInstance of every instance, the depth pass draws with firstInstance = instance index
+	HiZPyramid(VkPhysicalDevice physical_device, VkDevice device, VkExtent2D extent, VkBuffer instance_buffer);
+
+	// Begins the depth pass, the occluders are drawn by binding their mesh and issuing indirect draws
+	void begin(VkCommandBuffer cmd_buffer, glm::mat4 view_projection_matrix);
+	void bind_mesh(VkCommandBuffer cmd_buffer, Mesh &mesh);
+	// Ends the depth pass and reduces the depth buffer into the pyramid
+	void end(VkCommandBuffer cmd_buffer);
+
+	VkImageView get_view()
+	{
+		return pyramid_view;
+	}
+	VkSampler get_sampler()
+	{
+		return sampler;
+	}
+	VkExtent2D get_extent()
+	{
+		return extent;
+	}
+	uint32_t get_level_count()
+	{
+		return level_count;
+	}
+	void destroy(VkDevice device);
+};
@@ -0,0 +1,81 @@
+#include "Picking.h"
+
+#include <cmath>
+#include <limits>
+
+#undef min
+#undef max
+
+void cursorRay(Camera &camera, glm::vec2 cursor, glm::vec3 &origin, glm::vec3 &direction)
+{
+	// The viewport maps NDC y = -1 to the top row, like the cursor
+	glm::vec2 ndc = cursor / camera.viewportSize * 2.0f - 1.0f;
+	glm::mat4 inverse_view_projection = glm::inverse(camera.projectionMatrix * camera.viewMatrix);
+	glm::vec4 near_point = inverse_view_projection * glm::vec4(ndc, 0.0f, 1.0f);
+	glm::vec4 far_point = inverse_view_projection * glm::vec4(ndc, 1.0f, 1.0f);
+	origin = glm::vec3(near_point) / near_point.w;
+	direction = glm::normalize(glm::vec3(far_point) / far_point.w - origin);
+}
+
+float intersectTriangles(const std::vector<TriangleBatch> &batches, glm::vec3 origin, glm::vec3 direction, float max_distance)
+{
+	// Moller-Trumbore
+	for (const TriangleBatch &batch : batches)
+	{
+		float distances[TRIANGLE_BATCH_SIZE];
+		for (uint32_t lane = 0; lane < TRIANGLE_BATCH_SIZE; lane++)
+		{
+			float p_x = direction.y * batch.e2_z[lane] - direction.z * batch.e2_y[lane];
+			float p_y = direction.z * batch.e2_x[lane] - direction.x * batch.e2_z[lane];
+			float p_z = direction.x * batch.e2_y[lane] - direction.y * batch.e2_x[lane];
+			float determinant = batch.e1_x[lane] * p_x + batch.e1_y[lane] * p_y + batch.e1_z[lane] * p_z;
+			float inverse_determinant = 1.0f / determinant;
+			float t_x = origin.x - batch.v0_x[lane];
+			float t_y = origin.y - batch.v0_y[lane];
+			float t_z = origin.z - batch.v0_z[lane];
+			float u = (t_x * p_x + t_y * p_y + t_z * p_z) * inverse_determinant;
+			float q_x = t_y * batch.e1_z[lane] - t_z * batch.e1_y[lane];
+			float q_y = t_z * batch.e1_x[lane] - t_x * batch.e1_z[lane];
+			float q_z = t_x * batch.e1_y[lane] - t_y * batch.e1_x[lane];
+			float v = (direction.x * q_x + direction.y * q_y + direction.z * q_z) * inverse_determinant;
+			float t = (batch.e2_x[lane] * q_x + batch.e2_y[lane] * q_y + batch.e2_z[lane] * q_z) * inverse_determinant;
+			// Degenerate triangles and rays parallel to the triangle fail the first test.
+			// & instead of && evaluates every test without branches, only then the lanes are vectorized.
+			bool hit = (std::abs(determinant) > 1e-12f) & (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f) & (t > 0.0f);
+			distances[lane] = hit ? t : max_distance;
+		}
+		for (uint32_t lane = 0; lane < TRIANGLE_BATCH_SIZE; lane++)
+		{
+			max_distance = std::min(max_distance, distances[lane]);
+		}
+	}
+	return max_distance;
+}
+
+PickResult pick(InstanceBvh &bvh, const std::vector<std::unique_ptr<MeshInstance>> &instances, glm::vec3 origin, glm::vec3 direction)
+{
+	PickResult result = {};
+	const float miss = std::numeric_limits<float>::max();
+	auto intersect = [&](uint32_t index, float max_distance)
+	{
+		MeshInstance &instance = *instances[index];
+		// The direction is not normalized in object space, so distances along both rays are the same
+		glm::mat4 inverse_model = glm::inverse(instance.get_model_matrix());
+		glm::vec3 object_origin = glm::vec3(inverse_model * glm::vec4(origin, 1.0f));
+		glm::vec3 object_direction = glm::vec3(inverse_model * glm::vec4(direction, 0.0f));
+		float hit = intersectTriangles(instance.mesh->get_triangle_batches(), object_origin, object_direction, max_distance);
+		if (hit < max_distance)
+		{
+			result.instance = &instance;
+			result.instance_index = index;
+		}
+		return hit;
+	};
+	float distance = bvh.query_ray(origin, direction, miss, intersect);
+	if (result.instance != nullptr)
+	{
+		result.distance = distance;
+		result.position = origin + direction * distance;
+	}
+	return result;
+}
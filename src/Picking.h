@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "Mesh.h"
+#include "Bvh.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+
+struct PickResult
+{
+	// nullptr if the ray hits nothing
+	MeshInstance *instance = nullptr;
+	uint32_t instance_index = 0;
+	// world space
+	glm::vec3 position = glm::vec3(0.0f);
+	float distance = 0.0f;
+};
+
+// The world space ray through a cursor position in framebuffer pixels, starting on the near plane
+void cursorRay(Camera &camera, glm::vec2 cursor, glm::vec3 &origin, glm::vec3 &direction);
+// Distance along the ray to the closest triangle within max_distance, or max_distance without hit.
+// Both faces are hit, the lanes of a batch are tested together and the compiler vectorizes them.
+float intersectTriangles(const std::vector<TriangleBatch> &batches, glm::vec3 origin, glm::vec3 direction, float max_distance);
+
+// Picks the closest instance along a ray on the CPU, without reading anything back from the GPU.
+// The BVH narrows the candidates down to the instances whose bounds the ray enters, their triangles are tested in
+// object space. Parametric instances are tested against their current tessellation.
+PickResult pick(InstanceBvh &bvh, const std::vector<std::unique_ptr<MeshInstance>> &instances, glm::vec3 origin, glm::vec3 direction);
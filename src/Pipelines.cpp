@@ -4,42 +4,97 @@
 #include "Utils.h"
 #include "PathUtils.h"
 #include "Input.h"
+#include "Compute.h"
+
+void describeVertexInput(VertexLayout layout, bool position_only, std::vector<VkVertexInputBindingDescription> &buffers, std::vector<VkVertexInputAttributeDescription> &attributes)
+{
+	bool compact = layout == VertexLayout::Compact;
+	buffers = {{
+		.binding = 0,
+		.stride = compact ? uint32_t(sizeof(CompactPosition)) : uint32_t(sizeof(glm::vec3)),
+		.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+	}};
+	attributes = {{
+		.location = 0,
+		.binding = 0,
+		.format = compact ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R32G32B32_SFLOAT,
+		.offset = 0,
+	}};
+	if (position_only)
+		return;
+
+	if (compact)
+	{
+		// The shaders see the same attribute locations, the color comes from a per instance binding.
+		// Its stride is 0, so indirect draws with any firstInstance read the single color of the mesh.
+		buffers.push_back({
+			.binding = 1,
+			.stride = sizeof(CompactVertexAttributes),
+			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+		});
+		buffers.push_back({
+			.binding = 2,
+			.stride = 0,
+			.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+		});
+		attributes.push_back({
+			.location = 1,
+			.binding = 2,
+			.format = VK_FORMAT_R32G32B32_SFLOAT,
+			.offset = 0,
+		});
+		attributes.push_back({
+			.location = 2,
+			.binding = 1,
+			.format = VK_FORMAT_R16G16_SNORM,
+			.offset = offsetof(CompactVertexAttributes, normal),
+		});
+		attributes.push_back({
+			.location = 3,
+			.binding = 1,
+			.format = VK_FORMAT_R16G16_SFLOAT,
+			.offset = offsetof(CompactVertexAttributes, uv),
+		});
+	}
+	else
+	{
+		buffers.push_back({
+			.binding = 1,
+			.stride = sizeof(VertexAttributes),
+			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+		});
+		attributes.push_back({
+			.location = 1,
+			.binding = 1,
+			.format = VK_FORMAT_R32G32B32_SFLOAT,
+			.offset = offsetof(VertexAttributes, color),
+		});
+		attributes.push_back({
+			.location = 2,
+			.binding = 1,
+			.format = VK_FORMAT_R32G32B32_SFLOAT,
+			.offset = offsetof(VertexAttributes, normal),
+		});
+		attributes.push_back({
+			.location = 3,
+			.binding = 1,
+			.format = VK_FORMAT_R32G32_SFLOAT,
+			.offset = offsetof(VertexAttributes, uv),
+		});
+	}
+}
 
 VkPipeline createVkPipeline(PipelineParams &params)
 {
+	std::vector<VkVertexInputBindingDescription> vertex_input_buffers;
+	std::vector<VkVertexInputAttributeDescription> input_attribute_descriptions;
+	describeVertexInput(params.vertex_layout, params.position_only, vertex_input_buffers, input_attribute_descriptions);
+
 	VklGraphicsPipelineConfig graphics_pipeline_config = {
 		.vertexShaderPath = params.vertex_shader_path.c_str(),
 		.fragmentShaderPath = params.fragment_shader_path.c_str(),
-		.vertexInputBuffers = {{
-			.binding = 0,
-			.stride = sizeof(Vertex),
-			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-		}},
-		.inputAttributeDescriptions = {
-			{
-				.location = 0,
-				.binding = 0,
-				.format = VK_FORMAT_R32G32B32_SFLOAT,
-				.offset = offsetof(Vertex, position),
-			},
-			{
-				.location = 1,
-				.binding = 0,
-				.format = VK_FORMAT_R32G32B32_SFLOAT,
-				.offset = offsetof(Vertex, color),
-			},
-			{
-				.location = 2,
-				.binding = 0,
-				.format = VK_FORMAT_R32G32B32_SFLOAT,
-				.offset = offsetof(Vertex, normal),
-			},
-			{
-				.location = 3,
-				.binding = 0,
-				.format = VK_FORMAT_R32G32_SFLOAT,
-				.offset = offsetof(Vertex, uv),
-			}},
+		.vertexInputBuffers = vertex_input_buffers,
+		.inputAttributeDescriptions = input_attribute_descriptions,
 		.polygonDrawMode = params.polygon_mode,
 		.triangleCullingMode = params.culling_mode,
 		.descriptorLayout = {{
@@ -77,6 +132,24 @@ VkPipeline createVkPipeline(PipelineParams &params)
 								 .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 								 .descriptorCount = 1,
 								 .stageFlags = VK_SHADER_STAGE_ALL,
+							 },
+							 {
+								 .binding = 6,
+								 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+								 .descriptorCount = 1,
+								 .stageFlags = VK_SHADER_STAGE_ALL,
+							 },
+							 {
+								 .binding = 7,
+								 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+								 .descriptorCount = 1,
+								 .stageFlags = VK_SHADER_STAGE_ALL,
+							 },
+							 {
+								 .binding = 8,
+								 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+								 .descriptorCount = 1,
+								 .stageFlags = VK_SHADER_STAGE_ALL,
 							 }},
 	};
 	return vklCreateGraphicsPipeline(graphics_pipeline_config);
@@ -109,6 +182,102 @@ void destroyVkPipelineMatrix(std::vector<std::vector<VkPipeline>> matrix)
 	}
 }
 
+VkPipeline createVkPrepassPipeline(VkDevice device, VkRenderPass render_pass, VkPipelineLayout layout, VkExtent2D extent, PipelineParams &params)
+{
+	std::vector<VkVertexInputBindingDescription> vertex_input_buffers;
+	std::vector<VkVertexInputAttributeDescription> input_attribute_descriptions;
+	describeVertexInput(params.vertex_layout, params.position_only, vertex_input_buffers, input_attribute_descriptions);
+	VkPipelineVertexInputStateCreateInfo vertex_input = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = uint32_t(vertex_input_buffers.size()),
+		.pVertexBindingDescriptions = vertex_input_buffers.data(),
+		.vertexAttributeDescriptionCount = uint32_t(input_attribute_descriptions.size()),
+		.pVertexAttributeDescriptions = input_attribute_descriptions.data(),
+	};
+
+	bool has_fragment_shader = !params.fragment_shader_path.empty();
+	std::vector<VkShaderModule> shader_modules = {createVkShaderModule(device, params.vertex_shader_path, VK_SHADER_STAGE_VERTEX_BIT)};
+	std::vector<VkPipelineShaderStageCreateInfo> stages = {{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.module = shader_modules[0],
+		.pName = "main",
+	}};
+	if (has_fragment_shader)
+	{
+		shader_modules.push_back(createVkShaderModule(device, params.fragment_shader_path, VK_SHADER_STAGE_FRAGMENT_BIT));
+		stages.push_back({
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.module = shader_modules[1],
+			.pName = "main",
+		});
+	}
+
+	VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	};
+	VkViewport viewport = {0.0f, 0.0f, float(extent.width), float(extent.height), 0.0f, 1.0f};
+	VkRect2D scissor = {{0, 0}, extent};
+	VkPipelineViewportStateCreateInfo viewport_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.pViewports = &viewport,
+		.scissorCount = 1,
+		.pScissors = &scissor,
+	};
+	VkPipelineRasterizationStateCreateInfo rasterization = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.polygonMode = params.polygon_mode,
+		.cullMode = params.culling_mode,
+		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+		.lineWidth = 1.0f,
+	};
+	VkPipelineMultisampleStateCreateInfo multisample = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+	};
+	VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = VK_TRUE,
+		.depthWriteEnable = params.depth_equal ? VK_FALSE : VK_TRUE,
+		.depthCompareOp = params.depth_equal ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS,
+	};
+	VkPipelineColorBlendAttachmentState color_blend_attachment = {
+		.blendEnable = VK_FALSE,
+		.colorWriteMask = has_fragment_shader ? VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT : 0,
+	};
+	VkPipelineColorBlendStateCreateInfo color_blend = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.attachmentCount = 1,
+		.pAttachments = &color_blend_attachment,
+	};
+	VkGraphicsPipelineCreateInfo pipeline_create_info = {
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.stageCount = uint32_t(stages.size()),
+		.pStages = stages.data(),
+		.pVertexInputState = &vertex_input,
+		.pInputAssemblyState = &input_assembly,
+		.pViewportState = &viewport_state,
+		.pRasterizationState = &rasterization,
+		.pMultisampleState = &multisample,
+		.pDepthStencilState = &depth_stencil,
+		.pColorBlendState = &color_blend,
+		.layout = layout,
+		.renderPass = render_pass,
+		.subpass = 0,
+	};
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkResult error = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &pipeline);
+	VKL_CHECK_VULKAN_ERROR(error);
+	for (VkShaderModule shader_module : shader_modules)
+	{
+		vkDestroyShaderModule(device, shader_module, nullptr);
+	}
+	return pipeline;
+}
+
 #pragma region PipelineMatrixManager
 PipelineMatrixManager::PipelineMatrixManager()
 {
@@ -124,14 +293,150 @@ void PipelineMatrixManager::load(PipelineMatrixManager::Shader shader, std::stri
 		.polygon_mode = VK_POLYGON_MODE_FILL,
 		.culling_mode = VK_CULL_MODE_NONE,
 	};
-	matrix[shader] = createVkPipelineMatrix(pipelineParams, polygon_modes, culling_modes);
+	for (VertexLayout layout : {VertexLayout::Full, VertexLayout::Compact})
+	{
+		pipelineParams.vertex_layout = layout;
+		matrix[shader][size_t(layout)] = createVkPipelineMatrix(pipelineParams, polygon_modes, culling_modes);
+	}
+	shader_params[shader] = pipelineParams;
+}
+
+void PipelineMatrixManager::init_depth_prepass(VkDevice device, VkFormat color_format, VkFormat depth_format, VkExtent2D extent, VkDescriptorSetLayout descriptor_layout, bool enabled)
+{
+	depth_prepass = enabled;
+	prepass_device = device;
+	prepass_color_format = color_format;
+	prepass_depth_format = depth_format;
+	prepass_extent = extent;
+
+	VkPipelineLayoutCreateInfo layout_create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &descriptor_layout,
+	};
+	VkResult error = vkCreatePipelineLayout(device, &layout_create_info, nullptr, &prepass_layout);
+	VKL_CHECK_VULKAN_ERROR(error);
+	create_prepass_pipelines();
+}
+
+void PipelineMatrixManager::create_prepass_pipelines()
+{
+	VkDevice device = prepass_device;
+
+	// Only needed to create the pipelines, it matches the framework's render pass in attachment formats and references
+	VkAttachmentDescription attachments[] = {
+		{
+			.format = prepass_color_format,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		},
+		{
+			.format = prepass_depth_format,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		},
+	};
+	VkAttachmentReference color_reference = {
+		.attachment = 0,
+		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	};
+	VkAttachmentReference depth_reference = {
+		.attachment = 1,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	};
+	VkSubpassDescription subpass = {
+		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+		.colorAttachmentCount = 1,
+		.pColorAttachments = &color_reference,
+		.pDepthStencilAttachment = &depth_reference,
+	};
+	VkRenderPassCreateInfo render_pass_create_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+		.attachmentCount = uint32_t(std::size(attachments)),
+		.pAttachments = attachments,
+		.subpassCount = 1,
+		.pSubpasses = &subpass,
+	};
+	VkRenderPass render_pass = VK_NULL_HANDLE;
+	VkResult error = vkCreateRenderPass(device, &render_pass_create_info, nullptr, &render_pass);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	PipelineParams depth_params = {
+		.vertex_shader_path = gcgLoadShaderFilePath("assets/shaders_vk/depth.vert"),
+		.polygon_mode = VK_POLYGON_MODE_FILL,
+		.position_only = true,
+	};
+	for (VertexLayout layout : {VertexLayout::Full, VertexLayout::Compact})
+	{
+		depth_params.vertex_layout = layout;
+		for (VkCullModeFlags mode : culling_modes)
+		{
+			depth_params.culling_mode = mode;
+			depth_pipelines[size_t(layout)].push_back(createVkPrepassPipeline(device, render_pass, prepass_layout, prepass_extent, depth_params));
+		}
+
+		for (size_t s = 0; s < shader_params.size(); s++)
+		{
+			if (shader_params[s].vertex_shader_path.empty())
+				continue;
+			PipelineParams params = shader_params[s];
+			params.vertex_layout = layout;
+			params.polygon_mode = VK_POLYGON_MODE_FILL;
+			params.depth_equal = true;
+			for (VkCullModeFlags mode : culling_modes)
+			{
+				params.culling_mode = mode;
+				equal_pipelines[s][size_t(layout)].push_back(createVkPrepassPipeline(device, render_pass, prepass_layout, prepass_extent, params));
+			}
+		}
+	}
+	vkDestroyRenderPass(device, render_pass, nullptr);
+}
+
+void PipelineMatrixManager::destroy_prepass_pipelines(VkDevice device)
+{
+	for (auto &&pipelines : depth_pipelines)
+	{
+		for (VkPipeline pipeline : pipelines)
+		{
+			vkDestroyPipeline(device, pipeline, nullptr);
+		}
+		pipelines.clear();
+	}
+	for (auto &&layouts : equal_pipelines)
+	{
+		for (auto &&pipelines : layouts)
+		{
+			for (VkPipeline pipeline : pipelines)
+			{
+				vkDestroyPipeline(device, pipeline, nullptr);
+			}
+			pipelines.clear();
+		}
+	}
 }
 
 void PipelineMatrixManager::destroy(VkDevice device)
 {
-	destroyVkPipelineMatrix(matrix[0]);
-	destroyVkPipelineMatrix(matrix[1]);
-	destroyVkPipelineMatrix(matrix[2]);
+	for (auto &&layouts : matrix)
+	{
+		for (auto &&m : layouts)
+		{
+			destroyVkPipelineMatrix(m);
+		}
+	}
+	destroy_prepass_pipelines(device);
+	vkDestroyPipelineLayout(device, prepass_layout, nullptr);
 }
 
 void PipelineMatrixManager::set_polygon_mode(int mode)
@@ -149,6 +454,16 @@ void PipelineMatrixManager::set_shader(PipelineMatrixManager::Shader shader)
 	this->shader = shader;
 }
 
+void PipelineMatrixManager::set_vertex_layout(VertexLayout layout)
+{
+	this->vertex_layout = layout;
+}
+
+void PipelineMatrixManager::set_pass(PipelineMatrixManager::Pass pass)
+{
+	this->pass = pass;
+}
+
 void PipelineMatrixManager::update()
 {
 	auto input = Input::instance();
@@ -158,11 +473,120 @@ void PipelineMatrixManager::update()
 
 	if (input->isKeyPress(GLFW_KEY_F2))
 		set_culling_mode(culling_mode + 1);
+
+	if (input->isKeyPress(GLFW_KEY_P) && prepass_layout != VK_NULL_HANDLE)
+	{
+		depth_prepass = !depth_prepass;
+		VKL_LOG("Depth prepass " << (depth_prepass ? "enabled" : "disabled"));
+	}
+
+	// The framework reloads its own pipelines on F5, but does not know those of the prepass
+	if (input->isKeyPress(GLFW_KEY_F5) && prepass_layout != VK_NULL_HANDLE)
+	{
+		vkDeviceWaitIdle(prepass_device);
+		destroy_prepass_pipelines(prepass_device);
+		create_prepass_pipelines();
+	}
 }
 
 VkPipeline PipelineMatrixManager::selected()
 {
-	return matrix[shader][polygon_mode][culling_mode];
+	if (pass == Pass::Depth)
+		return depth_pipelines[size_t(vertex_layout)][culling_mode];
+	if (pass == Pass::Equal)
+		return equal_pipelines[shader][size_t(vertex_layout)][culling_mode];
+	return matrix[shader][size_t(vertex_layout)][polygon_mode][culling_mode];
+}
+
+VkPipelineLayout PipelineMatrixManager::bind_selected(VkCommandBuffer cmd_buffer)
+{
+	VkPipeline pipeline = selected();
+	if (pass == Pass::Standard)
+	{
+		vklCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		return vklGetLayoutForPipeline(pipeline);
+	}
+	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	return prepass_layout;
+}
+#pragma endregion
+
+#pragma region FragmentStatistics
+FragmentStatistics::FragmentStatistics(VkPhysicalDevice physical_device, VkDevice device)
+{
+	this->device = device;
+	query_prepass.fill(-1);
+
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(physical_device, &features);
+	if (!features.pipelineStatisticsQuery)
+	{
+		VKL_WARNING("Pipeline statistics queries are not supported, fragment shader invocations are not counted");
+		return;
+	}
+	VkQueryPoolCreateInfo query_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = QUERY_COUNT,
+		.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+	};
+	VkResult error = vkCreateQueryPool(device, &query_pool_create_info, nullptr, &query_pool);
+	VKL_CHECK_VULKAN_ERROR(error);
+}
+
+void FragmentStatistics::reset(VkCommandBuffer compute_cmd_buffer)
+{
+	if (query_pool == VK_NULL_HANDLE)
+		return;
+	uint32_t query = frame % QUERY_COUNT;
+	if (query_prepass[query] != -1)
+	{
+		// A frame still in flight keeps the previous result
+		uint64_t result = 0;
+		VkResult error = vkGetQueryPoolResults(device, query_pool, query, 1, sizeof(result), &result, sizeof(result), VK_QUERY_RESULT_64_BIT);
+		if (error == VK_SUCCESS)
+		{
+			invocations[query_prepass[query]] = result;
+			measured[query_prepass[query]] = true;
+		}
+	}
+	vkCmdResetQueryPool(compute_cmd_buffer, query_pool, query, 1);
+	query_prepass[query] = -1;
+}
+
+void FragmentStatistics::begin(VkCommandBuffer cmd_buffer, bool depth_prepass)
+{
+	if (query_pool == VK_NULL_HANDLE)
+		return;
+	uint32_t query = frame % QUERY_COUNT;
+	query_prepass[query] = depth_prepass ? 1 : 0;
+	vkCmdBeginQuery(cmd_buffer, query_pool, query, 0);
+}
+
+void FragmentStatistics::end(VkCommandBuffer cmd_buffer)
+{
+	if (query_pool == VK_NULL_HANDLE)
+		return;
+	vkCmdEndQuery(cmd_buffer, query_pool, frame % QUERY_COUNT);
+	frame++;
+}
+
+void FragmentStatistics::log()
+{
+	if (query_pool == VK_NULL_HANDLE)
+		return;
+	if (measured[0])
+		VKL_LOG("Fragment shader invocations without depth prepass: " << invocations[0]);
+	if (measured[1])
+		VKL_LOG("Fragment shader invocations with depth prepass: " << invocations[1]);
+	if (measured[0] && measured[1])
+		VKL_LOG("Depth prepass saves " << int64_t(invocations[0]) - int64_t(invocations[1]) << " fragment shader invocations");
+}
+
+void FragmentStatistics::destroy(VkDevice device)
+{
+	if (query_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(device, query_pool, nullptr);
 }
 #pragma endregion
 
@@ -12,17 +12,35 @@
 #include <memory>
 #include <array>
 
+enum class VertexLayout
+{
+	// float32 attributes, see Vertex
+	Full,
+	// quantized attributes without per vertex color, see CompactPosition and CompactVertexAttributes
+	Compact
+};
+
 struct PipelineParams
 {
 	std::string vertex_shader_path;
 	std::string fragment_shader_path;
 	VkPolygonMode polygon_mode;
 	VkCullModeFlags culling_mode;
+	VertexLayout vertex_layout = VertexLayout::Full;
+	// Only vertex stream 0 is read, for depth only passes whose shaders consume nothing but the position
+	bool position_only = false;
+	// Depth test EQUAL without depth writes, for the color pass after a depth prepass
+	bool depth_equal = false;
 };
 
+// Vertex stream 0 holds positions, stream 1 the remaining attributes and for compact meshes stream 2 the mesh color
+void describeVertexInput(VertexLayout layout, bool position_only, std::vector<VkVertexInputBindingDescription> &buffers, std::vector<VkVertexInputAttributeDescription> &attributes);
 VkPipeline createVkPipeline(PipelineParams &params);
 std::vector<std::vector<VkPipeline>> createVkPipelineMatrix(PipelineParams &params, std::vector<VkPolygonMode> &polygonModes, std::vector<VkCullModeFlags> &cullingModes);
 void destroyVkPipelineMatrix(std::vector<std::vector<VkPipeline>> matrix);
+// The framework's pipelines always test LESS and write depth, so those of a depth prepass are created manually.
+// render_pass only has to be compatible with the framework's one. Without a fragment shader, nothing but depth is written.
+VkPipeline createVkPrepassPipeline(VkDevice device, VkRenderPass render_pass, VkPipelineLayout layout, VkExtent2D extent, PipelineParams &params);
 
 class PipelineMatrixManager : public ITrash
 {
@@ -33,6 +51,13 @@ public:
 		Gouraud,
 		Box
 	};
+	// Standard draws in a single pass, with a depth prepass the frame is drawn with Depth and then with Equal
+	enum class Pass
+	{
+		Standard,
+		Depth,
+		Equal
+	};
 
 private:
 	std::vector<VkPolygonMode> polygon_modes = std::vector<VkPolygonMode>({
@@ -47,18 +72,89 @@ private:
 	int polygon_mode = 0;
 	int culling_mode = 0;
 	Shader shader = Shader::Phong;
-	std::array<std::vector<std::vector<VkPipeline>>, 3> matrix;
+	VertexLayout vertex_layout = VertexLayout::Full;
+	// indexed by shader and vertex layout
+	std::array<std::array<std::vector<std::vector<VkPipeline>>, 2>, 3> matrix;
+	std::array<PipelineParams, 3> shader_params;
+
+	Pass pass = Pass::Standard;
+	bool depth_prepass = false;
+	// shared by all prepass pipelines, compatible with the layout of the framework's pipelines
+	VkPipelineLayout prepass_layout = VK_NULL_HANDLE;
+	// indexed by vertex layout and culling mode
+	std::array<std::vector<VkPipeline>, 2> depth_pipelines;
+	// indexed by shader, vertex layout and culling mode
+	std::array<std::array<std::vector<VkPipeline>, 2>, 3> equal_pipelines;
+	// kept to recreate the prepass pipelines when the shaders are reloaded
+	VkDevice prepass_device = VK_NULL_HANDLE;
+	VkFormat prepass_color_format = VK_FORMAT_UNDEFINED;
+	VkFormat prepass_depth_format = VK_FORMAT_UNDEFINED;
+	VkExtent2D prepass_extent = {};
+
+	void create_prepass_pipelines();
+	void destroy_prepass_pipelines(VkDevice device);
 
 public:
 	PipelineMatrixManager();
 
 	void load(Shader shader, std::string vshName, std::string fshName);
+	// Creates the pipelines of the depth prepass for the loaded shaders.
+	// The formats and extent are those of the framework's attachments, descriptor_layout the one of the instances.
+	// Like the framework's pipelines, they are recreated from the shader files when F5 is pressed.
+	void init_depth_prepass(VkDevice device, VkFormat color_format, VkFormat depth_format, VkExtent2D extent, VkDescriptorSetLayout descriptor_layout, bool enabled);
+	// Lines do not hide what lies behind them, so wireframes are drawn without prepass
+	bool uses_depth_prepass()
+	{
+		return depth_prepass && polygon_modes[polygon_mode] == VK_POLYGON_MODE_FILL;
+	}
 	void destroy(VkDevice device);
 	void set_polygon_mode(int mode);
 	void set_culling_mode(int mode);
 	void set_shader(Shader shader);
+	void set_vertex_layout(VertexLayout layout);
+	void set_pass(Pass pass);
+	Pass get_pass()
+	{
+		return pass;
+	}
+	VkCullModeFlags get_culling_mode()
+	{
+		return culling_modes[culling_mode];
+	}
 	void update();
 	VkPipeline selected();
+	// Binds the selected pipeline and returns its layout
+	VkPipelineLayout bind_selected(VkCommandBuffer cmd_buffer);
+};
+
+// Counts the fragment shader invocations of the frames with a pipeline statistics query.
+// The framework's command buffer is inside its render pass from the start, so queries are reset in the compute command
+// buffer. Every frame uses a query of a ring, which is read back without waiting before it is reset again.
+class FragmentStatistics : public ITrash
+{
+private:
+	static const uint32_t QUERY_COUNT = 4;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueryPool query_pool = VK_NULL_HANDLE;
+	uint32_t frame = 0;
+	// whether the frame of a query was drawn with depth prepass, unset if the query was not used yet
+	std::array<int, QUERY_COUNT> query_prepass;
+	// latest results, indexed by with or without depth prepass
+	std::array<uint64_t, 2> invocations = {};
+	std::array<bool, 2> measured = {};
+
+public:
+	// Does nothing if the device lacks the pipelineStatisticsQuery feature
+	FragmentStatistics(VkPhysicalDevice physical_device, VkDevice device);
+
+	// Reads the result of the query of this frame from its previous use and resets it
+	void reset(VkCommandBuffer compute_cmd_buffer);
+	void begin(VkCommandBuffer cmd_buffer, bool depth_prepass);
+	void end(VkCommandBuffer cmd_buffer);
+	// Logs the invocations with and without depth prepass, each is measured while it is in use
+	void log();
+	void destroy(VkDevice device);
 };
 
 std::unique_ptr<PipelineMatrixManager> createPipelineManager(INIReader renderer_reader);
\ No newline at end of file
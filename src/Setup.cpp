@@ -95,29 +95,66 @@ VkPhysicalDevice createVkPhysicalDevice(VkInstance vkInstance, VkSurfaceKHR vkSu
 	return physicalDevices[index];
 }
 
-VkDevice createVkDevice(VkPhysicalDevice vkPhysicalDevice, uint32_t queueFamily)
+bool hasDeviceExtension(VkPhysicalDevice vkPhysicalDevice, const char *extensionName)
+{
+	uint32_t extensionCount = 0;
+	VkResult error = vkEnumerateDeviceExtensionProperties(vkPhysicalDevice, nullptr, &extensionCount, nullptr);
+	VKL_CHECK_VULKAN_ERROR(error);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	error = vkEnumerateDeviceExtensionProperties(vkPhysicalDevice, nullptr, &extensionCount, extensions.data());
+	VKL_CHECK_VULKAN_ERROR(error);
+	return std::any_of(extensions.begin(), extensions.end(), [&](const VkExtensionProperties &e)
+					   { return std::string(e.extensionName) == extensionName; });
+}
+
+VkDevice createVkDevice(VkPhysicalDevice vkPhysicalDevice, uint32_t queueFamily, uint32_t transferQueueFamily)
 {
 	float queuePriority = 1.0f;
-	std::vector<const char *> requiredDeviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME};
-	const VkDeviceQueueCreateInfo queueCreateInfo = {
+	std::vector<const char *> requiredDeviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME};
+	// optional, without it GPU culling draws culled commands with zero indices
+	if (hasDeviceExtension(vkPhysicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+		requiredDeviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos = {{
 		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
 		.queueFamilyIndex = queueFamily,
 		.queueCount = 1,
 		.pQueuePriorities = &queuePriority,
-	};
+	}};
+	if (transferQueueFamily != queueFamily)
+	{
+		queueCreateInfos.push_back({
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = transferQueueFamily,
+			.queueCount = 1,
+			.pQueuePriorities = &queuePriority,
+		});
+	}
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(vkPhysicalDevice, &supportedFeatures);
 	const VkPhysicalDeviceFeatures deviceFeatures = {
+		// optional, without it indirect draws are issued one at a time
+		.multiDrawIndirect = supportedFeatures.multiDrawIndirect,
 		.fillModeNonSolid = VK_TRUE,
+		// optional, samplers fall back to isotropic filtering without it
+		.samplerAnisotropy = supportedFeatures.samplerAnisotropy,
+		// optional, fragment shader invocations are only counted with it
+		.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery,
 	};
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.enabledExtensionCount = requiredDeviceExtensions.size();
 	deviceCreateInfo.ppEnabledExtensionNames = &requiredDeviceExtensions.front();
-	deviceCreateInfo.queueCreateInfoCount = 1;
-	deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+	deviceCreateInfo.queueCreateInfoCount = queueCreateInfos.size();
+	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
+	VkPhysicalDeviceTimelineSemaphoreFeatures vk_timeline_feature = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+		.timelineSemaphore = VK_TRUE,
+	};
 	const VkPhysicalDeviceSynchronization2Features vk_sync_feature = {
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES,
+		.pNext = &vk_timeline_feature,
 		.synchronization2 = VK_TRUE,
 	};
 	deviceCreateInfo.pNext = &vk_sync_feature;
@@ -307,6 +344,37 @@ uint32_t selectQueueFamilyIndex(VkPhysicalDevice physical_device, VkSurfaceKHR s
 	VKL_EXIT_WITH_ERROR("Unable to find a suitable queue family that supports graphics and presentation on the same queue.");
 }
 
+uint32_t selectTransferQueueFamilyIndex(VkPhysicalDevice physical_device, uint32_t graphics_queue_family)
+{
+	uint32_t queue_family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families.data());
+
+	uint32_t selected = graphics_queue_family;
+	int selected_rank = 0;
+	for (uint32_t queue_family_index = 0u; queue_family_index < queue_family_count; ++queue_family_index)
+	{
+		const VkQueueFamilyProperties &properties = queue_families[queue_family_index];
+		VkExtent3D granularity = properties.minImageTransferGranularity;
+		if (queue_family_index == graphics_queue_family || (properties.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0)
+			continue;
+		// Every queue supports transfers, even if only the graphics or compute bit is set
+		if ((properties.queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) == 0)
+			continue;
+		if (granularity.width != 1 || granularity.height != 1 || granularity.depth != 1)
+			continue;
+
+		int rank = (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) == 0 ? 2 : 1;
+		if (rank > selected_rank)
+		{
+			selected = queue_family_index;
+			selected_rank = rank;
+		}
+	}
+	return selected;
+}
+
 VkSurfaceFormatKHR getSurfaceImageFormat(VkPhysicalDevice physical_device, VkSurfaceKHR surface)
 {
 	VkResult result;
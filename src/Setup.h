@@ -46,6 +46,14 @@ uint32_t selectPhysicalDeviceIndex(const std::vector<VkPhysicalDevice> &physical
  */
 uint32_t selectQueueFamilyIndex(VkPhysicalDevice physical_device, VkSurfaceKHR surface);
 
+/*!
+ *	Select a queue family for uploads which runs independently of the graphics queue family.
+ *	A family with only transfer capabilities is preferred, then one without graphics capabilities.
+ *	Families which cannot copy single texels of small mip levels are skipped.
+ *	@return		The index of the transfer queue family, or graphics_queue_family if there is no other suitable family.
+ */
+uint32_t selectTransferQueueFamilyIndex(VkPhysicalDevice physical_device, uint32_t graphics_queue_family);
+
 /*!
  *	Based on the given physical device and the surface, a the physical device's surface capabilites are read and returned.
  *	@return		VkSurfaceCapabilitiesKHR data
@@ -75,6 +83,8 @@ GLFWwindow *createGLFWWindow();
 VkInstance createVkInstance();
 VkSurfaceKHR createVkSurface(VkInstance vkInstance, GLFWwindow *window);
 VkPhysicalDevice createVkPhysicalDevice(VkInstance vkInstance, VkSurfaceKHR vkSurface);
-VkDevice createVkDevice(VkPhysicalDevice vkPhysicalDevice, uint32_t queueFamily);
+// True if the physical device supports the device extension
+bool hasDeviceExtension(VkPhysicalDevice vkPhysicalDevice, const char *extensionName);
+VkDevice createVkDevice(VkPhysicalDevice vkPhysicalDevice, uint32_t queueFamily, uint32_t transferQueueFamily);
 VkSwapchainKHR createVkSwapchain(VkPhysicalDevice vkPhysicalDevice, VkDevice vkDevice, VkSurfaceKHR vkSurface, VkSurfaceFormatKHR vkSurfaceImageFormat, GLFWwindow *window, uint32_t queueFamily, std::vector<VkDetailedImage> &colorAttachments, VkDetailedImage *depthAttachment);
 VklSwapchainConfig createVklSwapchainConfig(VkSwapchainKHR vkSwapchain, std::vector<VkDetailedImage> &colorAttachments, VkDetailedImage &depthAttachment);
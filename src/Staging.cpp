@@ -0,0 +1,345 @@
+#include "Staging.h"
+#include "vulkan_ext.h"
+
+VkSemaphore createTimelineSemaphore(VkDevice device)
+{
+	VkSemaphoreTypeCreateInfo semaphore_type_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0,
+	};
+	VkSemaphoreCreateInfo semaphore_create_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &semaphore_type_create_info,
+	};
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	VkResult error = vkCreateSemaphore(device, &semaphore_create_info, nullptr, &semaphore);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return semaphore;
+}
+
+VkCommandPool createUploadCommandPool(VkDevice device, uint32_t queue_family)
+{
+	VkCommandPoolCreateInfo command_pool_create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = queue_family,
+	};
+	VkCommandPool command_pool = VK_NULL_HANDLE;
+	VkResult error = vkCreateCommandPool(device, &command_pool_create_info, nullptr, &command_pool);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return command_pool;
+}
+
+VkCommandBuffer allocateUploadCommandBuffer(VkDevice device, VkCommandPool command_pool)
+{
+	VkCommandBufferAllocateInfo command_buffer_alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+	VkResult error = vkAllocateCommandBuffers(device, &command_buffer_alloc_info, &cmd_buffer);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return cmd_buffer;
+}
+
+#pragma region StagingBuffer
+StagingBuffer::StagingBuffer(VkPhysicalDevice physical_device, VkDevice device, VkQueue transfer_queue, uint32_t transfer_family, VkQueue graphics_queue, uint32_t graphics_family, VkDeviceSize capacity)
+{
+	this->physical_device = physical_device;
+	this->device = device;
+	this->transfer_queue = transfer_queue;
+	this->transfer_family = transfer_family;
+	this->graphics_queue = graphics_queue;
+	this->graphics_family = graphics_family;
+
+	command_pool = createUploadCommandPool(device, transfer_family);
+	transfer_timeline = createTimelineSemaphore(device);
+	if (separate_queues())
+	{
+		graphics_command_pool = createUploadCommandPool(device, graphics_family);
+		graphics_timeline = createTimelineSemaphore(device);
+	}
+
+	staging = create_mapped_buffer(capacity);
+
+	VkDeviceSize page_size = capacity / pages.size();
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		Page &page = pages[i];
+		page.begin = page_size * i;
+		page.end = page.begin + page_size;
+		page.head = page.begin;
+		page.cmd_buffer = allocateUploadCommandBuffer(device, command_pool);
+		if (separate_queues())
+			page.graphics_cmd_buffer = allocateUploadCommandBuffer(device, graphics_command_pool);
+	}
+}
+
+StagingBuffer::MappedBuffer StagingBuffer::create_mapped_buffer(VkDeviceSize size)
+{
+	MappedBuffer result = {};
+	VkBufferCreateInfo buffer_create_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	VkResult error = vkCreateBuffer(device, &buffer_create_info, nullptr, &result.buffer);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	VkMemoryRequirements memory_requirements = {};
+	vkGetBufferMemoryRequirements(device, result.buffer, &memory_requirements);
+	VkMemoryAllocateInfo memory_alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = memory_requirements.size,
+		.memoryTypeIndex = findMemoryTypeIndex(physical_device, memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+	};
+	error = vkAllocateMemory(device, &memory_alloc_info, nullptr, &result.memory);
+	VKL_CHECK_VULKAN_ERROR(error);
+	error = vkBindBufferMemory(device, result.buffer, result.memory, 0);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	void *data = nullptr;
+	error = vkMapMemory(device, result.memory, 0, VK_WHOLE_SIZE, 0, &data);
+	VKL_CHECK_VULKAN_ERROR(error);
+	result.data = static_cast<uint8_t *>(data);
+	return result;
+}
+
+void StagingBuffer::destroy_mapped_buffer(MappedBuffer &buffer)
+{
+	vkUnmapMemory(device, buffer.memory);
+	vkDestroyBuffer(device, buffer.buffer, nullptr);
+	vkFreeMemory(device, buffer.memory, nullptr);
+	buffer = {};
+}
+
+void StagingBuffer::begin_page(Page &page)
+{
+	wait_page(page);
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	VkResult error = vkBeginCommandBuffer(page.cmd_buffer, &begin_info);
+	VKL_CHECK_VULKAN_ERROR(error);
+	if (separate_queues())
+	{
+		error = vkBeginCommandBuffer(page.graphics_cmd_buffer, &begin_info);
+		VKL_CHECK_VULKAN_ERROR(error);
+	}
+	page.state = PageState::Recording;
+}
+
+void StagingBuffer::submit_page(Page &page)
+{
+	if (page.state != PageState::Recording)
+		return;
+
+	VkResult error = vkEndCommandBuffer(page.cmd_buffer);
+	VKL_CHECK_VULKAN_ERROR(error);
+	page.serial = ++submitted_serial;
+	VkCommandBufferSubmitInfo cmd_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+		.commandBuffer = page.cmd_buffer,
+	};
+	VkSemaphoreSubmitInfo signal_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+		.semaphore = transfer_timeline,
+		.value = page.serial,
+		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+	};
+	VkSubmitInfo2 submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+		.commandBufferInfoCount = 1,
+		.pCommandBufferInfos = &cmd_buffer_info,
+		.signalSemaphoreInfoCount = 1,
+		.pSignalSemaphoreInfos = &signal_info,
+	};
+	error = vkQueueSubmit2KHR(transfer_queue, 1, &submit_info, VK_NULL_HANDLE);
+	VKL_CHECK_VULKAN_ERROR(error);
+
+	if (separate_queues())
+	{
+		error = vkEndCommandBuffer(page.graphics_cmd_buffer);
+		VKL_CHECK_VULKAN_ERROR(error);
+		page.graphics_pending = true;
+	}
+	page.state = PageState::Submitted;
+}
+
+void StagingBuffer::submit_graphics_pages()
+{
+	// The graphics part of a page is only submitted once its copies completed, so frames submitted to the graphics queue
+	// in the meantime never wait for the transfer queue. Pages are submitted in serial order to keep the timeline increasing.
+	uint64_t transfer_value = 0;
+	VkResult error = vkGetSemaphoreCounterValueKHR(device, transfer_timeline, &transfer_value);
+	VKL_CHECK_VULKAN_ERROR(error);
+	std::array<Page *, 2> ordered_pages = {&pages[0], &pages[1]};
+	std::sort(ordered_pages.begin(), ordered_pages.end(), [](Page *a, Page *b)
+			  { return a->serial < b->serial; });
+	for (auto &&page : ordered_pages)
+	{
+		if (!page->graphics_pending)
+			continue;
+		if (page->serial > transfer_value)
+			break;
+
+		VkCommandBufferSubmitInfo cmd_buffer_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+			.commandBuffer = page->graphics_cmd_buffer,
+		};
+		VkSemaphoreSubmitInfo wait_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+			.semaphore = transfer_timeline,
+			.value = page->serial,
+			.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		};
+		VkSemaphoreSubmitInfo signal_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+			.semaphore = graphics_timeline,
+			.value = page->serial,
+			.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		};
+		VkSubmitInfo2 submit_info = {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+			.waitSemaphoreInfoCount = 1,
+			.pWaitSemaphoreInfos = &wait_info,
+			.commandBufferInfoCount = 1,
+			.pCommandBufferInfos = &cmd_buffer_info,
+			.signalSemaphoreInfoCount = 1,
+			.pSignalSemaphoreInfos = &signal_info,
+		};
+		error = vkQueueSubmit2KHR(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
+		VKL_CHECK_VULKAN_ERROR(error);
+		page->graphics_pending = false;
+	}
+}
+
+void StagingBuffer::wait_timeline(VkSemaphore timeline, uint64_t value)
+{
+	VkSemaphoreWaitInfo wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.semaphoreCount = 1,
+		.pSemaphores = &timeline,
+		.pValues = &value,
+	};
+	VkResult error = vkWaitSemaphoresKHR(device, &wait_info, UINT64_MAX);
+	VKL_CHECK_VULKAN_ERROR(error);
+}
+
+void StagingBuffer::wait_page(Page &page)
+{
+	if (page.state == PageState::Submitted)
+	{
+		if (page.graphics_pending)
+		{
+			wait_timeline(transfer_timeline, page.serial);
+			submit_graphics_pages();
+		}
+		wait_timeline(separate_queues() ? graphics_timeline : transfer_timeline, page.serial);
+		VkResult error = vkResetCommandBuffer(page.cmd_buffer, 0);
+		VKL_CHECK_VULKAN_ERROR(error);
+		if (separate_queues())
+		{
+			error = vkResetCommandBuffer(page.graphics_cmd_buffer, 0);
+			VKL_CHECK_VULKAN_ERROR(error);
+		}
+		page.state = PageState::Idle;
+	}
+	if (page.state == PageState::Idle)
+	{
+		for (auto &&buffer : page.dedicated)
+		{
+			destroy_mapped_buffer(buffer);
+		}
+		page.dedicated.clear();
+		page.head = page.begin;
+	}
+}
+
+StagingBuffer::Allocation StagingBuffer::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (pages[current].state != PageState::Recording)
+		begin_page(pages[current]);
+
+	Page *page = &pages[current];
+	if (size > page->end - page->begin)
+	{
+		MappedBuffer dedicated = create_mapped_buffer(size);
+		page->dedicated.push_back(dedicated);
+		return {dedicated.buffer, 0, dedicated.data};
+	}
+
+	VkDeviceSize offset = (page->head + alignment - 1) / alignment * alignment;
+	if (offset + size > page->end)
+	{
+		submit_page(*page);
+		current = (current + 1) % pages.size();
+		page = &pages[current];
+		begin_page(*page);
+		offset = (page->head + alignment - 1) / alignment * alignment;
+	}
+	page->head = offset + size;
+	return {staging.buffer, offset, staging.data + offset};
+}
+
+StagingBuffer::Commands StagingBuffer::commands()
+{
+	if (pages[current].state != PageState::Recording)
+		begin_page(pages[current]);
+	Page &page = pages[current];
+	return {
+		.transfer = page.cmd_buffer,
+		.graphics = separate_queues() ? page.graphics_cmd_buffer : page.cmd_buffer,
+		.transfer_family = transfer_family,
+		.graphics_family = graphics_family,
+	};
+}
+
+uint64_t StagingBuffer::submit()
+{
+	if (pages[current].state == PageState::Recording)
+	{
+		submit_page(pages[current]);
+		// Continue in the other page, so the next allocation does not wait for this submission
+		current = (current + 1) % pages.size();
+	}
+	return submitted_serial;
+}
+
+bool StagingBuffer::is_complete(uint64_t serial)
+{
+	if (separate_queues())
+		submit_graphics_pages();
+	uint64_t value = 0;
+	VkResult error = vkGetSemaphoreCounterValueKHR(device, separate_queues() ? graphics_timeline : transfer_timeline, &value);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return value >= serial;
+}
+
+void StagingBuffer::flush()
+{
+	submit_page(pages[current]);
+	for (auto &&page : pages)
+	{
+		wait_page(page);
+	}
+}
+
+void StagingBuffer::destroy(VkDevice device)
+{
+	flush();
+	vkDestroySemaphore(device, transfer_timeline, nullptr);
+	vkDestroyCommandPool(device, command_pool, nullptr);
+	if (separate_queues())
+	{
+		vkDestroySemaphore(device, graphics_timeline, nullptr);
+		vkDestroyCommandPool(device, graphics_command_pool, nullptr);
+	}
+	destroy_mapped_buffer(staging);
+}
+#pragma endregion
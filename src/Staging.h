@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <VulkanLaunchpad.h>
+
+#include "MyUtils.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <array>
+
+// A timeline semaphore with the initial value 0
+VkSemaphore createTimelineSemaphore(VkDevice device);
+
+// A persistently mapped, host coherent upload buffer that is suballocated linearly.
+// The buffer is split into two pages, each with its own command buffers. When the current page is full
+// it is submitted and recording continues in the other page, which is recycled once its previous submission completed.
+// Host memory used for uploads therefore stays bounded by the capacity, no matter how much data is uploaded.
+//
+// Copies are recorded for the transfer queue. If it belongs to another family than the graphics queue, each page also
+// records a graphics command buffer for the ownership acquires and the work the transfer queue cannot do (blits).
+// Both queues signal a timeline semaphore with the serial of the page, nothing on the host waits on fences.
+class StagingBuffer : public ITrash
+{
+public:
+	struct Allocation
+	{
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		// points to the mapped memory at offset
+		uint8_t *data;
+	};
+
+	struct Commands
+	{
+		VkCommandBuffer transfer;
+		// same as transfer if both queues belong to the same family
+		VkCommandBuffer graphics;
+		uint32_t transfer_family;
+		uint32_t graphics_family;
+	};
+
+private:
+	enum class PageState
+	{
+		Idle,
+		Recording,
+		Submitted
+	};
+
+	struct MappedBuffer
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint8_t *data = nullptr;
+	};
+
+	struct Page
+	{
+		VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+		VkCommandBuffer graphics_cmd_buffer = VK_NULL_HANDLE;
+		VkDeviceSize begin = 0;
+		VkDeviceSize end = 0;
+		VkDeviceSize head = 0;
+		PageState state = PageState::Idle;
+		// number of the last submission of this page, signaled by the timeline semaphores
+		uint64_t serial = 0;
+		// the graphics command buffer waits to be submitted until the transfer part completed
+		bool graphics_pending = false;
+		// allocations which are larger than a page get their own buffer, released when the page is recycled
+		std::vector<MappedBuffer> dedicated;
+	};
+
+	VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueue transfer_queue = VK_NULL_HANDLE;
+	VkQueue graphics_queue = VK_NULL_HANDLE;
+	uint32_t transfer_family = 0;
+	uint32_t graphics_family = 0;
+	VkCommandPool command_pool = VK_NULL_HANDLE;
+	VkCommandPool graphics_command_pool = VK_NULL_HANDLE;
+	VkSemaphore transfer_timeline = VK_NULL_HANDLE;
+	VkSemaphore graphics_timeline = VK_NULL_HANDLE;
+	MappedBuffer staging = {};
+	std::array<Page, 2> pages;
+	uint32_t current = 0;
+	uint64_t submitted_serial = 0;
+
+	bool separate_queues()
+	{
+		return transfer_family != graphics_family;
+	}
+	MappedBuffer create_mapped_buffer(VkDeviceSize size);
+	void destroy_mapped_buffer(MappedBuffer &buffer);
+	void begin_page(Page &page);
+	void submit_page(Page &page);
+	void submit_graphics_pages();
+	void wait_page(Page &page);
+	void wait_timeline(VkSemaphore timeline, uint64_t value);
+
+public:
+	StagingBuffer(VkPhysicalDevice physical_device, VkDevice device, VkQueue transfer_queue, uint32_t transfer_family, VkQueue graphics_queue, uint32_t graphics_family, VkDeviceSize capacity);
+
+	// May switch pages, so the command buffers have to be queried after every allocation
+	Allocation allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+	// The command buffers of the current page, uploads from allocations of the current page are recorded into them
+	Commands commands();
+	// Submits all recorded commands without waiting, returns a serial to query their completion with is_complete
+	uint64_t submit();
+	bool is_complete(uint64_t serial);
+	// Submits all recorded commands and waits until they have completed
+	void flush();
+	void destroy(VkDevice device);
+};
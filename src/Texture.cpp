@@ -2,23 +2,81 @@
 #include "vulkan_ext.h"
 #include "Descriptors.h"
 #include "PathUtils.h"
+#include "BlockCompression.h"
+#include "Ktx2.h"
 #include <glm/glm.hpp>
 
+#include <thread>
+#include <future>
+#include <atomic>
+#include <cstring>
+
 // Why is max defined as a macro?
+#undef min
 #undef max
 
 #pragma region Texture
-Texture::Texture(VkImage image, VkFormat format, VkExtent2D extent, VkImageView view)
+Texture::Texture(VkDevice device, VkImage image, VkFormat format, VkExtent2D extent, uint32_t level_count, uint32_t resident_level, VkDeviceSize memory_size)
 {
 	this->image = image;
 	this->format = format;
 	this->extent = extent;
-	this->view = view;
+	this->level_count = level_count;
+	this->resident_level = resident_level;
+	this->memory_size = memory_size;
+	this->view = create_view(device);
+}
+
+VkImageView Texture::create_view(VkDevice device)
+{
+	VkImageView image_view = VK_NULL_HANDLE;
+	VkImageViewCreateInfo image_view_create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.flags = 0,
+		.image = image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = format,
+		.components = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY},
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = resident_level,
+			.levelCount = level_count - resident_level,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+	};
+	VkResult error = vkCreateImageView(device, &image_view_create_info, nullptr, &image_view);
+	VKL_CHECK_VULKAN_ERROR(error);
+	return image_view;
 }
 
-void Texture::init_uniforms(VkDevice device, VkDescriptorSet descriptor_set, uint32_t binding, VkSampler sampler)
+void Texture::init_uniforms(VkDevice device, std::shared_ptr<SwappableDescriptorSet> descriptor_set, uint32_t binding, VkSampler sampler)
 {
-	writeDescriptorSetImage(device, descriptor_set, binding, sampler, this->view);
+	bindings.push_back({descriptor_set, binding, sampler});
+	writeDescriptorSetImage(device, descriptor_set->get(), binding, sampler, this->view);
+}
+
+bool Texture::set_resident_level(VkDevice device, uint32_t level, FrameRetirement &frames)
+{
+	for (auto &&b : bindings)
+	{
+		if (!b.descriptor_set->can_swap(frames))
+			return false;
+	}
+
+	VkImageView old_view = this->view;
+	frames.defer([device, old_view]
+				 { vkDestroyImageView(device, old_view, nullptr); });
+	this->resident_level = level;
+	this->view = create_view(device);
+	for (auto &&b : bindings)
+	{
+		b.descriptor_set->swap(device, frames, [&](VkDescriptorSet set)
+							   { writeDescriptorSetImage(device, set, b.binding, b.sampler, this->view); });
+	}
+	if (level == 0)
+		stream_source = nullptr;
+	return true;
 }
 
 void Texture::destroy(VkDevice device)
@@ -28,17 +86,133 @@ void Texture::destroy(VkDevice device)
 }
 #pragma endregion
 
-VkImage loadImageToTexture(VkCommandBuffer vk_cmd_buf, std::vector<VklImageInfo> level_infos, std::vector<VkBuffer> level_host_bufs)
+// encoder_threads is the share of the threads this file may encode with while other files are opened next to it
+TextureFile openTextureFile(std::string path, const TextureLoadOptions &options, uint32_t encoder_threads)
+{
+	TextureFile file;
+	file.path = options.compress ? compressedDdsPath(path, encoder_threads) : path;
+	file.mapping = std::make_unique<MappedFile>(file.path);
+	if (!parseDdsHeader(file.mapping->data, file.mapping->size, file.image) && !parseKtx2Header(file.mapping->data, file.mapping->size, file.image, file.decoded))
+	{
+		VKL_EXIT_WITH_ERROR("Unsupported or corrupt texture file (Basis Universal and zlib supercompressed KTX2 files are not supported): " << file.path);
+	}
+	// The level data is copied into the staging buffer, start reading it ahead
+	if (options.stream_base_size == 0)
+		file.mapping->advise_sequential();
+	return file;
+}
+
+// Number of levels of a full mip chain down to 1x1
+uint32_t mipLevelCount(VkExtent2D extent)
+{
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(extent.width, extent.height); size > 1; size /= 2)
+	{
+		levels++;
+	}
+	return levels;
+}
+
+// Fills the levels after base_level by blitting each level into the next one.
+// All levels are in TRANSFER_DST_OPTIMAL layout before and after, the base level has to be written already.
+void generateMipLevels(VkCommandBuffer vk_cmd_buf, VkImage vk_img, VkExtent2D extent, uint32_t base_level, uint32_t level_count)
+{
+	for (uint32_t i = base_level + 1; i < level_count; i++)
+	{
+		// The previous level was written by the copy or the last blit and is read by this blit
+		VkImageMemoryBarrier2 vk_img_barrier_src = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+			.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+			.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = vk_img,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = i - 1,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+		};
+		VkDependencyInfo vk_img_dep_info_src = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.dependencyFlags = 0,
+			.imageMemoryBarrierCount = 1,
+			.pImageMemoryBarriers = &vk_img_barrier_src,
+		};
+		vkCmdPipelineBarrier2KHR(vk_cmd_buf, &vk_img_dep_info_src);
+
+		int32_t src_width = std::max(1u, extent.width >> (i - 1));
+		int32_t src_height = std::max(1u, extent.height >> (i - 1));
+		int32_t dst_width = std::max(1u, extent.width >> i);
+		int32_t dst_height = std::max(1u, extent.height >> i);
+		VkImageBlit vk_img_blit = {
+			.srcSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = i - 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+			.srcOffsets = {{0, 0, 0}, {src_width, src_height, 1}},
+			.dstSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = i,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+			.dstOffsets = {{0, 0, 0}, {dst_width, dst_height, 1}},
+		};
+		vkCmdBlitImage(vk_cmd_buf, vk_img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, vk_img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &vk_img_blit, VK_FILTER_LINEAR);
+	}
+
+	// Return the source levels to the common layout, the blits reading them have to complete first
+	if (level_count > base_level + 1)
+	{
+		VkImageMemoryBarrier2 vk_img_barrier_dst = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+			.srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+			.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = vk_img,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = base_level,
+				.levelCount = level_count - 1 - base_level,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+		};
+		VkDependencyInfo vk_img_dep_info_dst = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.dependencyFlags = 0,
+			.imageMemoryBarrierCount = 1,
+			.pImageMemoryBarriers = &vk_img_barrier_dst,
+		};
+		vkCmdPipelineBarrier2KHR(vk_cmd_buf, &vk_img_dep_info_dst);
+	}
+}
+
+// Levels from dds.levels.size() up to level_count are generated on the GPU by downsampling the previous level
+void recordTextureUpload(const StagingBuffer::Commands &cmds, VkImage vk_img, const DdsImage &dds, uint32_t first_level, uint32_t level_count, VkBuffer staging_buffer, VkDeviceSize staging_offset)
 {
-	VkImage vk_img = vklCreateDeviceLocalImageWithBackingMemory(level_infos[0].extent.width, level_infos[0].extent.height, level_infos[0].imageFormat, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-	uint32_t levelCount = level_infos.size();
+	uint32_t file_level_count = std::min(uint32_t(dds.levels.size()), level_count);
 
 	VkImageMemoryBarrier2 vk_img_barrier_first = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
 		.srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
 		.srcAccessMask = 0,
 		.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
-		.dstAccessMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+		.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
 		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
@@ -46,8 +220,8 @@ VkImage loadImageToTexture(VkCommandBuffer vk_cmd_buf, std::vector<VklImageInfo>
 		.image = vk_img,
 		.subresourceRange = {
 			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = levelCount,
+			.baseMipLevel = first_level,
+			.levelCount = level_count - first_level,
 			.baseArrayLayer = 0,
 			.layerCount = 1,
 		},
@@ -58,22 +232,67 @@ VkImage loadImageToTexture(VkCommandBuffer vk_cmd_buf, std::vector<VklImageInfo>
 		.imageMemoryBarrierCount = 1,
 		.pImageMemoryBarriers = &vk_img_barrier_first,
 	};
-	vkCmdPipelineBarrier2KHR(vk_cmd_buf, &vk_img_dep_info_first);
+	vkCmdPipelineBarrier2KHR(cmds.transfer, &vk_img_dep_info_first);
 
-	for (uint32_t i = 0; i < levelCount; i++)
+	std::vector<VkBufferImageCopy> vk_img_copy_regions;
+	VkDeviceSize buffer_offset = staging_offset;
+	for (uint32_t i = first_level; i < file_level_count; i++)
 	{
-		VkBufferImageCopy vk_img_copy_region = {
+		vk_img_copy_regions.push_back({
+			.bufferOffset = buffer_offset,
 			.imageSubresource = {
 				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 				.mipLevel = i,
 				.baseArrayLayer = 0,
 				.layerCount = 1,
 			},
-			.imageExtent = {.width = level_infos[i].extent.width, .height = level_infos[i].extent.height, .depth = 1},
+			.imageExtent = {.width = dds.levels[i].extent.width, .height = dds.levels[i].extent.height, .depth = 1},
+		});
+		buffer_offset += dds.levels[i].size;
+	}
+	vkCmdCopyBufferToImage(cmds.transfer, staging_buffer, vk_img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(vk_img_copy_regions.size()), vk_img_copy_regions.data());
+
+	if (cmds.transfer_family != cmds.graphics_family)
+	{
+		// Hand the image over to the graphics queue, which generates the remaining levels and samples it
+		VkImageMemoryBarrier2 vk_img_barrier_ownership = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+			.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+			.dstAccessMask = 0,
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.srcQueueFamilyIndex = cmds.transfer_family,
+			.dstQueueFamilyIndex = cmds.graphics_family,
+			.image = vk_img,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = first_level,
+				.levelCount = level_count - first_level,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
 		};
-		vkCmdCopyBufferToImage(vk_cmd_buf, level_host_bufs[i], vk_img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &vk_img_copy_region);
+		VkDependencyInfo vk_img_dep_info_ownership = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.dependencyFlags = 0,
+			.imageMemoryBarrierCount = 1,
+			.pImageMemoryBarriers = &vk_img_barrier_ownership,
+		};
+		vkCmdPipelineBarrier2KHR(cmds.transfer, &vk_img_dep_info_ownership);
+
+		// The acquire repeats the release, only the synchronization scopes are swapped
+		vk_img_barrier_ownership.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		vk_img_barrier_ownership.srcAccessMask = 0;
+		vk_img_barrier_ownership.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		vk_img_barrier_ownership.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier2KHR(cmds.graphics, &vk_img_dep_info_ownership);
 	}
 
+	if (level_count > file_level_count)
+		generateMipLevels(cmds.graphics, vk_img, dds.extent, file_level_count - 1, level_count);
+
 	VkImageMemoryBarrier2 vk_img_barrier_second = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
 		.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
@@ -87,8 +306,8 @@ VkImage loadImageToTexture(VkCommandBuffer vk_cmd_buf, std::vector<VklImageInfo>
 		.image = vk_img,
 		.subresourceRange = {
 			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = levelCount,
+			.baseMipLevel = first_level,
+			.levelCount = level_count - first_level,
 			.baseArrayLayer = 0,
 			.layerCount = 1,
 		},
@@ -99,123 +318,260 @@ VkImage loadImageToTexture(VkCommandBuffer vk_cmd_buf, std::vector<VklImageInfo>
 		.imageMemoryBarrierCount = 1,
 		.pImageMemoryBarriers = &vk_img_barrier_second,
 	};
-	vkCmdPipelineBarrier2KHR(vk_cmd_buf, &vk_img_dep_info_second);
+	vkCmdPipelineBarrier2KHR(cmds.graphics, &vk_img_dep_info_second);
+}
 
-	return vk_img;
+std::vector<std::shared_ptr<Texture>> createTextureImages(VkDevice vk_device, StagingBuffer &staging, std::vector<std::string> names)
+{
+	std::vector<std::string> paths;
+	for (auto &&name : names)
+	{
+		paths.push_back(gcgFindTextureFile("assets/textures/" + name));
+	}
+	return createTextureImagesFromPaths(vk_device, staging, paths);
 }
 
-std::vector<std::shared_ptr<Texture>> createTextureImages(VkDevice vk_device, VkQueue vk_queue, uint32_t queue_family, std::vector<std::string> names)
+std::vector<std::shared_ptr<Texture>> createTextureImagesFromPaths(VkDevice vk_device, StagingBuffer &staging, std::vector<std::string> paths, TextureLoadOptions options)
 {
-	VkCommandPool vk_img_cmd_pool = VK_NULL_HANDLE;
-	VkCommandPoolCreateInfo vk_img_cmd_pool_create_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
-		.queueFamilyIndex = queue_family,
+	// Worker threads map and parse the files in order while this thread records the uploads
+	std::vector<std::promise<TextureFile>> file_promises(paths.size());
+	std::vector<std::future<TextureFile>> file_futures;
+	for (auto &&promise : file_promises)
+	{
+		file_futures.push_back(promise.get_future());
+	}
+	std::atomic<size_t> next_file = 0;
+	size_t worker_count = std::min(std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8), paths.size());
+	// The workers share the cores when they encode files, instead of each spawning a thread per core
+	uint32_t encoder_threads = std::max(1u, uint32_t(std::thread::hardware_concurrency() / std::max<size_t>(worker_count, 1)));
+	auto read_files = [&]()
+	{
+		for (size_t i = next_file++; i < paths.size(); i = next_file++)
+		{
+			file_promises[i].set_value(openTextureFile(paths[i], options, encoder_threads));
+		}
 	};
-	VkResult error = vkCreateCommandPool(vk_device, &vk_img_cmd_pool_create_info, nullptr, &vk_img_cmd_pool);
-	VKL_CHECK_VULKAN_ERROR(error);
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < worker_count; i++)
+	{
+		workers.emplace_back(read_files);
+	}
 
-	VkCommandBuffer vk_img_cmd_buf = VK_NULL_HANDLE;
-	VkCommandBufferAllocateInfo vk_img_cmd_buf_alloc_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.commandPool = vk_img_cmd_pool,
-		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = 1,
-	};
-	error = vkAllocateCommandBuffers(vk_device, &vk_img_cmd_buf_alloc_info, &vk_img_cmd_buf);
-	VKL_CHECK_VULKAN_ERROR(error);
+	std::vector<std::shared_ptr<Texture>> result;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		TextureFile file = file_futures[i].get();
+		const DdsImage &dds = file.image;
 
-	VkCommandBufferBeginInfo vk_img_cmd_buf_begin_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.flags = 0,
-	};
-	error = vkBeginCommandBuffer(vk_img_cmd_buf, &vk_img_cmd_buf_begin_info);
-	VKL_CHECK_VULKAN_ERROR(error);
+		// Files without a full mip chain only ship the first levels, the rest is generated with blits.
+		// Block compressed formats cannot be blit destinations, they keep the levels of the file.
+		uint32_t level_count = uint32_t(dds.levels.size());
+		if (!ddsIsBlockCompressed(dds.format))
+			level_count = std::max(level_count, mipLevelCount(dds.extent));
+		VkDeviceSize memory_size = 0;
+		for (uint32_t level = 0; level < level_count; level++)
+		{
+			memory_size += ddsLevelSize(dds.format, {std::max(1u, dds.extent.width >> level), std::max(1u, dds.extent.height >> level)});
+		}
 
-	std::vector<VkBuffer> host_buffers;
-	std::vector<std::shared_ptr<Texture>> result;
+		// When streaming, the finest levels of the file are skipped until the first one within the base size
+		uint32_t first_level = 0;
+		while (options.stream_base_size != 0 && first_level + 1 < dds.levels.size() &&
+			   std::max(dds.levels[first_level].extent.width, dds.levels[first_level].extent.height) > options.stream_base_size)
+		{
+			first_level++;
+		}
+		size_t upload_size = 0;
+		for (uint32_t level = first_level; level < dds.levels.size(); level++)
+		{
+			upload_size += dds.levels[level].size;
+		}
+
+		// Full staging pages are submitted by the allocator, so uploads overlap with the remaining reads.
+		// The level data is copied straight from the file mapping into the staging memory, packed from fine to coarse.
+		StagingBuffer::Allocation staging_alloc = staging.allocate(upload_size);
+		size_t packed_offset = 0;
+		for (uint32_t level = first_level; level < dds.levels.size(); level++)
+		{
+			std::memcpy(staging_alloc.data + packed_offset, file.level_data(dds.levels[level]), dds.levels[level].size);
+			packed_offset += dds.levels[level].size;
+		}
+		VkImage image = vklCreateDeviceLocalImageWithBackingMemory(dds.extent.width, dds.extent.height, dds.format, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+		recordTextureUpload(staging.commands(), image, dds, first_level, level_count, staging_alloc.buffer, staging_alloc.offset);
+
+		auto texture = std::make_shared<Texture>(vk_device, image, dds.format, dds.extent, level_count, first_level, memory_size);
+		if (first_level > 0)
+			texture->stream_source = std::make_unique<TextureFile>(std::move(file));
+		result.push_back(texture);
+	}
+
+	for (auto &&worker : workers)
+	{
+		worker.join();
+	}
+	staging.flush();
+	return result;
+}
+
+#pragma region TextureCache
+TextureCache::TextureCache(VkDevice device, std::shared_ptr<StagingBuffer> staging, std::shared_ptr<FrameRetirement> frames, VkDeviceSize budget, TextureLoadOptions options)
+{
+	this->device = device;
+	this->staging = staging;
+	this->frames = frames;
+	this->budget = budget;
+	this->options = options;
+}
+
+std::vector<std::shared_ptr<Texture>> TextureCache::get(std::vector<std::string> names)
+{
+	std::vector<std::string> paths;
+	std::vector<std::string> missing_paths;
 	for (auto &&name : names)
 	{
 		std::string path = gcgFindTextureFile("assets/textures/" + name);
-		VklImageInfo img_info = vklGetDdsImageInfo(path.c_str());
+		paths.push_back(path);
+		if (!entries.contains(path) && std::find(missing_paths.begin(), missing_paths.end(), path) == missing_paths.end())
+			missing_paths.push_back(path);
+	}
 
-		uint32_t mipLevels = static_cast<uint32_t>(1 + std::floor(std::log2(std::max(img_info.extent.width, img_info.extent.height))));
-		std::vector<VkBuffer> level_bufs(mipLevels);
-		std::vector<VklImageInfo> level_infos(mipLevels);
-		for (size_t i = 0; i < mipLevels; i++)
+	if (!missing_paths.empty())
+	{
+		auto loaded = createTextureImagesFromPaths(device, *staging, missing_paths, options);
+		for (size_t i = 0; i < loaded.size(); i++)
 		{
-			level_infos[i] = vklGetDdsImageLevelInfo(path.c_str(), i);
-			level_bufs[i] = vklLoadDdsImageLevelIntoHostCoherentBuffer(path.c_str(), i);
-			host_buffers.push_back(level_bufs[i]);
+			entries[missing_paths[i]] = {loaded[i], 0};
+			resident_size += loaded[i]->get_memory_size();
 		}
-		VkImage image = loadImageToTexture(vk_img_cmd_buf, level_infos, level_bufs);
-
-		VkImageView image_view = VK_NULL_HANDLE;
-		VkImageViewCreateInfo image_view_create_info = {
-			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-			.flags = 0,
-			.image = image,
-			.viewType = VK_IMAGE_VIEW_TYPE_2D,
-			.format = img_info.imageFormat,
-			.components = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY},
-			.subresourceRange = {
-				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-				.baseMipLevel = 0,
-				.levelCount = mipLevels,
-				.baseArrayLayer = 0,
-				.layerCount = 1,
-			},
-		};
-		error = vkCreateImageView(vk_device, &image_view_create_info, nullptr, &image_view);
-		VKL_CHECK_VULKAN_ERROR(error);
+	}
 
-		result.push_back(std::make_shared<Texture>(image, img_info.imageFormat, img_info.extent, image_view));
+	std::vector<std::shared_ptr<Texture>> result;
+	for (auto &&path : paths)
+	{
+		Entry &entry = entries[path];
+		entry.last_use = ++use_counter;
+		result.push_back(entry.texture);
 	}
-	error = vkEndCommandBuffer(vk_img_cmd_buf);
-	VKL_CHECK_VULKAN_ERROR(error);
 
-	VkFence vk_img_fence = VK_NULL_HANDLE;
-	VkFenceCreateInfo vk_img_fence_create_info = {
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-		.flags = 0,
-	};
-	error = vkCreateFence(vk_device, &vk_img_fence_create_info, nullptr, &vk_img_fence);
-	VKL_CHECK_VULKAN_ERROR(error);
+	trim();
+	return result;
+}
 
-	VkSubmitInfo vk_img_submit_info = {
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &vk_img_cmd_buf,
-	};
+std::shared_ptr<Texture> TextureCache::get(std::string name)
+{
+	return get(std::vector<std::string>{name})[0];
+}
 
-	error = vkQueueSubmit(vk_queue, 1, &vk_img_submit_info, vk_img_fence);
-	VKL_CHECK_VULKAN_ERROR(error);
+void TextureCache::trim()
+{
+	if (resident_size <= budget)
+		return;
 
-	error = vkWaitForFences(vk_device, 1, &vk_img_fence, VK_TRUE, UINT64_MAX);
-	VKL_CHECK_VULKAN_ERROR(error);
+	std::vector<std::unordered_map<std::string, Entry>::iterator> unreferenced;
+	for (auto it = entries.begin(); it != entries.end(); it++)
+	{
+		if (it->second.texture.use_count() == 1)
+			unreferenced.push_back(it);
+	}
+	std::sort(unreferenced.begin(), unreferenced.end(), [](auto &a, auto &b)
+			  { return a->second.last_use < b->second.last_use; });
 
-	vkDestroyCommandPool(vk_device, vk_img_cmd_pool, nullptr);
-	vkDestroyFence(vk_device, vk_img_fence, nullptr);
-	for (auto &&buf : host_buffers)
+	for (auto &&it : unreferenced)
 	{
-		vklDestroyHostCoherentBufferAndItsBackingMemory(buf);
+		if (resident_size <= budget)
+			break;
+		resident_size -= it->second.texture->get_memory_size();
+		// The texture might still be used by frames in flight
+		frames->defer([device = this->device, texture = it->second.texture]
+					  { texture->destroy(device); });
+		entries.erase(it);
+	}
+
+	if (resident_size > budget)
+	{
+		VKL_WARNING("Referenced textures exceed the texture budget: " << resident_size << " > " << budget << " bytes");
 	}
-	return result;
 }
 
-VkSampler createSampler(VkDevice vk_device, VkFilter minFilter, VkFilter magFilter, VkSamplerMipmapMode mipmapMode)
+void TextureCache::destroy(VkDevice device)
+{
+	for (auto &&[path, entry] : entries)
+	{
+		entry.texture->destroy(device);
+	}
+	entries.clear();
+	resident_size = 0;
+}
+#pragma endregion
+
+#pragma region SamplerCache
+SamplerCache::SamplerCache(VkPhysicalDevice physical_device, VkDevice device)
+{
+	this->device = device;
+
+	// createVkDevice enables anisotropic filtering whenever the device supports it
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(physical_device, &features);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	anisotropy_supported = features.samplerAnisotropy == VK_TRUE;
+	max_anisotropy = properties.limits.maxSamplerAnisotropy;
+	max_lod_bias = properties.limits.maxSamplerLodBias;
+}
+
+VkSampler SamplerCache::get(const SamplerSettings &settings)
+{
+	for (auto &&[cached_settings, sampler] : samplers)
+	{
+		if (cached_settings == settings)
+			return sampler;
+	}
+
+	SamplerSettings clamped = settings;
+	if (clamped.max_anisotropy > 1.0f && !anisotropy_supported)
+	{
+		VKL_WARNING("Anisotropic filtering is not supported by the device, it is disabled");
+		clamped.max_anisotropy = 1.0f;
+	}
+	clamped.max_anisotropy = std::min(clamped.max_anisotropy, max_anisotropy);
+	clamped.lod_bias = std::clamp(clamped.lod_bias, -max_lod_bias, max_lod_bias);
+	clamped.max_lod = std::max(clamped.max_lod, clamped.min_lod);
+
+	// Cached under the requested settings, so requesting them again does not repeat the warnings
+	VkSampler sampler = createSampler(device, clamped);
+	samplers.push_back({settings, sampler});
+	return sampler;
+}
+
+void SamplerCache::destroy(VkDevice device)
+{
+	for (auto &&[settings, sampler] : samplers)
+	{
+		vkDestroySampler(device, sampler, nullptr);
+	}
+	samplers.clear();
+}
+#pragma endregion
+
+VkSampler createSampler(VkDevice vk_device, const SamplerSettings &settings)
 {
 	VkSampler sampler = VK_NULL_HANDLE;
 	VkSamplerCreateInfo sampler_create_info = {
 		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
 		.flags = 0,
-		.magFilter = minFilter,
-		.minFilter = magFilter,
-		.mipmapMode = mipmapMode,
-		.minLod = 0.0f,
-		.maxLod = VK_LOD_CLAMP_NONE,
+		.magFilter = settings.mag_filter,
+		.minFilter = settings.min_filter,
+		.mipmapMode = settings.mipmap_mode,
+		.addressModeU = settings.address_mode,
+		.addressModeV = settings.address_mode,
+		.addressModeW = settings.address_mode,
+		.mipLodBias = settings.lod_bias,
+		.anisotropyEnable = settings.max_anisotropy > 1.0f ? VK_TRUE : VK_FALSE,
+		.maxAnisotropy = std::max(settings.max_anisotropy, 1.0f),
+		.minLod = settings.min_lod,
+		.maxLod = settings.max_lod,
 	};
 	VkResult error = vkCreateSampler(vk_device, &sampler_create_info, nullptr, &sampler);
 	VKL_CHECK_VULKAN_ERROR(error);
 	return sampler;
-}
\ No newline at end of file
+}
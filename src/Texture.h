@@ -5,25 +5,169 @@
 #include <GLFW/glfw3.h>
 
 #include "MyUtils.h"
+#include "Staging.h"
+#include "Descriptors.h"
+#include "Frames.h"
+#include "Dds.h"
+#include "MappedFile.h"
 
 #include <vector>
 #include <algorithm>
 #include <iterator>
 #include <memory>
+#include <string>
+#include <unordered_map>
+
+// The memory mapped DDS or KTX2 file and its header, parsed once
+struct TextureFile
+{
+	std::string path;
+	DdsImage image;
+	std::unique_ptr<MappedFile> mapping;
+	// the levels of supercompressed files, empty if they are read from the mapping
+	std::vector<uint8_t> decoded;
+
+	const uint8_t *level_data(const DdsLevel &level) const
+	{
+		return (decoded.empty() ? mapping->data : decoded.data()) + level.offset;
+	}
+};
+
+struct TextureLoadOptions
+{
+	// Levels larger than this are skipped and left to a TextureStreamer, 0 loads all levels
+	uint32_t stream_base_size = 0;
+	// Uncompressed files are encoded to BC1 or BC3 once and loaded from the copy cached next to them
+	bool compress = false;
+};
 
 class Texture : public ITrash
 {
 private:
+	struct DescriptorBinding
+	{
+		std::shared_ptr<SwappableDescriptorSet> descriptor_set;
+		uint32_t binding;
+		VkSampler sampler;
+	};
+
 	VkImage image;
 	VkImageView view;
 	VkFormat format;
 	VkExtent2D extent;
+	uint32_t level_count;
+	// finest uploaded level, the view starts at this level so coarser levels are never sampled beyond it
+	uint32_t resident_level;
+	VkDeviceSize memory_size;
+	// descriptor sets which have to be rewritten when the view changes
+	std::vector<DescriptorBinding> bindings;
+
+	VkImageView create_view(VkDevice device);
+
+public:
+	// The file the levels finer than the resident level are streamed from, released once all levels are resident
+	std::unique_ptr<TextureFile> stream_source = nullptr;
+
+	Texture(VkDevice device, VkImage image, VkFormat format, VkExtent2D extent, uint32_t level_count, uint32_t resident_level, VkDeviceSize memory_size);
+	void destroy(VkDevice device);
+	// The descriptor set does not keep the texture alive, see TextureCache
+	void init_uniforms(VkDevice device, std::shared_ptr<SwappableDescriptorSet> descriptor_set, uint32_t binding, VkSampler sampler);
+	// Creates a view starting at level and swaps all descriptor sets to it, the old view is destroyed once the frames
+	// in flight completed. Returns false without changes if a descriptor set cannot be swapped yet.
+	bool set_resident_level(VkDevice device, uint32_t level, FrameRetirement &frames);
+	VkImage get_image()
+	{
+		return image;
+	}
+	VkExtent2D get_extent()
+	{
+		return extent;
+	}
+	uint32_t get_level_count()
+	{
+		return level_count;
+	}
+	uint32_t get_resident_level()
+	{
+		return resident_level;
+	}
+	VkDeviceSize get_memory_size()
+	{
+		return memory_size;
+	}
+};
+
+// Shares textures by their resolved file path. A texture is referenced while anyone but the cache holds its shared_ptr.
+// Descriptor sets do not count, so callers have to hold the shared_ptr as long as a descriptor set samples the texture.
+// Unreferenced textures stay resident until the total texture memory exceeds the budget, then the least recently
+// requested ones are evicted. Evicted textures are destroyed once the frames in flight completed.
+class TextureCache : public ITrash
+{
+private:
+	struct Entry
+	{
+		std::shared_ptr<Texture> texture;
+		uint64_t last_use;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::shared_ptr<StagingBuffer> staging = nullptr;
+	std::shared_ptr<FrameRetirement> frames = nullptr;
+	std::unordered_map<std::string, Entry> entries;
+	VkDeviceSize budget = 0;
+	VkDeviceSize resident_size = 0;
+	uint64_t use_counter = 0;
+	TextureLoadOptions options = {};
+
+public:
+	TextureCache(VkDevice device, std::shared_ptr<StagingBuffer> staging, std::shared_ptr<FrameRetirement> frames, VkDeviceSize budget, TextureLoadOptions options = {});
+
+	// Loads all textures that are not cached yet in one batch
+	std::vector<std::shared_ptr<Texture>> get(std::vector<std::string> names);
+	std::shared_ptr<Texture> get(std::string name);
+	// Evicts unreferenced textures until the resident size is within the budget
+	void trim();
+	void destroy(VkDevice device);
+};
+
+std::vector<std::shared_ptr<Texture>> createTextureImages(VkDevice vk_device, StagingBuffer &staging, std::vector<std::string> names);
+std::vector<std::shared_ptr<Texture>> createTextureImagesFromPaths(VkDevice vk_device, StagingBuffer &staging, std::vector<std::string> paths, TextureLoadOptions options = {});
+// Records the upload of the levels from first_level up to level_count, the staging buffer contains their tightly packed data.
+// Copies go to the transfer command buffer, mip generation and the transition for sampling to the graphics one.
+void recordTextureUpload(const StagingBuffer::Commands &cmds, VkImage vk_img, const DdsImage &dds, uint32_t first_level, uint32_t level_count, VkBuffer staging_buffer, VkDeviceSize staging_offset);
+
+// The complete state of a sampler, samplers with equal settings are shared
+struct SamplerSettings
+{
+	VkFilter mag_filter = VK_FILTER_LINEAR;
+	VkFilter min_filter = VK_FILTER_LINEAR;
+	VkSamplerMipmapMode mipmap_mode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	VkSamplerAddressMode address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	// values of 1 or less disable anisotropic filtering
+	float max_anisotropy = 1.0f;
+	float lod_bias = 0.0f;
+	float min_lod = 0.0f;
+	float max_lod = VK_LOD_CLAMP_NONE;
+
+	bool operator==(const SamplerSettings &other) const = default;
+};
+
+// Creates each distinct sampler once. Settings beyond the device limits are clamped when the sampler is created.
+class SamplerCache : public ITrash
+{
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	bool anisotropy_supported = false;
+	float max_anisotropy = 1.0f;
+	float max_lod_bias = 0.0f;
+	// there are only a few distinct samplers, a linear search is fast enough
+	std::vector<std::pair<SamplerSettings, VkSampler>> samplers;
 
 public:
-	Texture(VkImage image, VkFormat format, VkExtent2D extent, VkImageView view);
+	SamplerCache(VkPhysicalDevice physical_device, VkDevice device);
+
+	VkSampler get(const SamplerSettings &settings);
 	void destroy(VkDevice device);
-	void init_uniforms(VkDevice device, VkDescriptorSet descriptor_set, uint32_t binding, VkSampler sampler);
 };
 
-std::vector<std::shared_ptr<Texture>> createTextureImages(VkDevice vk_device, VkQueue vk_queue, uint32_t queue_family, std::vector<std::string> names);
-VkSampler createSampler(VkDevice vk_device, VkFilter minFilter, VkFilter magFilter, VkSamplerMipmapMode mipmapMode);
\ No newline at end of file
+VkSampler createSampler(VkDevice vk_device, const SamplerSettings &settings);
@@ -0,0 +1,88 @@
+#include "TextureStreaming.h"
+
+#include <cstring>
+#include <limits>
+
+#undef min
+#undef max
+
+#pragma region TextureStreamer
+TextureStreamer::TextureStreamer(VkDevice device, std::shared_ptr<FrameRetirement> frames, std::shared_ptr<StagingBuffer> staging, VkDeviceSize bytes_per_update)
+{
+	this->device = device;
+	this->frames = frames;
+	this->staging = staging;
+	this->bytes_per_update = bytes_per_update;
+}
+
+void TextureStreamer::request(std::shared_ptr<Texture> texture, float footprint)
+{
+	if (!texture->stream_source)
+		return;
+
+	// Level at which one texel covers about one pixel, assuming the texture is mapped once across the object
+	VkExtent2D extent = texture->get_extent();
+	float texels_per_pixel = float(std::max(extent.width, extent.height)) / std::max(footprint, 1.0f);
+	uint32_t level = uint32_t(std::clamp(std::floor(std::log2(std::max(texels_per_pixel, 1.0f))), 0.0f, float(texture->get_level_count() - 1)));
+
+	auto it = requests.find(texture);
+	if (it == requests.end())
+		requests[texture] = level;
+	else
+		it->second = std::min(it->second, level);
+}
+
+void TextureStreamer::update()
+{
+	// With a separate transfer family, a level is only complete once the graphics queue acquired and transitioned it,
+	// levels whose uploads are still running stay pending. So do those whose descriptor sets were swapped too recently.
+	for (auto it = pending.begin(); it != pending.end();)
+	{
+		bool done = staging->is_complete(it->serial) && (it->level >= it->texture->get_resident_level() || it->texture->set_resident_level(device, it->level, *frames));
+		if (done)
+			it = pending.erase(it);
+		else
+			it++;
+	}
+
+	VkDeviceSize uploaded = 0;
+	size_t first_new = pending.size();
+	for (auto &&[texture, level] : requests)
+	{
+		if (uploaded >= bytes_per_update)
+			break;
+		uint32_t resident_level = texture->get_resident_level();
+		if (level >= resident_level || !texture->stream_source)
+			continue;
+		if (std::any_of(pending.begin(), pending.end(), [&](auto &p)
+						{ return p.texture == texture; }))
+			continue;
+
+		// Levels are streamed one at a time from coarse to fine
+		uint32_t next_level = resident_level - 1;
+		const TextureFile &file = *texture->stream_source;
+		const DdsLevel &dds_level = file.image.levels[next_level];
+		StagingBuffer::Allocation staging_alloc = staging->allocate(dds_level.size);
+		std::memcpy(staging_alloc.data, file.level_data(dds_level), dds_level.size);
+		recordTextureUpload(staging->commands(), texture->get_image(), file.image, next_level, next_level + 1, staging_alloc.buffer, staging_alloc.offset);
+		pending.push_back({texture, next_level, 0});
+		uploaded += dds_level.size;
+	}
+	requests.clear();
+
+	if (first_new < pending.size())
+	{
+		uint64_t serial = staging->submit();
+		for (size_t i = first_new; i < pending.size(); i++)
+		{
+			pending[i].serial = serial;
+		}
+	}
+}
+
+void TextureStreamer::destroy(VkDevice device)
+{
+	requests.clear();
+	pending.clear();
+}
+#pragma endregion
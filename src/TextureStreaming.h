@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "MyUtils.h"
+#include "Camera.h"
+#include "Staging.h"
+#include "Texture.h"
+#include "Frames.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+
+// Streams the finer levels of textures which were loaded with a stream base size.
+// Every frame the footprint of each textured instance is requested, textures that need more detail than resident
+// get their next finer level uploaded. A texture's view switches to the new level once the upload completed, frames in
+// flight keep sampling the old view until they retire.
+class TextureStreamer : public ITrash
+{
+private:
+	struct PendingLevel
+	{
+		std::shared_ptr<Texture> texture;
+		uint32_t level;
+		uint64_t serial;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::shared_ptr<FrameRetirement> frames = nullptr;
+	std::shared_ptr<StagingBuffer> staging = nullptr;
+	VkDeviceSize bytes_per_update = 0;
+	// finest level requested for each texture since the last update
+	std::unordered_map<std::shared_ptr<Texture>, uint32_t> requests;
+	std::vector<PendingLevel> pending;
+
+public:
+	TextureStreamer(VkDevice device, std::shared_ptr<FrameRetirement> frames, std::shared_ptr<StagingBuffer> staging, VkDeviceSize bytes_per_update);
+
+	// footprint is the size of the textured object on screen in pixels
+	void request(std::shared_ptr<Texture> texture, float footprint);
+	// Switches textures to levels which completed uploading and starts the uploads of requested levels
+	void update();
+	void destroy(VkDevice device);
+};
+
@@ -4,8 +4,21 @@
 
 inline PFN_vkCmdPipelineBarrier2KHR __vkCmdPipelineBarrier2KHR;
 #define vkCmdPipelineBarrier2KHR __vkCmdPipelineBarrier2KHR
+inline PFN_vkQueueSubmit2KHR __vkQueueSubmit2KHR;
+#define vkQueueSubmit2KHR __vkQueueSubmit2KHR
+inline PFN_vkWaitSemaphoresKHR __vkWaitSemaphoresKHR;
+#define vkWaitSemaphoresKHR __vkWaitSemaphoresKHR
+inline PFN_vkGetSemaphoreCounterValueKHR __vkGetSemaphoreCounterValueKHR;
+#define vkGetSemaphoreCounterValueKHR __vkGetSemaphoreCounterValueKHR
+// nullptr if VK_KHR_draw_indirect_count is not supported
+inline PFN_vkCmdDrawIndexedIndirectCountKHR __vkCmdDrawIndexedIndirectCountKHR;
+#define vkCmdDrawIndexedIndirectCountKHR __vkCmdDrawIndexedIndirectCountKHR
 
 static void load_vulkan_extensions(VkDevice vk_device)
 {
 	__vkCmdPipelineBarrier2KHR = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(vkGetDeviceProcAddr(vk_device, "vkCmdPipelineBarrier2KHR"));
-}
\ No newline at end of file
+	__vkQueueSubmit2KHR = reinterpret_cast<PFN_vkQueueSubmit2KHR>(vkGetDeviceProcAddr(vk_device, "vkQueueSubmit2KHR"));
+	__vkWaitSemaphoresKHR = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(vk_device, "vkWaitSemaphoresKHR"));
+	__vkGetSemaphoreCounterValueKHR = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(vk_device, "vkGetSemaphoreCounterValueKHR"));
+	__vkCmdDrawIndexedIndirectCountKHR = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(vk_device, "vkCmdDrawIndexedIndirectCountKHR"));
+}